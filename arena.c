@@ -0,0 +1,64 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Bump allocator for fixed-size objects.
+ *
+ * Objects are carved out of zeroed chunks and are never freed one by one.
+ * Objects that hold memory of their own are registered with arena_own();
+ * arena_free() runs the release function over those only, then drops the
+ * chunks, so plain objects cost nothing at teardown.
+ */
+
+#define ARENA_CHUNK_BYTES (64 * 1024)
+
+struct arena_chunk {
+  arena_chunk_t *next;
+  char data[];
+};
+
+arena_t *arena_new(int obj_size) {
+  arena_t *arena = (arena_t *)malloc(sizeof (arena_t));
+  arena->obj_size = (obj_size + 7) & ~7;
+  arena->chunk_objs = max(1, ARENA_CHUNK_BYTES / arena->obj_size);
+  arena->chunks = NULL;
+  arena->p = arena->end = NULL;
+  arena->owners = vector_new();
+  return arena;
+}
+
+void *arena_alloc(arena_t *arena) {
+  if (arena->p == arena->end) {
+    int bytes = arena->obj_size * arena->chunk_objs;
+    arena_chunk_t *chunk = (arena_chunk_t *)calloc(1, sizeof (arena_chunk_t) + bytes);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->p = chunk->data;
+    arena->end = chunk->data + bytes;
+  }
+  void *obj = arena->p;
+  arena->p += arena->obj_size;
+  return obj;
+}
+
+// obj holds resources that the release function of arena_free() must drop
+void arena_own(arena_t *arena, void *obj) {
+  vector_push(arena->owners, obj);
+}
+
+void arena_free(arena_t *arena, void (*release_fn)(void *)) {
+  if (release_fn != NULL) {
+    for (int i = 0; i < arena->owners->size; i++) {
+      (*release_fn)(arena->owners->data[i]);
+    }
+  }
+  vector_free(arena->owners);
+  arena_chunk_t *next;
+  for (arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(arena);
+}
@@ -0,0 +1,1246 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <ctype.h>
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hcc.h"
+
+/*
+ * Built-in x86-64 assembler.
+ *
+ * Encodes the instruction records buffered by emit.c straight into an ELF64
+ * relocatable object. It only knows the instructions and directives gen.c
+ * produces. Every branch is encoded with a 32-bit displacement, so offsets
+ * are final after one pass; label references are recorded as relocations
+ * and the ones that stay inside a section are patched once every label is
+ * known. The rest are written out as R_X86_64_PC32, R_X86_64_PLT32 or
+ * R_X86_64_64 relocations.
+ */
+
+enum {
+  SECTION_TEXT,
+  SECTION_DATA,
+  SECTION_RODATA,
+  SECTION_NUM,
+};
+
+// section header indexes of the object file
+enum {
+  SHNDX_NULL,
+  SHNDX_TEXT,
+  SHNDX_DATA,
+  SHNDX_RODATA,
+  SHNDX_RELA_TEXT,
+  SHNDX_RELA_DATA,
+  SHNDX_RELA_RODATA,
+  SHNDX_SYMTAB,
+  SHNDX_STRTAB,
+  SHNDX_SHSTRTAB,
+  SHNDX_NOTE_STACK,
+  SHNDX_NUM,
+};
+
+enum {
+  OPERAND_REG,
+  OPERAND_XMM,
+  OPERAND_IMM,
+  OPERAND_MEM,
+  OPERAND_SYM,
+};
+
+#define BASE_NONE -1
+#define BASE_RIP  -2
+
+#define REX_W     0x48
+#define REX_FORCE 0x40
+
+typedef struct bytes bytes_t;
+struct bytes {
+  unsigned char *p;
+  int size;
+  int capacity;
+};
+
+typedef struct symbol symbol_t;
+struct symbol {
+  char *name;
+  int section; // -1 while undefined
+  long value;
+  bool global;
+  int index;   // symbol table index, assigned when the object is written
+};
+
+typedef struct reloc reloc_t;
+struct reloc {
+  int offset;
+  symbol_t *sym;
+  int type;
+  long addend;
+};
+
+typedef struct section section_t;
+struct section {
+  char *name;
+  bytes_t data;
+  int align;
+  vector_t *relocs;
+  symbol_t sym;
+};
+
+typedef struct operand operand_t;
+struct operand {
+  int kind;
+  int reg;        // register number, or the base of a memory operand
+  int size;       // register width in bytes
+  int index;
+  int scale;
+  long disp;      // immediate value or displacement
+  symbol_t *sym;  // %rip-relative symbol or branch target
+  bool indirect;  // "*" prefix of jmp and call
+};
+
+static section_t sections[SECTION_NUM];
+static section_t *cur;
+static map_t *symbols;
+static vector_t *symbol_list;
+
+enum {
+  INS_SIMPLE,   // fixed encoding without operands
+  INS_REP,
+  INS_ALU,      // add, or, adc, sbb, and, sub, xor and cmp
+  INS_MOV,
+  INS_MOVQ,     // mov, or a move between general purpose and xmm registers
+  INS_LEA,
+  INS_TEST,
+  INS_XCHG,
+  INS_PUSH,
+  INS_POP,
+  INS_IMUL,
+  INS_UNARY,    // mul, div, idiv, neg and not
+  INS_SHIFT,
+  INS_MOVX,     // zero and sign extending moves
+  INS_SSE,      // scalar and packed "op xmm/mem, xmm"
+  INS_SSE_IMM,  // "op $imm8, xmm/mem, xmm"
+  INS_CVT_INT,  // xmm to general purpose register conversions
+  INS_CVT_FP,   // general purpose register to xmm conversions
+  INS_JMP,
+  INS_CALL,
+  INS_JCC,
+  INS_SETCC,
+};
+
+typedef struct mnemonic mnemonic_t;
+struct mnemonic {
+  int kind;
+  int code;    // opcode, opcode extension or condition code
+  int size;    // operand size given by the suffix, 0 to take the registers'
+  int prefix;
+  int store;   // opcode of the "op xmm, mem" form of INS_SSE, 0 if none
+  int from;    // source size of INS_MOVX
+};
+
+// both tables are built on first use and live for the whole compilation
+static map_t *mnemonics;
+static map_t *registers;
+
+static const char *gpr_names[4][16] = {
+  {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+   "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+  {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+   "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+  {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+   "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+  {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+   "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"},
+};
+
+static const struct { char *name; int code; } conds[] = {
+  {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2}, {"ae", 3}, {"nb", 3},
+  {"nc", 3}, {"e", 4}, {"z", 4}, {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6},
+  {"a", 7}, {"nbe", 7}, {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11},
+  {"po", 11}, {"l", 12}, {"nge", 12}, {"ge", 13}, {"nl", 13}, {"le", 14},
+  {"ng", 14}, {"g", 15}, {"nle", 15}, {NULL, 0},
+};
+
+// integer instructions, also accepted with a b/w/l/q size suffix
+static const struct { char *name; int kind; int code; } int_ops[] = {
+  {"add", INS_ALU, 0}, {"or", INS_ALU, 1}, {"adc", INS_ALU, 2}, {"sbb", INS_ALU, 3},
+  {"and", INS_ALU, 4}, {"sub", INS_ALU, 5}, {"xor", INS_ALU, 6}, {"cmp", INS_ALU, 7},
+  {"mov", INS_MOV, 0}, {"lea", INS_LEA, 0x8d}, {"test", INS_TEST, 0}, {"xchg", INS_XCHG, 0},
+  {"push", INS_PUSH, 0}, {"pop", INS_POP, 0}, {"imul", INS_IMUL, 5}, {"mul", INS_UNARY, 4},
+  {"div", INS_UNARY, 6}, {"idiv", INS_UNARY, 7}, {"neg", INS_UNARY, 3}, {"not", INS_UNARY, 2},
+  {"sal", INS_SHIFT, 4}, {"shl", INS_SHIFT, 4}, {"shr", INS_SHIFT, 5}, {"sar", INS_SHIFT, 7},
+  {NULL, 0, 0},
+};
+
+static const struct { char *name; int prefix; int opcode; int store; } sse_ops[] = {
+  {"movss", 0xf3, 0x0f10, 0x0f11},
+  {"movsd", 0xf2, 0x0f10, 0x0f11},
+  {"addss", 0xf3, 0x0f58, 0},
+  {"addsd", 0xf2, 0x0f58, 0},
+  {"mulss", 0xf3, 0x0f59, 0},
+  {"mulsd", 0xf2, 0x0f59, 0},
+  {"subss", 0xf3, 0x0f5c, 0},
+  {"subsd", 0xf2, 0x0f5c, 0},
+  {"divss", 0xf3, 0x0f5e, 0},
+  {"divsd", 0xf2, 0x0f5e, 0},
+  {"ucomiss", 0, 0x0f2e, 0},
+  {"ucomisd", 0x66, 0x0f2e, 0},
+  {"xorps", 0, 0x0f57, 0},
+  {"xorpd", 0x66, 0x0f57, 0},
+  {"cvtss2sd", 0xf3, 0x0f5a, 0},
+  {"cvtsd2ss", 0xf2, 0x0f5a, 0},
+  {"movaps", 0, 0x0f28, 0x0f29},
+  {"movups", 0, 0x0f10, 0x0f11},
+  {"movupd", 0x66, 0x0f10, 0x0f11},
+  {"movdqu", 0xf3, 0x0f6f, 0x0f7f},
+  {"addps", 0, 0x0f58, 0},
+  {"addpd", 0x66, 0x0f58, 0},
+  {"mulps", 0, 0x0f59, 0},
+  {"mulpd", 0x66, 0x0f59, 0},
+  {"subps", 0, 0x0f5c, 0},
+  {"subpd", 0x66, 0x0f5c, 0},
+  {"divps", 0, 0x0f5e, 0},
+  {"divpd", 0x66, 0x0f5e, 0},
+  {"paddd", 0x66, 0x0ffe, 0},
+  {"psubd", 0x66, 0x0ffa, 0},
+  {"pmuludq", 0x66, 0x0ff4, 0},
+  {"pand", 0x66, 0x0fdb, 0},
+  {"pandn", 0x66, 0x0fdf, 0},
+  {"por", 0x66, 0x0feb, 0},
+  {"pxor", 0x66, 0x0fef, 0},
+  {"pcmpgtd", 0x66, 0x0f66, 0},
+  {"punpckldq", 0x66, 0x0f62, 0},
+  {NULL, 0, 0, 0},
+};
+
+static void bytes_reserve(bytes_t *b, int n) {
+  if (b->size + n <= b->capacity) {
+    return;
+  }
+  b->capacity = max(b->capacity * 2, b->size + n);
+  b->p = (unsigned char *)realloc(b->p, b->capacity);
+}
+
+static void bytes_append(bytes_t *b, const void *p, int len) {
+  if (len == 0) {
+    return;
+  }
+  bytes_reserve(b, len);
+  memcpy(b->p + b->size, p, len);
+  b->size += len;
+}
+
+static void bytes_fill(bytes_t *b, int c, int len) {
+  if (len == 0) {
+    return;
+  }
+  bytes_reserve(b, len);
+  memset(b->p + b->size, c, len);
+  b->size += len;
+}
+
+static void bytes_align(bytes_t *b, int align) {
+  bytes_fill(b, 0, (align - b->size % align) % align);
+}
+
+static void emit8(int v) {
+  unsigned char c = v;
+  bytes_append(&cur->data, &c, 1);
+}
+
+// little-endian, as is the host
+static void emit_imm(long v, int size) {
+  bytes_append(&cur->data, &v, size);
+}
+
+static bool fits8(long v) {
+  return v >= -128 && v <= 127;
+}
+
+static bool fits32(long v) {
+  return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+static symbol_t *symbol_get(char *name) {
+  char *atom = atom_new(name);
+  symbol_t *sym = (symbol_t *)map_get(symbols, atom);
+  if (sym == NULL) {
+    sym = (symbol_t *)calloc(1, sizeof (symbol_t));
+    sym->name = atom;
+    sym->section = -1;
+    map_add(symbols, atom, sym);
+    vector_push(symbol_list, sym);
+  }
+  return sym;
+}
+
+static bool symbol_is_label(symbol_t *sym) {
+  return strncmp(sym->name, ".L", 2) == 0;
+}
+
+static void add_reloc(int offset, symbol_t *sym, int type, long addend) {
+  reloc_t *r = (reloc_t *)malloc(sizeof (reloc_t));
+  r->offset = offset;
+  r->sym = sym;
+  r->type = type;
+  r->addend = addend;
+  vector_push(cur->relocs, r);
+}
+
+static mnemonic_t *add_mnemonic(char *name, int kind, int code, int size) {
+  char *atom = atom_new(name);
+  mnemonic_t *m = (mnemonic_t *)map_get(mnemonics, atom);
+  if (m != NULL) {
+    return m;
+  }
+  m = (mnemonic_t *)calloc(1, sizeof (mnemonic_t));
+  m->kind = kind;
+  m->code = code;
+  m->size = size;
+  map_add(mnemonics, atom, m);
+  return m;
+}
+
+static void add_register(char *name, int kind, int reg, int size) {
+  operand_t *op = (operand_t *)calloc(1, sizeof (operand_t));
+  op->kind = kind;
+  op->reg = reg;
+  op->size = size;
+  map_add(registers, atom_new(name), op);
+}
+
+static void init_tables(void) {
+  char name[16];
+  mnemonics = map_new();
+  registers = map_new();
+
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 16; j++) {
+      add_register((char *)gpr_names[i][j], OPERAND_REG, j, 1 << i);
+    }
+  }
+  for (int i = 0; i < 16; i++) {
+    sprintf(name, "xmm%d", i);
+    add_register(name, OPERAND_XMM, i, 16);
+  }
+
+  static const struct { char *name; int code; } simple[] = {
+    {"ret", 0xc3}, {"leave", 0xc9}, {"nop", 0x90}, {"cltd", 0x99},
+    {"cqto", 0x4899}, {"cqo", 0x4899}, {"cltq", 0x4898}, {"cdqe", 0x4898},
+    {NULL, 0},
+  };
+  for (int i = 0; simple[i].name != NULL; i++) {
+    add_mnemonic(simple[i].name, INS_SIMPLE, simple[i].code, 0);
+  }
+  add_mnemonic("rep", INS_REP, 0, 0);
+  add_mnemonic("movq", INS_MOVQ, 0, 8);
+  add_mnemonic("movd", INS_MOVQ, 0, 4);
+  add_mnemonic("jmp", INS_JMP, 0, 0);
+  add_mnemonic("jmpq", INS_JMP, 0, 0);
+  add_mnemonic("call", INS_CALL, 0, 0);
+  add_mnemonic("callq", INS_CALL, 0, 0);
+  for (int i = 0; int_ops[i].name != NULL; i++) {
+    add_mnemonic(int_ops[i].name, int_ops[i].kind, int_ops[i].code, 0);
+    for (int j = 0; j < 4; j++) {
+      sprintf(name, "%s%c", int_ops[i].name, "bwlq"[j]);
+      add_mnemonic(name, int_ops[i].kind, int_ops[i].code, 1 << j);
+    }
+  }
+  for (int i = 0; conds[i].name != NULL; i++) {
+    sprintf(name, "j%s", conds[i].name);
+    add_mnemonic(name, INS_JCC, conds[i].code, 0);
+    sprintf(name, "set%s", conds[i].name);
+    add_mnemonic(name, INS_SETCC, conds[i].code, 1);
+  }
+  for (int i = 0; sse_ops[i].name != NULL; i++) {
+    mnemonic_t *m = add_mnemonic(sse_ops[i].name, INS_SSE, sse_ops[i].opcode, 0);
+    m->prefix = sse_ops[i].prefix;
+    m->store = sse_ops[i].store;
+  }
+  add_mnemonic("pshufd", INS_SSE_IMM, 0x0f70, 0)->prefix = 0x66;
+  // movzb, movzbl, movsbq, movzwq, ... and movslq
+  for (int sign = 0; sign < 2; sign++) {
+    for (int from = 1; from <= 2; from *= 2) {
+      for (int to = 0; to <= 8; to = to == 0 ? from * 2 : to * 2) {
+        sprintf(name, "mov%c%c%s", sign ? 's' : 'z', from == 1 ? 'b' : 'w',
+                to == 0 ? "" : to == 2 ? "w" : to == 4 ? "l" : "q");
+        mnemonic_t *m = add_mnemonic(name, INS_MOVX, sign ? (from == 1 ? 0x0fbe : 0x0fbf) : (from == 1 ? 0x0fb6 : 0x0fb7), to);
+        m->from = from;
+      }
+    }
+  }
+  add_mnemonic("movslq", INS_MOVX, 0x63, 8)->from = 4;
+  static const struct { char *name; int prefix; int opcode; } cvt_ints[] = {
+    {"cvttsd2si", 0xf2, 0x0f2c}, {"cvttss2si", 0xf3, 0x0f2c},
+    {"cvtsd2si", 0xf2, 0x0f2d}, {"cvtss2si", 0xf3, 0x0f2d},
+    {NULL, 0, 0},
+  };
+  for (int i = 0; cvt_ints[i].name != NULL; i++) {
+    add_mnemonic(cvt_ints[i].name, INS_CVT_INT, cvt_ints[i].opcode, 0)->prefix = cvt_ints[i].prefix;
+  }
+  for (int i = 0; i < 3; i++) {
+    char *suffix = i == 0 ? "" : i == 1 ? "l" : "q";
+    sprintf(name, "cvtsi2sd%s", suffix);
+    add_mnemonic(name, INS_CVT_FP, 0x0f2a, i * 4)->prefix = 0xf2;
+    sprintf(name, "cvtsi2ss%s", suffix);
+    add_mnemonic(name, INS_CVT_FP, 0x0f2a, i * 4)->prefix = 0xf3;
+  }
+}
+
+/*
+ * Operands
+ */
+
+static int parse_reg(char *name, operand_t *op) {
+  operand_t *reg = (operand_t *)map_get(registers, atom_new(name));
+  if (reg == NULL) {
+    return false;
+  }
+  op->kind = reg->kind;
+  op->reg = reg->reg;
+  op->size = reg->size;
+  return true;
+}
+
+static int parse_base(char *s, char *e) {
+  char name[8];
+  operand_t op;
+  if (e - s < 2 || e - s >= (int)sizeof (name) || *s != '%') {
+    return BASE_NONE;
+  }
+  memcpy(name, s + 1, e - s - 1);
+  name[e - s - 1] = '\0';
+  if (strcmp(name, "rip") == 0) {
+    return BASE_RIP;
+  }
+  if (!parse_reg(name, &op) || op.kind != OPERAND_REG || op.size != 8) {
+    errorf("internal error: invalid base register %s", name);
+  }
+  return op.reg;
+}
+
+// "sym", "sym+8", "-16" or empty
+static void parse_disp(char *s, char *e, operand_t *op) {
+  op->disp = 0;
+  op->sym = NULL;
+  if (s == e) {
+    return;
+  }
+  if (!isdigit(*s) && *s != '-' && *s != '+') {
+    char *p = s;
+    while (p < e && *p != '+' && *p != '-') {
+      p++;
+    }
+    op->sym = symbol_get(atom_new_with_len(s, p - s));
+    s = p;
+    if (s == e) {
+      return;
+    }
+  }
+  char *end;
+  op->disp = strtol(s, &end, 0);
+  if (end != e) {
+    errorf("internal error: invalid displacement %s", s);
+  }
+}
+
+static void parse_operand(char *s, operand_t *op) {
+  memset(op, 0, sizeof (operand_t));
+  op->reg = op->index = BASE_NONE;
+  if (*s == '*') {
+    op->indirect = true;
+    s++;
+  }
+  if (*s == '%') {
+    if (!parse_reg(s + 1, op)) {
+      errorf("internal error: unknown register %s", s);
+    }
+    return;
+  }
+  if (*s == '$') {
+    char *end;
+    op->kind = OPERAND_IMM;
+    op->disp = strtol(s + 1, &end, 0);
+    if (*end != '\0') {
+      errorf("internal error: invalid immediate %s", s);
+    }
+    return;
+  }
+  char *paren = strchr(s, '(');
+  if (paren == NULL) {
+    op->kind = OPERAND_SYM;
+    op->sym = symbol_get(s);
+    return;
+  }
+  op->kind = OPERAND_MEM;
+  parse_disp(s, paren, op);
+  char *p = paren + 1;
+  char *close = strchr(p, ')');
+  if (close == NULL) {
+    errorf("internal error: invalid memory operand %s", s);
+  }
+  char *comma = memchr(p, ',', close - p);
+  op->reg = parse_base(p, comma ? comma : close);
+  if (comma != NULL) {
+    p = comma + 1;
+    comma = memchr(p, ',', close - p);
+    op->index = parse_base(p, comma ? comma : close);
+    op->scale = comma ? atoi(comma + 1) : 1;
+  }
+  if (op->reg == BASE_NONE || (op->sym != NULL && op->reg != BASE_RIP) ||
+      (op->reg == BASE_RIP && op->index != BASE_NONE)) {
+    errorf("internal error: unsupported memory operand %s", s);
+  }
+}
+
+/*
+ * Encoding
+ */
+
+static bool needs_rex8(operand_t *op) {
+  return op != NULL && op->kind == OPERAND_REG && op->size == 1 && op->reg >= 4 && op->reg < 8;
+}
+
+// REX is also needed to address spl, bpl, sil and dil
+static int rex_for(int size, operand_t *a, operand_t *b) {
+  int rex = size == 8 ? REX_W : 0;
+  if (needs_rex8(a) || needs_rex8(b)) {
+    rex |= REX_FORCE;
+  }
+  return rex;
+}
+
+static void emit_opcode(int opcode) {
+  if (opcode > 0xffff) {
+    emit8(opcode >> 16);
+  }
+  if (opcode > 0xff) {
+    emit8(opcode >> 8);
+  }
+  emit8(opcode);
+}
+
+static void emit_modrm(int reg, operand_t *rm, int imm_size) {
+  reg &= 7;
+  if (rm->kind != OPERAND_MEM) {
+    emit8(0xc0 | reg << 3 | (rm->reg & 7));
+    return;
+  }
+  if (rm->reg == BASE_RIP) {
+    emit8(reg << 3 | 5);
+    add_reloc(cur->data.size, rm->sym, R_X86_64_PC32, rm->disp - 4 - imm_size);
+    emit_imm(0, 4);
+    return;
+  }
+  int base = rm->reg & 7;
+  int mod = 2;
+  if (rm->disp == 0 && base != 5) {
+    mod = 0;
+  } else if (fits8(rm->disp)) {
+    mod = 1;
+  }
+  if (rm->index != BASE_NONE || base == 4) {
+    int index = rm->index == BASE_NONE ? 4 : rm->index & 7;
+    int scale;
+    switch (rm->scale) {
+    case 0:
+    case 1: scale = 0; break;
+    case 2: scale = 1; break;
+    case 4: scale = 2; break;
+    case 8: scale = 3; break;
+    default:
+      errorf("internal error: invalid scale %d", rm->scale);
+    }
+    emit8(mod << 6 | reg << 3 | 4);
+    emit8(scale << 6 | index << 3 | base);
+  } else {
+    emit8(mod << 6 | reg << 3 | base);
+  }
+  if (mod == 1) {
+    emit_imm(rm->disp, 1);
+  } else if (mod == 2) {
+    emit_imm(rm->disp, 4);
+  }
+}
+
+static void encode(int prefix, int rex, int opcode, int reg, operand_t *rm, int imm_size, long imm) {
+  if (rm->kind == OPERAND_MEM) {
+    if (rm->index >= 8) {
+      rex |= 0x42;
+    }
+    if (rm->reg >= 8) {
+      rex |= 0x41;
+    }
+  } else if (rm->reg >= 8) {
+    rex |= 0x41;
+  }
+  if (reg >= 8) {
+    rex |= 0x44;
+  }
+  if (prefix) {
+    emit8(prefix);
+  }
+  if (rex) {
+    emit8(rex | 0x40);
+  }
+  emit_opcode(opcode);
+  emit_modrm(reg, rm, imm_size);
+  if (imm_size > 0) {
+    emit_imm(imm, imm_size);
+  }
+}
+
+// opcodes that carry the register in their low bits, like push and pop
+static void encode_plus(int prefix, int rex, int opcode, int reg) {
+  if (reg >= 8) {
+    rex |= 0x41;
+  }
+  if (prefix) {
+    emit8(prefix);
+  }
+  if (rex) {
+    emit8(rex | 0x40);
+  }
+  emit8(opcode + (reg & 7));
+}
+
+static void encode_branch(int opcode, symbol_t *target, int type) {
+  emit_opcode(opcode);
+  add_reloc(cur->data.size, target, type, -4);
+  emit_imm(0, 4);
+}
+
+static noreturn void unsupported(inst_t *inst) {
+  errorf("internal error: cannot assemble %s%s%s%s%s", inst->op,
+         inst->nargs > 0 ? " " : "", inst->nargs > 0 ? inst->args[0] : "",
+         inst->nargs > 1 ? ", " : "", inst->nargs > 1 ? inst->args[1] : "");
+}
+
+static bool is_rm(operand_t *op) {
+  return op->kind == OPERAND_REG || op->kind == OPERAND_MEM;
+}
+
+static bool is_xmm_rm(operand_t *op) {
+  return op->kind == OPERAND_XMM || op->kind == OPERAND_MEM;
+}
+
+static void asm_alu(inst_t *inst, int ext, int size, operand_t *src, operand_t *dst) {
+  int prefix = size == 2 ? 0x66 : 0;
+  int rex = rex_for(size, src, dst);
+  if (src->kind == OPERAND_IMM && is_rm(dst)) {
+    if (size == 1) {
+      encode(prefix, rex, 0x80, ext, dst, 1, src->disp);
+    } else if (fits8(src->disp)) {
+      encode(prefix, rex, 0x83, ext, dst, 1, src->disp);
+    } else if (fits32(src->disp)) {
+      encode(prefix, rex, 0x81, ext, dst, size == 2 ? 2 : 4, src->disp);
+    } else {
+      unsupported(inst);
+    }
+  } else if (src->kind == OPERAND_REG && is_rm(dst)) {
+    encode(prefix, rex, ext * 8 + (size == 1 ? 0 : 1), src->reg, dst, 0, 0);
+  } else if (src->kind == OPERAND_MEM && dst->kind == OPERAND_REG) {
+    encode(prefix, rex, ext * 8 + (size == 1 ? 2 : 3), dst->reg, src, 0, 0);
+  } else {
+    unsupported(inst);
+  }
+}
+
+static void asm_mov(inst_t *inst, int size, operand_t *src, operand_t *dst) {
+  int prefix = size == 2 ? 0x66 : 0;
+  int rex = rex_for(size, src, dst);
+  if (src->kind == OPERAND_IMM && dst->kind == OPERAND_REG) {
+    if (size == 8 && !fits32(src->disp)) {
+      encode_plus(0, rex, 0xb8, dst->reg);
+      emit_imm(src->disp, 8);
+    } else if (size == 8) {
+      encode(0, rex, 0xc7, 0, dst, 4, src->disp);
+    } else {
+      encode_plus(prefix, rex, size == 1 ? 0xb0 : 0xb8, dst->reg);
+      emit_imm(src->disp, size);
+    }
+  } else if (src->kind == OPERAND_IMM && dst->kind == OPERAND_MEM) {
+    if (!fits32(src->disp)) {
+      unsupported(inst);
+    }
+    encode(prefix, rex, size == 1 ? 0xc6 : 0xc7, 0, dst, min(size, 4), src->disp);
+  } else if (src->kind == OPERAND_REG && is_rm(dst)) {
+    encode(prefix, rex, size == 1 ? 0x88 : 0x89, src->reg, dst, 0, 0);
+  } else if (src->kind == OPERAND_MEM && dst->kind == OPERAND_REG) {
+    encode(prefix, rex, size == 1 ? 0x8a : 0x8b, dst->reg, src, 0, 0);
+  } else {
+    unsupported(inst);
+  }
+}
+
+static void asm_rep(inst_t *inst) {
+  if (inst->nargs != 1) {
+    unsupported(inst);
+  }
+  emit8(0xf3);
+  if (strcmp(inst->args[0], "movsb") == 0) {
+    emit8(0xa4);
+  } else if (strcmp(inst->args[0], "movsq") == 0) {
+    emit8(REX_W);
+    emit8(0xa5);
+  } else if (strcmp(inst->args[0], "stosb") == 0) {
+    emit8(0xaa);
+  } else {
+    unsupported(inst);
+  }
+}
+
+static void asm_inst(inst_t *inst) {
+  mnemonic_t *m = (mnemonic_t *)map_get(mnemonics, atom_new(inst->op));
+  if (m == NULL) {
+    unsupported(inst);
+  }
+  if (m->kind == INS_SIMPLE) {
+    if (inst->nargs != 0) {
+      unsupported(inst);
+    }
+    emit_opcode(m->code);
+    return;
+  }
+  if (m->kind == INS_REP) {
+    asm_rep(inst);
+    return;
+  }
+  if (inst->nargs == 0) {
+    unsupported(inst);
+  }
+
+  operand_t ops[EMIT_MAX_ARGS];
+  for (int i = 0; i < inst->nargs; i++) {
+    parse_operand(inst->args[i], &ops[i]);
+  }
+  operand_t *src = &ops[0], *dst = &ops[inst->nargs - 1];
+  int size = m->size;
+  for (int i = inst->nargs - 1; size == 0 && i >= 0; i--) {
+    if (ops[i].kind == OPERAND_REG) {
+      size = ops[i].size;
+    }
+  }
+  int prefix = size == 2 ? 0x66 : 0;
+  int rex = rex_for(size, src, dst);
+
+  switch (m->kind) {
+  case INS_JMP:
+  case INS_CALL:
+  case INS_JCC:
+    if (inst->nargs != 1) {
+      unsupported(inst);
+    }
+    if (src->indirect) {
+      if (!is_rm(src) || m->kind == INS_JCC) {
+        unsupported(inst);
+      }
+      encode(0, 0, 0xff, m->kind == INS_CALL ? 2 : 4, src, 0, 0);
+    } else if (src->kind != OPERAND_SYM) {
+      unsupported(inst);
+    } else if (m->kind == INS_CALL) {
+      encode_branch(0xe8, src->sym, R_X86_64_PLT32);
+    } else if (m->kind == INS_JMP) {
+      encode_branch(0xe9, src->sym, R_X86_64_PC32);
+    } else {
+      encode_branch(0x0f80 + m->code, src->sym, R_X86_64_PC32);
+    }
+    return;
+  case INS_SETCC:
+    if (inst->nargs != 1 || !is_rm(src) || (src->kind == OPERAND_REG && src->size != 1)) {
+      unsupported(inst);
+    }
+    encode(0, rex_for(1, src, NULL), 0x0f90 + m->code, 0, src, 0, 0);
+    return;
+  case INS_SSE:
+    if (inst->nargs != 2) {
+      unsupported(inst);
+    }
+    if (dst->kind == OPERAND_XMM && is_xmm_rm(src)) {
+      encode(m->prefix, 0, m->code, dst->reg, src, 0, 0);
+    } else if (m->store && src->kind == OPERAND_XMM && dst->kind == OPERAND_MEM) {
+      encode(m->prefix, 0, m->store, src->reg, dst, 0, 0);
+    } else {
+      unsupported(inst);
+    }
+    return;
+  case INS_SSE_IMM:
+    if (inst->nargs != 3 || src->kind != OPERAND_IMM || dst->kind != OPERAND_XMM || !is_xmm_rm(&ops[1])) {
+      unsupported(inst);
+    }
+    encode(m->prefix, 0, m->code, dst->reg, &ops[1], 1, src->disp);
+    return;
+  case INS_CVT_INT:
+    if (inst->nargs != 2 || dst->kind != OPERAND_REG || dst->size < 4 || !is_xmm_rm(src)) {
+      unsupported(inst);
+    }
+    encode(m->prefix, dst->size == 8 ? REX_W : 0, m->code, dst->reg, src, 0, 0);
+    return;
+  case INS_CVT_FP:
+    size = m->size ? m->size : src->size;
+    if (inst->nargs != 2 || dst->kind != OPERAND_XMM || !is_rm(src) || size < 4) {
+      unsupported(inst);
+    }
+    encode(m->prefix, size == 8 ? REX_W : 0, m->code, dst->reg, src, 0, 0);
+    return;
+  case INS_MOVQ:
+    if (inst->nargs == 2 && dst->kind == OPERAND_XMM && is_rm(src)) {
+      encode(0x66, m->size == 8 ? REX_W : 0, 0x0f6e, dst->reg, src, 0, 0);
+      return;
+    }
+    if (inst->nargs == 2 && src->kind == OPERAND_XMM && is_rm(dst)) {
+      encode(0x66, m->size == 8 ? REX_W : 0, 0x0f7e, src->reg, dst, 0, 0);
+      return;
+    }
+    // fall through to a plain mov
+  case INS_MOV:
+    if (inst->nargs != 2 || size == 0) {
+      unsupported(inst);
+    }
+    asm_mov(inst, size, src, dst);
+    return;
+  case INS_MOVX:
+    size = m->size ? m->size : dst->size;
+    if (inst->nargs != 2 || dst->kind != OPERAND_REG || !is_rm(src) || size <= m->from) {
+      unsupported(inst);
+    }
+    encode(size == 2 ? 0x66 : 0, rex_for(size, src, NULL), m->code, dst->reg, src, 0, 0);
+    return;
+  }
+
+  if (size == 0 && (m->kind == INS_PUSH || m->kind == INS_POP)) {
+    size = 8;
+  }
+  if (size == 0) {
+    unsupported(inst);
+  }
+  switch (m->kind) {
+  case INS_ALU:
+    if (inst->nargs != 2) {
+      unsupported(inst);
+    }
+    asm_alu(inst, m->code, size, src, dst);
+    break;
+  case INS_LEA:
+    if (inst->nargs != 2 || src->kind != OPERAND_MEM || dst->kind != OPERAND_REG) {
+      unsupported(inst);
+    }
+    encode(prefix, rex, m->code, dst->reg, src, 0, 0);
+    break;
+  case INS_TEST:
+  case INS_XCHG:
+    if (inst->nargs != 2) {
+      unsupported(inst);
+    }
+    if (src->kind == OPERAND_REG && is_rm(dst)) {
+      encode(prefix, rex, (m->kind == INS_TEST ? 0x84 : 0x86) + (size == 1 ? 0 : 1), src->reg, dst, 0, 0);
+    } else if (m->kind == INS_TEST && src->kind == OPERAND_IMM && is_rm(dst) && fits32(src->disp)) {
+      encode(prefix, rex, size == 1 ? 0xf6 : 0xf7, 0, dst, min(size, 4), src->disp);
+    } else {
+      unsupported(inst);
+    }
+    break;
+  case INS_PUSH:
+  case INS_POP: {
+    bool push = m->kind == INS_PUSH;
+    if (inst->nargs != 1 || size != 8) {
+      unsupported(inst);
+    }
+    if (src->kind == OPERAND_REG) {
+      encode_plus(0, 0, push ? 0x50 : 0x58, src->reg);
+    } else if (src->kind == OPERAND_MEM) {
+      encode(0, 0, push ? 0xff : 0x8f, push ? 6 : 0, src, 0, 0);
+    } else if (push && src->kind == OPERAND_IMM && fits32(src->disp)) {
+      emit8(fits8(src->disp) ? 0x6a : 0x68);
+      emit_imm(src->disp, fits8(src->disp) ? 1 : 4);
+    } else {
+      unsupported(inst);
+    }
+    break;
+  }
+  case INS_IMUL:
+    if (inst->nargs >= 2) {
+      // "imul $imm, %reg" is short for "imul $imm, %reg, %reg"
+      operand_t *rm = inst->nargs == 3 ? &ops[1] : dst;
+      if (dst->kind != OPERAND_REG || size == 1) {
+        unsupported(inst);
+      }
+      if (src->kind == OPERAND_IMM && is_rm(rm) && fits32(src->disp)) {
+        bool short_imm = fits8(src->disp);
+        encode(prefix, rex, short_imm ? 0x6b : 0x69, dst->reg, rm, short_imm ? 1 : min(size, 4), src->disp);
+      } else if (inst->nargs == 2 && is_rm(src)) {
+        encode(prefix, rex, 0x0faf, dst->reg, src, 0, 0);
+      } else {
+        unsupported(inst);
+      }
+      break;
+    }
+    // fall through
+  case INS_UNARY:
+    if (inst->nargs != 1 || !is_rm(src)) {
+      unsupported(inst);
+    }
+    encode(prefix, rex, size == 1 ? 0xf6 : 0xf7, m->code, src, 0, 0);
+    break;
+  case INS_SHIFT:
+    if (inst->nargs == 1 || (src->kind == OPERAND_IMM && src->disp == 1)) {
+      encode(prefix, rex, size == 1 ? 0xd0 : 0xd1, m->code, dst, 0, 0);
+    } else if (src->kind == OPERAND_IMM) {
+      encode(prefix, rex, size == 1 ? 0xc0 : 0xc1, m->code, dst, 1, src->disp);
+    } else if (src->kind == OPERAND_REG && src->reg == 1 && src->size == 1) {
+      encode(prefix, rex, size == 1 ? 0xd2 : 0xd3, m->code, dst, 0, 0);
+    } else {
+      unsupported(inst);
+    }
+    break;
+  default:
+    unsupported(inst);
+  }
+}
+
+/*
+ * Directives
+ */
+
+static void set_section(char *name) {
+  for (int i = 0; i < SECTION_NUM; i++) {
+    if (strcmp(name, sections[i].name) == 0) {
+      cur = &sections[i];
+      return;
+    }
+  }
+  errorf("internal error: unsupported section %s", name);
+}
+
+static void emit_string(char *s) {
+  char *p = strchr(s, '"');
+  if (p == NULL) {
+    errorf("internal error: invalid string %s", s);
+  }
+  for (p++; *p != '"'; p++) {
+    if (*p == '\0') {
+      errorf("internal error: unterminated string %s", s);
+    }
+    if (*p != '\\') {
+      emit8(*p);
+      continue;
+    }
+    switch (*++p) {
+    case 'a': emit8('\a'); break;
+    case 'b': emit8('\b'); break;
+    case 'f': emit8('\f'); break;
+    case 'n': emit8('\n'); break;
+    case 'r': emit8('\r'); break;
+    case 't': emit8('\t'); break;
+    case 'v': emit8('\v'); break;
+    case 'x': {
+      char *end;
+      emit8(strtol(p + 1, &end, 16));
+      p = end - 1;
+      break;
+    }
+    default:
+      if (*p >= '0' && *p <= '7') {
+        int c = 0;
+        for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++, p++) {
+          c = c * 8 + *p - '0';
+        }
+        p--;
+        emit8(c);
+      } else {
+        emit8(*p);
+      }
+    }
+  }
+  emit8(0);
+}
+
+static void emit_data(char *s, int size) {
+  operand_t op;
+  parse_disp(s, s + strlen(s), &op);
+  if (op.sym != NULL) {
+    if (size != 8 && size != 4) {
+      errorf("internal error: cannot relocate %d bytes", size);
+    }
+    add_reloc(cur->data.size, op.sym, size == 8 ? R_X86_64_64 : R_X86_64_32, op.disp);
+    op.disp = 0;
+  }
+  emit_imm(op.disp, size);
+}
+
+static void asm_directive(char *line) {
+  char *arg = strchr(line, ' ');
+  int len = arg ? arg - line : (int)strlen(line);
+  if (arg != NULL) {
+    while (*arg == ' ' || *arg == '\t') {
+      arg++;
+    }
+  }
+#define IS(name) (len == (int)strlen(name) && strncmp(line, name, len) == 0)
+  if (IS(".text") || IS(".data")) {
+    set_section(atom_new_with_len(line, len));
+  } else if (IS(".section") && arg != NULL) {
+    set_section(arg);
+  } else if ((IS(".global") || IS(".globl")) && arg != NULL) {
+    symbol_get(arg)->global = true;
+  } else if ((IS(".align") || IS(".p2align")) && arg != NULL) {
+    int align = line[1] == 'p' ? 1 << atoi(arg) : atoi(arg);
+    int pad = (align - cur->data.size % align) % align;
+    bytes_fill(&cur->data, cur == &sections[SECTION_TEXT] ? 0x90 : 0, pad);
+    cur->align = max(cur->align, align);
+  } else if (IS(".byte") && arg != NULL) {
+    emit_data(arg, 1);
+  } else if (IS(".short") && arg != NULL) {
+    emit_data(arg, 2);
+  } else if (IS(".long") && arg != NULL) {
+    emit_data(arg, 4);
+  } else if (IS(".quad") && arg != NULL) {
+    emit_data(arg, 8);
+  } else if (IS(".zero") && arg != NULL) {
+    bytes_fill(&cur->data, 0, atoi(arg));
+  } else if (IS(".string") && arg != NULL) {
+    emit_string(arg);
+  } else {
+    errorf("internal error: unsupported directive %s", line);
+  }
+#undef IS
+}
+
+static void define_label(char *line) {
+  int len = strlen(line) - 1;
+  symbol_t *sym = symbol_get(atom_new_with_len(line, len));
+  if (sym->section >= 0) {
+    errorf("internal error: symbol %s is already defined", sym->name);
+  }
+  sym->section = cur - sections;
+  sym->value = cur->data.size;
+}
+
+/*
+ * Object file
+ */
+
+// patch references that stay inside their section, rebase the rest of
+// the local ones on the section symbol
+static void resolve(section_t *sec) {
+  vector_t *relocs = vector_new();
+  for (int i = 0; i < sec->relocs->size; i++) {
+    reloc_t *r = (reloc_t *)sec->relocs->data[i];
+    symbol_t *sym = r->sym;
+    if (sym->section < 0) {
+      if (symbol_is_label(sym)) {
+        errorf("internal error: undefined label %s", sym->name);
+      }
+      vector_push(relocs, r);
+      continue;
+    }
+    if (sym->global) {
+      vector_push(relocs, r);
+      continue;
+    }
+    if (&sections[sym->section] == sec && (r->type == R_X86_64_PC32 || r->type == R_X86_64_PLT32)) {
+      int32_t v = sym->value + r->addend - r->offset;
+      memcpy(sec->data.p + r->offset, &v, 4);
+      free(r);
+      continue;
+    }
+    if (r->type == R_X86_64_PLT32) {
+      r->type = R_X86_64_PC32;
+    }
+    r->addend += sym->value;
+    r->sym = &sections[sym->section].sym;
+    vector_push(relocs, r);
+  }
+  vector_free(sec->relocs);
+  sec->relocs = relocs;
+}
+
+static int add_name(bytes_t *strtab, char *name) {
+  int offset = strtab->size;
+  bytes_append(strtab, name, strlen(name) + 1);
+  return offset;
+}
+
+static void add_symbol(bytes_t *symtab, bytes_t *strtab, symbol_t *sym, int type, bool global) {
+  Elf64_Sym s = {0};
+  s.st_name = sym->name ? add_name(strtab, sym->name) : 0;
+  s.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+  s.st_shndx = sym->section < 0 ? SHN_UNDEF : SHNDX_TEXT + sym->section;
+  s.st_value = sym->section < 0 ? 0 : sym->value;
+  sym->index = symtab->size / sizeof (Elf64_Sym);
+  bytes_append(symtab, &s, sizeof (s));
+}
+
+static void write_object(FILE *out) {
+  bytes_t symtab = {NULL, 0, 0}, strtab = {NULL, 0, 0}, shstrtab = {NULL, 0, 0};
+  bytes_t rela[SECTION_NUM] = {{NULL, 0, 0}};
+  Elf64_Shdr shdrs[SHNDX_NUM] = {{0}};
+
+  // locals come first: section symbols, then named non-label symbols
+  bytes_fill(&symtab, 0, sizeof (Elf64_Sym));
+  bytes_fill(&strtab, 0, 1);
+  for (int i = 0; i < SECTION_NUM; i++) {
+    add_symbol(&symtab, &strtab, &sections[i].sym, STT_SECTION, false);
+  }
+  for (int i = 0; i < symbol_list->size; i++) {
+    symbol_t *sym = (symbol_t *)symbol_list->data[i];
+    if (!sym->global && sym->section >= 0 && !symbol_is_label(sym)) {
+      add_symbol(&symtab, &strtab, sym, STT_NOTYPE, false);
+    }
+  }
+  int first_global = symtab.size / sizeof (Elf64_Sym);
+  for (int i = 0; i < symbol_list->size; i++) {
+    symbol_t *sym = (symbol_t *)symbol_list->data[i];
+    if (sym->global || sym->section < 0) {
+      add_symbol(&symtab, &strtab, sym, STT_NOTYPE, true);
+    }
+  }
+
+  for (int i = 0; i < SECTION_NUM; i++) {
+    vector_t *relocs = sections[i].relocs;
+    for (int j = 0; j < relocs->size; j++) {
+      reloc_t *r = (reloc_t *)relocs->data[j];
+      Elf64_Rela rel = {r->offset, ELF64_R_INFO(r->sym->index, r->type), r->addend};
+      bytes_append(&rela[i], &rel, sizeof (rel));
+    }
+  }
+
+  static const char *rela_names[SECTION_NUM] = {".rela.text", ".rela.data", ".rela.rodata"};
+  bytes_fill(&shstrtab, 0, 1);
+  for (int i = 0; i < SECTION_NUM; i++) {
+    section_t *sec = &sections[i];
+    Elf64_Shdr *sh = &shdrs[SHNDX_TEXT + i];
+    sh->sh_name = add_name(&shstrtab, sec->name);
+    sh->sh_type = SHT_PROGBITS;
+    sh->sh_flags = SHF_ALLOC | (i == SECTION_TEXT ? SHF_EXECINSTR : i == SECTION_DATA ? SHF_WRITE : 0);
+    sh->sh_addralign = sec->align;
+
+    sh = &shdrs[SHNDX_RELA_TEXT + i];
+    sh->sh_name = add_name(&shstrtab, (char *)rela_names[i]);
+    sh->sh_type = SHT_RELA;
+    sh->sh_flags = SHF_INFO_LINK;
+    sh->sh_link = SHNDX_SYMTAB;
+    sh->sh_info = SHNDX_TEXT + i;
+    sh->sh_addralign = 8;
+    sh->sh_entsize = sizeof (Elf64_Rela);
+  }
+  shdrs[SHNDX_SYMTAB].sh_name = add_name(&shstrtab, ".symtab");
+  shdrs[SHNDX_SYMTAB].sh_type = SHT_SYMTAB;
+  shdrs[SHNDX_SYMTAB].sh_link = SHNDX_STRTAB;
+  shdrs[SHNDX_SYMTAB].sh_info = first_global;
+  shdrs[SHNDX_SYMTAB].sh_addralign = 8;
+  shdrs[SHNDX_SYMTAB].sh_entsize = sizeof (Elf64_Sym);
+  shdrs[SHNDX_STRTAB].sh_name = add_name(&shstrtab, ".strtab");
+  shdrs[SHNDX_STRTAB].sh_type = SHT_STRTAB;
+  shdrs[SHNDX_STRTAB].sh_addralign = 1;
+  shdrs[SHNDX_SHSTRTAB].sh_name = add_name(&shstrtab, ".shstrtab");
+  shdrs[SHNDX_SHSTRTAB].sh_type = SHT_STRTAB;
+  shdrs[SHNDX_SHSTRTAB].sh_addralign = 1;
+  shdrs[SHNDX_NOTE_STACK].sh_name = add_name(&shstrtab, ".note.GNU-stack");
+  shdrs[SHNDX_NOTE_STACK].sh_type = SHT_PROGBITS;
+  shdrs[SHNDX_NOTE_STACK].sh_addralign = 1;
+
+  bytes_t *contents[SHNDX_NUM] = {
+    NULL, &sections[SECTION_TEXT].data, &sections[SECTION_DATA].data, &sections[SECTION_RODATA].data,
+    &rela[SECTION_TEXT], &rela[SECTION_DATA], &rela[SECTION_RODATA],
+    &symtab, &strtab, &shstrtab, NULL,
+  };
+
+  bytes_t image = {NULL, 0, 0};
+  Elf64_Ehdr ehdr = {{0}};
+  bytes_fill(&image, 0, sizeof (ehdr));
+  for (int i = 1; i < SHNDX_NUM; i++) {
+    Elf64_Shdr *sh = &shdrs[i];
+    if (contents[i] == NULL) {
+      sh->sh_offset = image.size;
+      continue;
+    }
+    bytes_align(&image, sh->sh_addralign);
+    sh->sh_offset = image.size;
+    sh->sh_size = contents[i]->size;
+    bytes_append(&image, contents[i]->p, contents[i]->size);
+  }
+  bytes_align(&image, 8);
+
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_shoff = image.size;
+  ehdr.e_ehsize = sizeof (Elf64_Ehdr);
+  ehdr.e_shentsize = sizeof (Elf64_Shdr);
+  ehdr.e_shnum = SHNDX_NUM;
+  ehdr.e_shstrndx = SHNDX_SHSTRTAB;
+  memcpy(image.p, &ehdr, sizeof (ehdr));
+  bytes_append(&image, shdrs, sizeof (shdrs));
+
+  fwrite(image.p, 1, image.size, out);
+
+  free(image.p);
+  free(symtab.p);
+  free(strtab.p);
+  free(shstrtab.p);
+  for (int i = 0; i < SECTION_NUM; i++) {
+    free(rela[i].p);
+  }
+}
+
+void asm_write_object(FILE *out) {
+  static char *names[SECTION_NUM] = {".text", ".data", ".rodata"};
+  if (mnemonics == NULL) {
+    init_tables();
+  }
+  symbols = map_new();
+  symbols->free_val_fn = free;
+  symbol_list = vector_new();
+  for (int i = 0; i < SECTION_NUM; i++) {
+    section_t *sec = &sections[i];
+    memset(sec, 0, sizeof (section_t));
+    sec->name = atom_new(names[i]);
+    sec->align = 1;
+    sec->relocs = vector_new();
+    sec->sym.section = i;
+  }
+  cur = &sections[SECTION_TEXT];
+
+  vector_t *insts = emit_insts();
+  for (int i = 0; insts != NULL && i < insts->size; i++) {
+    inst_t *inst = (inst_t *)insts->data[i];
+    char *op = inst->op;
+    if (op == NULL) {
+      continue;
+    }
+    int len = strlen(op);
+    if (inst->nargs == 0 && len > 0 && op[len - 1] == ':') {
+      define_label(op);
+    } else if (inst->nargs == 0 && op[0] == '.') {
+      asm_directive(op);
+    } else {
+      asm_inst(inst);
+    }
+  }
+  for (int i = 0; i < SECTION_NUM; i++) {
+    resolve(&sections[i]);
+  }
+  write_object(out);
+
+  for (int i = 0; i < SECTION_NUM; i++) {
+    section_t *sec = &sections[i];
+    for (int j = 0; j < sec->relocs->size; j++) {
+      free(sec->relocs->data[j]);
+    }
+    vector_free(sec->relocs);
+    free(sec->data.p);
+  }
+  vector_free(symbol_list);
+  map_free(symbols);
+  emit_clear();
+}
@@ -0,0 +1,85 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hcc.h"
+
+/*
+ * Global table of interned strings.
+ *
+ * Each spelling is stored once, prefixed by a header holding its hash, so
+ * two atoms are equal iff their pointers are equal and map lookups never
+ * need to rehash the key. Atoms live for the whole compilation.
+ */
+
+#define ATOM_MIN_SLOT_SIZE 1024
+
+typedef struct atom atom_t;
+struct atom {
+  atom_t *chain;
+  unsigned hash;
+  int len;
+  char str[];
+};
+
+static atom_t **slot;
+static int slot_size;
+static int count;
+
+#define ATOM_OF(s) ((atom_t *)((s) - offsetof(atom_t, str)))
+
+static unsigned calc_hash(const char *s, int len) {
+  unsigned sum = 0;
+  for (int i = 0; i < len; i++) {
+    sum = (sum << 5) - sum + s[i];
+  }
+  return sum;
+}
+
+static void rehash(void) {
+  int new_size = slot_size == 0 ? ATOM_MIN_SLOT_SIZE : slot_size * 2;
+  atom_t **new_slot = (atom_t **)calloc(new_size, sizeof (atom_t *));
+  for (int i = 0; i < slot_size; i++) {
+    atom_t *next;
+    for (atom_t *a = slot[i]; a != NULL; a = next) {
+      next = a->chain;
+      int j = a->hash & (new_size - 1);
+      a->chain = new_slot[j];
+      new_slot[j] = a;
+    }
+  }
+  free(slot);
+  slot = new_slot;
+  slot_size = new_size;
+}
+
+char *atom_new_with_len(const char *s, int len) {
+  if (count >= slot_size) {
+    rehash();
+  }
+  unsigned hash = calc_hash(s, len);
+  atom_t **head = &slot[hash & (slot_size - 1)];
+  for (atom_t *a = *head; a != NULL; a = a->chain) {
+    if (a->hash == hash && a->len == len && memcmp(a->str, s, len) == 0) {
+      return a->str;
+    }
+  }
+  atom_t *a = (atom_t *)malloc(sizeof (atom_t) + len + 1);
+  a->hash = hash;
+  a->len = len;
+  memcpy(a->str, s, len);
+  a->str[len] = '\0';
+  a->chain = *head;
+  *head = a;
+  count++;
+  return a->str;
+}
+
+char *atom_new(const char *s) {
+  return atom_new_with_len(s, strlen(s));
+}
+
+unsigned atom_hash(const char *atom) {
+  return ATOM_OF(atom)->hash;
+}
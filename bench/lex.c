@@ -0,0 +1,42 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hcc.h"
+
+/*
+ * Lexer microbenchmark: tokenizes the given (preprocessed) file a number of
+ * times and reports the throughput.
+ */
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file [iterations]\n", argv[0]);
+    return 1;
+  }
+  int iterations = argc > 2 ? atoi(argv[2]) : 10;
+  FILE *fp = fopen(argv[1], "r");
+  if (fp == NULL) {
+    errorf("cannot open %s", argv[1]);
+  }
+  file_t *f = file_new(fp);
+  fclose(fp);
+
+  long ntokens = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < iterations; i++) {
+    lex_t *lex = lex_new_string(string_new_with(f->buf));
+    while (lex_get_token(lex)->kind != TOKEN_KIND_EOF) {
+      ntokens++;
+    }
+    lex_free(lex);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%ld tokens in %.3f sec (%.2f Mtokens/sec)\n", ntokens, sec, ntokens / sec / 1e6);
+  file_free(f);
+  return 0;
+}
@@ -1,8 +1,14 @@
 // Copyright 2019 @htz. Released under the MIT license.
 
+#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "hcc.h"
 
+// probe cache value for paths that do not exist
+static char include_missing[] = "";
+
 static void preprocessor_include(parse_t *parse);
 static void preprocessor_define(parse_t *parse);
 static void preprocessor_undef(parse_t *parse);
@@ -48,7 +54,7 @@ static macro_t *read_macro(parse_t *parse) {
         if (token->kind == TOKEN_KIND_KEYWORD && token->keyword == TOKEN_KEYWORD_ELLIPSIS) {
           macro->is_vaargs = true;
           token_t *arg = macro_param(parse, macro->args->size, true);
-          map_add(macro->args, "__VA_ARGS__", arg);
+          map_add(macro->args, atom_new("__VA_ARGS__"), arg);
           lex_expect_keyword_is(parse->lex, ')');
           break;
         }
@@ -99,18 +105,146 @@ err:
   errorf("expected \"FILENAME\" or <FILENAME>");
 }
 
-static bool include_file(parse_t *parse, char *dir, char *file_name) {
+static char *skip_comment(char *p) {
+  if (p[1] == '*') {
+    p = strstr(p + 2, "*/");
+    return p != NULL ? p + 2 : NULL;
+  }
+  while (*p != '\0' && *p != '\n') {
+    p++;
+  }
+  return p;
+}
+
+static char *read_directive_word(char *p, char **word, int *len) {
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  *word = p;
+  while (isalnum(*p) || *p == '_') {
+    p++;
+  }
+  *len = p - *word;
+  return p;
+}
+
+static bool is_word(char *word, int len, char *s) {
+  return len == strlen(s) && strncmp(word, s, len) == 0;
+}
+
+/*
+ * Return the macro X if the whole file is wrapped in `#ifndef X ... #endif`
+ * with nothing but whitespace and comments outside, otherwise NULL. Such a
+ * file expands to nothing once X is defined.
+ */
+static char *detect_include_guard(file_t *f) {
+  char *p = f->buf, *end = f->buf + f->size;
+  char *guard = NULL;
+  int depth = 0;
+  bool bol = true;
+  while (p != NULL && p < end) {
+    char c = *p;
+    if (c == '\n') {
+      bol = true;
+      p++;
+      continue;
+    }
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+      p++;
+      continue;
+    }
+    if (c == '/' && (p[1] == '*' || p[1] == '/')) {
+      p = skip_comment(p);
+      continue;
+    }
+    if (depth == 0 && guard != NULL) {
+      return NULL;
+    }
+    if (c == '#' && bol) {
+      char *word;
+      int len;
+      p = read_directive_word(p + 1, &word, &len);
+      if (is_word(word, len, "if") || is_word(word, len, "ifdef") || is_word(word, len, "ifndef")) {
+        if (depth == 0) {
+          if (!is_word(word, len, "ifndef")) {
+            return NULL;
+          }
+          p = read_directive_word(p, &word, &len);
+          if (len == 0) {
+            return NULL;
+          }
+          guard = atom_new_with_len(word, len);
+        }
+        depth++;
+      } else if (is_word(word, len, "endif")) {
+        depth--;
+      } else if (depth == 1 && (is_word(word, len, "else") || is_word(word, len, "elif"))) {
+        return NULL;
+      } else if (depth == 0) {
+        return NULL;
+      }
+      bol = false;
+      continue;
+    }
+    if (depth == 0) {
+      return NULL;
+    }
+    if (c == '"' || c == '\'') {
+      for (p++; *p != c && *p != '\n' && *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+          p++;
+        }
+      }
+      if (*p == c) {
+        p++;
+      }
+    } else {
+      p++;
+    }
+    bol = false;
+  }
+  return depth == 0 ? guard : NULL;
+}
+
+// canonical path of dir/file_name, or NULL; results are cached per probe
+static char *find_include(parse_t *parse, char *dir, char *file_name) {
   string_t *path = string_new_with(dir);
   string_appendf(path, "/%s", file_name);
-  string_t *full = fullpath(path->buf);
+  char *key = atom_new(path->buf);
   string_free(path);
-  FILE *fp = fopen(full->buf, "r");
-  if (fp != NULL) {
-    fclose(fp);
-    parse_include(parse, full->buf);
+  char *full = (char *)map_get(parse->include_probes, key);
+  if (full == NULL) {
+    string_t *str = fullpath(key);
+    if (access(str->buf, R_OK) == 0) {
+      full = atom_new(str->buf);
+    } else {
+      full = include_missing;
+    }
+    string_free(str);
+    map_add(parse->include_probes, key, full);
+  }
+  return full != include_missing ? full : NULL;
+}
+
+static bool include_file(parse_t *parse, char *dir, char *file_name) {
+  char *path = find_include(parse, dir, file_name);
+  if (path == NULL) {
+    return false;
   }
-  string_free(full);
-  return fp != NULL;
+  include_guard_t *guard = (include_guard_t *)map_get(parse->include_guards, path);
+  if (guard != NULL) {
+    if (guard->once || (guard->macro != NULL && map_get(parse->macros, guard->macro) != NULL)) {
+      return true;
+    }
+  }
+  parse_include(parse, path);
+  if (guard == NULL) {
+    guard = (include_guard_t *)malloc(sizeof (include_guard_t));
+    guard->macro = detect_include_guard(lex_current_file(parse->lex));
+    guard->once = false;
+    map_add(parse->include_guards, path, guard);
+  }
+  return true;
 }
 
 static void preprocessor_include(parse_t *parse) {
@@ -172,6 +306,23 @@ static void preprocessor_undef(parse_t *parse) {
   }
 }
 
+static void preprocessor_pragma(parse_t *parse) {
+  token_t *token = lex_get_token(parse->lex);
+  if (token->kind == TOKEN_KIND_IDENTIFIER && strcmp("once", token->identifier) == 0) {
+    file_t *f = lex_current_file(parse->lex);
+    if (f->file_name != NULL) {
+      include_guard_t *guard = (include_guard_t *)map_get(parse->include_guards, atom_new(f->file_name));
+      if (guard != NULL) {
+        guard->once = true;
+      }
+    }
+  }
+  // other pragmas are ignored
+  while (token->kind != TOKEN_KIND_NEWLINE && token->kind != TOKEN_KIND_EOF) {
+    token = lex_get_token(parse->lex);
+  }
+}
+
 static void preprocessor_error(parse_t *parse) {
   lex_skip_whitespace(parse->lex);
   string_t *str = string_new();
@@ -373,6 +524,9 @@ static token_t *preprocessor(parse_t *parse, token_t *hash_token) {
   } else if (strcmp("error", token->str) == 0) {
     preprocessor_error(parse);
     return NULL;
+  } else if (strcmp("pragma", token->str) == 0) {
+    preprocessor_pragma(parse);
+    return NULL;
   } else if (strcmp("", token->str) == 0) {
     return NULL;
   } else {
@@ -0,0 +1,306 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Dead code elimination.
+ *
+ * Function bodies are structured (there is no goto), so reachability within
+ * a function follows the statement tree: a statement after a return, break,
+ * continue or endless loop is dead up to the next case label, and so is the
+ * branch of an if or loop whose condition folded to a constant. Afterwards
+ * the translation unit is walked from its externally visible definitions;
+ * static functions and variables that are never reached are dropped, and so
+ * are float and string constants in parse->data that no live code refers to.
+ */
+
+typedef struct dce dce_t;
+struct dce {
+  parse_t *parse;
+  map_t *defs;
+  map_t *reached;
+  vector_t *worklist;
+  char *live_data;
+  int statements;
+  int functions;
+  int variables;
+  int data;
+};
+
+static bool is_const_true(node_t *cond) {
+  return cond == NULL || (cond->kind == NODE_KIND_LITERAL && type_is_int(cond->type) && cond->ival != 0);
+}
+
+static bool is_const_false(node_t *cond) {
+  return cond != NULL && cond->kind == NODE_KIND_LITERAL && type_is_int(cond->type) && cond->ival == 0;
+}
+
+// Whether node breaks out of the innermost enclosing loop or switch
+static bool has_break(node_t *node) {
+  if (node == NULL) {
+    return false;
+  }
+  switch (node->kind) {
+  case NODE_KIND_BREAK:
+    return true;
+  case NODE_KIND_BLOCK:
+    for (int i = 0; i < node->statements->size; i++) {
+      if (has_break((node_t *)node->statements->data[i])) {
+        return true;
+      }
+    }
+    return false;
+  case NODE_KIND_IF:
+    return has_break(node->then_body) || has_break(node->else_body);
+  case NODE_KIND_CASE:
+    return has_break(node->cstmt);
+  }
+  return false;
+}
+
+// Returns the statement that replaces node; *live tells whether its end is reachable
+static node_t *prune(dce_t *d, node_t *node, bool *live) {
+  *live = true;
+  if (node == NULL) {
+    return NULL;
+  }
+  bool then_live, else_live;
+  switch (node->kind) {
+  case NODE_KIND_BLOCK: {
+    vector_t *stmts = node->statements;
+    int n = 0;
+    for (int i = 0; i < stmts->size; i++) {
+      node_t *stmt = (node_t *)stmts->data[i];
+      if (!*live && !loop_has_label(stmt)) {
+        d->statements++;
+        continue;
+      }
+      stmts->data[n++] = prune(d, stmt, live);
+    }
+    stmts->size = n;
+    break;
+  }
+  case NODE_KIND_IF:
+    if (is_const_true(node->cond) && !loop_has_label(node->else_body)) {
+      d->statements += node->else_body != NULL;
+      return prune(d, node->then_body, live);
+    }
+    if (is_const_false(node->cond) && !loop_has_label(node->then_body)) {
+      d->statements++;
+      if (node->else_body == NULL) {
+        return node_new_nop(d->parse);
+      }
+      return prune(d, node->else_body, live);
+    }
+    node->then_body = prune(d, node->then_body, &then_live);
+    node->else_body = prune(d, node->else_body, &else_live);
+    *live = then_live || else_live;
+    break;
+  case NODE_KIND_WHILE:
+  case NODE_KIND_FOR:
+    if (is_const_false(node->lcond) && !loop_has_label(node->lbody)) {
+      d->statements++;
+      if (node->kind == NODE_KIND_FOR && node->linit != NULL) {
+        return node->linit;
+      }
+      return node_new_nop(d->parse);
+    }
+    node->lbody = prune(d, node->lbody, &then_live);
+    *live = !is_const_true(node->lcond) || has_break(node->lbody);
+    break;
+  case NODE_KIND_DO:
+    node->lbody = prune(d, node->lbody, &then_live);
+    *live = !is_const_true(node->lcond) || has_break(node->lbody);
+    break;
+  case NODE_KIND_SWITCH:
+    node->sbody = prune(d, node->sbody, &then_live);
+    break;
+  case NODE_KIND_CASE:
+    node->cstmt = prune(d, node->cstmt, live);
+    break;
+  case NODE_KIND_RETURN:
+  case NODE_KIND_BREAK:
+  case NODE_KIND_CONTINUE:
+    *live = false;
+    break;
+  }
+  return node;
+}
+
+static void reach(dce_t *d, char *name) {
+  if (map_find(d->reached, name) != NULL) {
+    return;
+  }
+  map_add(d->reached, name, name);
+  node_t *def = (node_t *)map_get(d->defs, name);
+  if (def != NULL) {
+    vector_push(d->worklist, def);
+  }
+}
+
+static void mark(dce_t *d, node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_LITERAL:
+      if (type_is_float(node->type) && node->fid >= 0) {
+        d->live_data[node->fid] = true;
+      }
+      break;
+    case NODE_KIND_STRING_LITERAL:
+      if (node->sid >= 0) {
+        d->live_data[node->sid] = true;
+      }
+      break;
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        mark(d, (node_t *)node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_VARIABLE:
+      if (node->global) {
+        reach(d, node->vname);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      mark(d, node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      mark(d, node->left);
+      if (node->op != '.') {
+        mark(d, node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      mark(d, node->operand);
+      break;
+    case NODE_KIND_CALL:
+      mark(d, node->func);
+      for (int i = 0; i < node->args->size; i++) {
+        mark(d, (node_t *)node->args->data[i]);
+      }
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        mark(d, (node_t *)node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      mark(d, node->cond);
+      mark(d, node->then_body);
+      mark(d, node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      mark(d, node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      mark(d, node->linit);
+      mark(d, node->lcond);
+      mark(d, node->lstep);
+      mark(d, node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      mark(d, node->sexpr);
+      mark(d, node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      mark(d, node->cval);
+      mark(d, node->cstmt);
+      break;
+    case NODE_KIND_FUNCTION:
+      mark(d, node->fbody);
+      break;
+    }
+  }
+}
+
+static char *def_name(node_t *node) {
+  if (node->kind == NODE_KIND_FUNCTION) {
+    return node->fvar->vname;
+  }
+  if (node->kind == NODE_KIND_DECLARATION && node->next == NULL) {
+    return node->dec_var->vname;
+  }
+  return NULL;
+}
+
+static bool is_static(node_t *node) {
+  node_t *var = node->kind == NODE_KIND_FUNCTION ? node->fvar : node->dec_var;
+  return var->sclass == STORAGE_CLASS_STATIC;
+}
+
+void dce(parse_t *parse) {
+  dce_t d = {0};
+  d.parse = parse;
+  d.defs = map_new();
+  d.reached = map_new();
+  d.worklist = vector_new();
+  d.live_data = (char *)calloc(parse->data->size + 1, 1);
+
+  vector_t *stmts = parse->statements;
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind == NODE_KIND_FUNCTION) {
+      bool live;
+      prune(&d, node->fbody, &live);
+    }
+    char *name = def_name(node);
+    if (name != NULL) {
+      map_add(d.defs, name, node);
+    }
+  }
+
+  // externally visible definitions are the roots
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind == NODE_KIND_FUNCTION || node->kind == NODE_KIND_DECLARATION) {
+      char *name = def_name(node);
+      if (name == NULL || !is_static(node)) {
+        mark(&d, node);
+      }
+    }
+  }
+  while (d.worklist->size > 0) {
+    mark(&d, (node_t *)vector_pop(d.worklist));
+  }
+
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    char *name = def_name(node);
+    if (name == NULL || !is_static(node) || map_find(d.reached, name) != NULL) {
+      continue;
+    }
+    if (node->kind == NODE_KIND_FUNCTION) {
+      d.functions++;
+    } else {
+      d.variables++;
+    }
+    stmts->data[i] = node_new_nop(parse);
+  }
+
+  vector_t *data = parse->data;
+  int n = 0;
+  for (int i = 0; i < data->size; i++) {
+    if (d.live_data[i]) {
+      data->data[n++] = data->data[i];
+    } else {
+      d.data++;
+    }
+  }
+  data->size = n;
+
+  if (parse->option->stats) {
+    fprintf(stderr, "dce statements %d\n", d.statements);
+    fprintf(stderr, "dce functions %d\n", d.functions);
+    fprintf(stderr, "dce variables %d\n", d.variables);
+    fprintf(stderr, "dce data %d\n", d.data);
+  }
+
+  free(d.live_data);
+  vector_free(d.worklist);
+  map_free(d.reached);
+  map_free(d.defs);
+}
@@ -0,0 +1,271 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hcc.h"
+
+/*
+ * Assembly emission buffer.
+ *
+ * Every emitted line is formatted by a small hand-written formatter (it only
+ * knows %s, %d, %+d, %ld, %p, %c and %%) and stored as an instruction record:
+ * the mnemonic and up to three operands, copied into a chunked text pool.
+ * Labels and directives keep the whole line in `op`. emit_flush() renders
+ * the records into one buffer and writes it with a single fwrite; asm.c
+ * can encode the same records into an object file instead.
+ */
+
+#define EMIT_POOL_CHUNK (64 * 1024)
+
+typedef struct buf buf_t;
+struct buf {
+  char *p;
+  int size;
+  int capacity;
+};
+
+static arena_t *inst_arena;
+static vector_t *insts;
+static vector_t *pool_chunks;
+static char *pool_p;
+static char *pool_end;
+static buf_t line;
+
+static inline void buf_reserve(buf_t *b, int n) {
+  if (b->size + n <= b->capacity) {
+    return;
+  }
+  b->capacity = max(b->capacity * 2, b->size + n);
+  b->p = (char *)realloc(b->p, b->capacity);
+}
+
+static inline void buf_add(buf_t *b, char c) {
+  buf_reserve(b, 1);
+  b->p[b->size++] = c;
+}
+
+static inline void buf_append(buf_t *b, const char *s, int len) {
+  buf_reserve(b, len);
+  memcpy(b->p + b->size, s, len);
+  b->size += len;
+}
+
+static void buf_append_ulong(buf_t *b, unsigned long v, int base) {
+  char tmp[24];
+  int i = sizeof (tmp);
+  do {
+    tmp[--i] = "0123456789abcdef"[v % base];
+    v /= base;
+  } while (v != 0);
+  buf_append(b, tmp + i, sizeof (tmp) - i);
+}
+
+static void buf_append_long(buf_t *b, long v) {
+  if (v < 0) {
+    buf_add(b, '-');
+    buf_append_ulong(b, -(unsigned long)v, 10);
+  } else {
+    buf_append_ulong(b, v, 10);
+  }
+}
+
+static void format(buf_t *b, char *fmt, va_list args) {
+  for (char *p = fmt; *p; p++) {
+    if (*p != '%') {
+      char *q = p;
+      while (q[1] != '\0' && q[1] != '%') {
+        q++;
+      }
+      buf_append(b, p, q - p + 1);
+      p = q;
+      continue;
+    }
+    switch (*++p) {
+    case '%':
+      buf_add(b, '%');
+      break;
+    case 'c':
+      buf_add(b, (char)va_arg(args, int));
+      break;
+    case '+': {
+      if (*++p != 'd') {
+        errorf("internal error: unsupported emit format %s", fmt);
+      }
+      int v = va_arg(args, int);
+      if (v >= 0) {
+        buf_add(b, '+');
+      }
+      buf_append_long(b, v);
+      break;
+    }
+    case 'd':
+      buf_append_long(b, va_arg(args, int));
+      break;
+    case 'l':
+      if (*++p != 'd') {
+        errorf("internal error: unsupported emit format %s", fmt);
+      }
+      buf_append_long(b, va_arg(args, long));
+      break;
+    case 'p':
+      buf_append(b, "0x", 2);
+      buf_append_ulong(b, (unsigned long)va_arg(args, void *), 16);
+      break;
+    case 's': {
+      char *s = va_arg(args, char *);
+      buf_append(b, s, strlen(s));
+      break;
+    }
+    default:
+      errorf("internal error: unsupported emit format %s", fmt);
+    }
+  }
+}
+
+static char *pool_strndup(char *s, int len) {
+  if (pool_end - pool_p < len + 1) {
+    int size = max(EMIT_POOL_CHUNK, len + 1);
+    pool_p = (char *)malloc(size);
+    pool_end = pool_p + size;
+    vector_push(pool_chunks, pool_p);
+  }
+  char *r = pool_p;
+  memcpy(r, s, len);
+  r[len] = '\0';
+  pool_p += len + 1;
+  return r;
+}
+
+static char *trim(char *s, char *e) {
+  while (s < e && (*s == ' ' || *s == '\t')) {
+    s++;
+  }
+  while (e > s && (e[-1] == ' ' || e[-1] == '\t')) {
+    e--;
+  }
+  *e = '\0';
+  return s;
+}
+
+// split "op a, b" in place into the mnemonic and its top-level operands
+static void split(inst_t *inst, char *s, char *end) {
+  char *p = s;
+  while (p < end && *p != ' ' && *p != '\t') {
+    p++;
+  }
+  inst->op = s;
+  inst->nargs = 0;
+  if (p == end) {
+    return;
+  }
+  *p++ = '\0';
+  char *arg = p;
+  int depth = 0;
+  for (; p <= end; p++) {
+    if (p == end || (*p == ',' && depth == 0)) {
+      if (inst->nargs == EMIT_MAX_ARGS) {
+        errorf("internal error: too many operands");
+      }
+      inst->args[inst->nargs++] = trim(arg, p);
+      arg = p + 1;
+    } else if (*p == '(') {
+      depth++;
+    } else if (*p == ')') {
+      depth--;
+    }
+  }
+}
+
+static inst_t *inst_new(void) {
+  if (inst_arena == NULL) {
+    inst_arena = arena_new(sizeof (inst_t));
+    insts = vector_new();
+    pool_chunks = vector_new();
+  }
+  inst_t *inst = (inst_t *)arena_alloc(inst_arena);
+  vector_push(insts, inst);
+  return inst;
+}
+
+void emit_vline(bool indent, char *fmt, va_list args) {
+  line.size = 0;
+  format(&line, fmt, args);
+  inst_t *inst = inst_new();
+  inst->indent = indent;
+  char *s = pool_strndup(line.p, line.size);
+  char *end = s + line.size;
+  if (!indent || line.size == 0 || s[0] == '.' || end[-1] == ':') {
+    inst->op = s;
+    inst->nargs = 0;
+  } else {
+    split(inst, s, end);
+  }
+}
+
+void emit_string_literal(string_t *str) {
+  string_t *quoted = string_new_with(".string \"");
+  string_append_quote(quoted, str);
+  string_add(quoted, '"');
+  inst_t *inst = inst_new();
+  inst->indent = true;
+  inst->op = pool_strndup(quoted->buf, quoted->size);
+  inst->nargs = 0;
+  string_free(quoted);
+}
+
+// formats an operand for rewriting a record; it lives as long as the records
+char *emit_format(char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  line.size = 0;
+  format(&line, fmt, args);
+  va_end(args);
+  return pool_strndup(line.p, line.size);
+}
+
+vector_t *emit_insts(void) {
+  return insts;
+}
+
+void emit_flush(FILE *out) {
+  if (insts == NULL) {
+    return;
+  }
+  buf_t b = {NULL, 0, 0};
+  buf_reserve(&b, insts->size * 24);
+  for (int i = 0; i < insts->size; i++) {
+    inst_t *inst = (inst_t *)insts->data[i];
+    if (inst->op == NULL) {
+      continue;
+    }
+    if (inst->indent) {
+      buf_add(&b, '\t');
+    }
+    buf_append(&b, inst->op, strlen(inst->op));
+    for (int j = 0; j < inst->nargs; j++) {
+      buf_append(&b, j == 0 ? " " : ", ", j == 0 ? 1 : 2);
+      buf_append(&b, inst->args[j], strlen(inst->args[j]));
+    }
+    buf_add(&b, '\n');
+  }
+  fwrite(b.p, 1, b.size, out);
+  free(b.p);
+  emit_clear();
+}
+
+void emit_clear(void) {
+  if (insts == NULL) {
+    return;
+  }
+  while (pool_chunks->size > 0) {
+    free(vector_pop(pool_chunks));
+  }
+  vector_free(pool_chunks);
+  vector_free(insts);
+  arena_free(inst_arena, NULL);
+  insts = NULL;
+  inst_arena = NULL;
+  pool_p = pool_end = NULL;
+}
@@ -11,14 +11,47 @@ enum {
   COLOR_YELLOW = 33,
 };
 
+static lex_t *error_lex;
+
+void error_set_lex(lex_t *lex) {
+  error_lex = lex;
+}
+
+static file_t *error_file(void) {
+  if (error_lex == NULL || error_lex->files->size == 0) {
+    return NULL;
+  }
+  return (file_t *)error_lex->files->data[error_lex->files->size - 1];
+}
+
+static void print_excerpt(file_t *f) {
+  int len;
+  char *line = file_get_line(f, f->line, &len);
+  if (line == NULL) {
+    return;
+  }
+  fprintf(stderr, "  %.*s\n  ", len, line);
+  for (int i = 0; i < f->column - 1 && i < len; i++) {
+    fputc(line[i] == '\t' ? '\t' : ' ', stderr);
+  }
+  fprintf(stderr, "^\n");
+}
+
 static void print_message(char *label, int color, char *fmt, va_list args) {
   if (isatty(fileno(stderr))) {
     fprintf(stderr, "\e[1;%dm[%s]\e[0m ", color, label);
   } else {
     fprintf(stderr, "[%s] ", label);
   }
+  file_t *f = error_file();
+  if (f != NULL) {
+    fprintf(stderr, "%s:%d:%d: ", f->file_name ? f->file_name : "<stdin>", f->line, f->column);
+  }
   vfprintf(stderr, fmt, args);
   fprintf(stderr, "\n");
+  if (f != NULL) {
+    print_excerpt(f);
+  }
 }
 
 void errorf(char *fmt, ...) {
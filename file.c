@@ -1,20 +1,57 @@
 // Copyright 2019 @htz. Released under the MIT license.
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "hcc.h"
 
-#define BUFF_SIZE 256
+#define BUFF_SIZE (64 * 1024)
 
-static void push_line(file_t *f);
+static file_t *file_new_buf(string_t *src, char *buf, long size);
+
+/*
+ * Map a regular file read-only. The lexer relies on a '\0' sentinel, which
+ * the zero-filled tail of the last page provides unless the file size is
+ * an exact multiple of the page size.
+ */
+static file_t *file_new_mmap(FILE *fp) {
+  int fd = fileno(fp);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return NULL;
+  }
+  if (st.st_size % sysconf(_SC_PAGESIZE) == 0 || lseek(fd, 0, SEEK_CUR) != 0) {
+    return NULL;
+  }
+  char *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf == MAP_FAILED) {
+    return NULL;
+  }
+  return file_new_buf(NULL, buf, st.st_size);
+}
 
 file_t *file_new(FILE *fp) {
-  string_t *src = string_new();
-  char buf[BUFF_SIZE];
-  while (fgets(buf, BUFF_SIZE, fp)) {
-    string_append(src, buf);
+  file_t *f = file_new_mmap(fp);
+  if (f != NULL) {
+    return f;
   }
+
+  // stdin, pipes and unmappable files are read into a terminated buffer
+  string_t *src = string_new();
+  size_t n;
+  do {
+    if (src->capacity - src->size < BUFF_SIZE + 1) {
+      src->capacity = max(src->capacity * 2, src->size + BUFF_SIZE + 1);
+      src->buf = (char *)realloc(src->buf, src->capacity);
+    }
+    n = fread(src->buf + src->size, 1, BUFF_SIZE, fp);
+    src->size += n;
+  } while (n > 0);
+  src->buf[src->size] = '\0';
   return file_new_string(src);
 }
 
@@ -27,41 +64,67 @@ file_t *file_new_filename(char *file_name) {
 }
 
 file_t *file_new_string(string_t *str) {
+  return file_new_buf(str, str->buf, str->size);
+}
+
+static file_t *file_new_buf(string_t *src, char *buf, long size) {
   file_t *f = (file_t *)malloc(sizeof (file_t));
   f->file_name = NULL;
-  f->src = str;
-  f->p = f->src->buf;
+  f->src = src;
+  f->buf = buf;
+  f->size = size;
+  f->p = f->buf;
   f->tbuf = vector_new();;
   f->line = 1;
   f->column = 1;
-  f->lines = vector_new();
-  push_line(f);
+  f->line_index = NULL;
   return f;
 }
 
-static void push_line(file_t *f) {
-  char *p = f->p;
-  while (*p != '\0' && *p != '\r' && *p != '\n') {
+// offsets of every line start, built only when a diagnostic needs them
+static void build_line_index(file_t *f) {
+  vector_t *index = vector_new();
+  char *p = f->buf, *end = f->buf + f->size;
+  vector_push(index, (void *)0);
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
     p++;
+    vector_push(index, (void *)(intptr_t)(p - f->buf));
+  }
+  f->line_index = index;
+}
+
+char *file_get_line(file_t *f, int line, int *lenp) {
+  if (f->line_index == NULL) {
+    build_line_index(f);
+  }
+  if (line < 1 || line > f->line_index->size) {
+    return NULL;
   }
-  int len = p - f->p;
-  char *str = (char *)malloc(p - f->p + 1);
-  strncpy(str, f->p, len);
-  str[len] = '\0';
-  vector_push(f->lines, str);
+  char *s = f->buf + (intptr_t)f->line_index->data[line - 1];
+  char *e = memchr(s, '\n', f->buf + f->size - s);
+  if (e == NULL) {
+    e = f->buf + f->size;
+  }
+  if (e > s && e[-1] == '\r') {
+    e--;
+  }
+  *lenp = e - s;
+  return s;
 }
 
 void file_free(file_t *f) {
   if (f->file_name != NULL) {
     free(f->file_name);
   }
-  string_free(f->src);
+  if (f->src != NULL) {
+    string_free(f->src);
+  } else {
+    munmap(f->buf, f->size);
+  }
   vector_free(f->tbuf);
-  while (f->lines->size > 0) {
-    char *str = (char *)vector_pop(f->lines);
-    free(str);
+  if (f->line_index != NULL) {
+    vector_free(f->line_index);
   }
-  vector_free(f->lines);
   free(f);
 }
 
@@ -75,9 +138,6 @@ char file_get_char(file_t *f) {
     c = '\n';
   }
   if (c == '\n') {
-    if (f->lines->size < f->line) {
-      push_line(f);
-    }
     f->line++;
     f->column = 1;
   } else {
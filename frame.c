@@ -0,0 +1,319 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hcc.h"
+
+/*
+ * Stack frame layout.
+ *
+ * frame_layout() gives a stack slot to every local variable that did not
+ * get a register, including the parameters passed in registers that the
+ * prologue stores; those are live from the entry. The function body is numbered in evaluation order and
+ * each variable is live over a range of positions: from its first to its
+ * last use (extended over the loops it is used in but declared before) for
+ * scalars, and over its whole block for arrays, structs and variables
+ * whose address is taken, since those may be reached through pointers.
+ * Variables are then placed largest alignment first, each at the lowest
+ * offset that does not overlap a placed variable with an intersecting
+ * range, so slots are shared across disjoint scopes and lifetimes.
+ *
+ * frame_finish() runs over the emitted instructions after the peephole
+ * pass. A function that makes no calls, never moves %rsp after its
+ * prologue and whose frame fits in the 128-byte red zone loses its frame
+ * pointer: the prologue and leave are dropped and %rbp-relative operands
+ * are rewritten against %rsp.
+ */
+
+#define RED_ZONE 128
+
+typedef struct slot slot_t;
+struct slot {
+  node_t *var;
+  int start;
+  int end;
+  bool pinned;  // live over its whole block
+};
+
+typedef struct layout layout_t;
+struct layout {
+  vector_t *slots;
+  int pos;
+};
+
+static void walk(layout_t *lv, node_t *node);
+
+static slot_t *find_slot(layout_t *lv, node_t *var) {
+  for (int i = 0; i < lv->slots->size; i++) {
+    slot_t *s = (slot_t *)lv->slots->data[i];
+    if (s->var == var) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static slot_t *touch(layout_t *lv, node_t *var) {
+  if (var->global || var->vreg != REG_NONE || var->voffset != 0) {
+    return NULL;
+  }
+  slot_t *s = find_slot(lv, var);
+  if (s == NULL) {
+    s = (slot_t *)malloc(sizeof (slot_t));
+    s->var = var;
+    s->start = lv->pos;
+    s->pinned = var->sclass != STORAGE_CLASS_NONE || var->type->kind == TYPE_KIND_ARRAY || type_is_struct(var->type);
+    vector_push(lv->slots, s);
+  }
+  s->end = lv->pos++;
+  return s;
+}
+
+static void walk_loop(layout_t *lv, node_t *init, node_t *cond, node_t *body, node_t *step) {
+  if (init != NULL) {
+    walk(lv, init);
+  }
+  int loop_start = lv->pos++;
+  walk(lv, cond);
+  walk(lv, body);
+  walk(lv, step);
+  int loop_end = lv->pos++;
+  for (int i = 0; i < lv->slots->size; i++) {
+    slot_t *s = (slot_t *)lv->slots->data[i];
+    if (s->start < loop_start && s->end > loop_start) {
+      s->end = max(s->end, loop_end);
+    }
+  }
+}
+
+static void walk_block(layout_t *lv, node_t *node) {
+  int start = lv->pos++;
+  for (int i = 0; i < node->statements->size; i++) {
+    walk(lv, (node_t *)node->statements->data[i]);
+  }
+  int end = lv->pos++;
+  for (map_entry_t *e = node->vars->top; e != NULL; e = e->next) {
+    node_t *var = (node_t *)e->val;
+    if (var->kind != NODE_KIND_VARIABLE) {
+      continue;
+    }
+    slot_t *s = find_slot(lv, var);
+    if (s == NULL) {
+      // never used, but keep it addressable over its scope
+      s = touch(lv, var);
+      if (s == NULL) {
+        continue;
+      }
+      s->pinned = true;
+    }
+    if (s->pinned) {
+      s->start = min(s->start, start);
+      s->end = max(s->end, end);
+    }
+  }
+}
+
+static void walk(layout_t *lv, node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_VARIABLE:
+      touch(lv, node);
+      break;
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        walk(lv, (node_t *)node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      walk(lv, node->dec_init);
+      touch(lv, node->dec_var);
+      break;
+    case NODE_KIND_BINARY_OP:
+      walk(lv, node->left);
+      if (node->op != '.') {
+        walk(lv, node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if (node->op == '&') {
+        node_t *n = node->operand;
+        while (n->kind == NODE_KIND_BINARY_OP && n->op == '.') {
+          n = n->left;
+        }
+        if (n->kind == NODE_KIND_VARIABLE) {
+          slot_t *s = touch(lv, n);
+          if (s != NULL) {
+            s->pinned = true;
+          }
+          break;
+        }
+      }
+      walk(lv, node->operand);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        walk(lv, (node_t *)node->args->data[i]);
+      }
+      walk(lv, node->func);
+      break;
+    case NODE_KIND_BLOCK:
+      walk_block(lv, node);
+      break;
+    case NODE_KIND_IF:
+      walk(lv, node->cond);
+      walk(lv, node->then_body);
+      walk(lv, node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      walk(lv, node->retval);
+      break;
+    case NODE_KIND_WHILE:
+      walk_loop(lv, NULL, node->lcond, node->lbody, NULL);
+      break;
+    case NODE_KIND_DO:
+      walk_loop(lv, NULL, node->lbody, node->lcond, NULL);
+      break;
+    case NODE_KIND_FOR:
+      walk_loop(lv, node->linit, node->lcond, node->lbody, node->lstep);
+      break;
+    case NODE_KIND_SWITCH:
+      walk(lv, node->sexpr);
+      walk(lv, node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      walk(lv, node->cstmt);
+      break;
+    }
+    lv->pos++;
+  }
+}
+
+static int comp_slot(const void *a, const void *b) {
+  type_t *x = (*(slot_t **)a)->var->type, *y = (*(slot_t **)b)->var->type;
+  if (x->align != y->align) {
+    return y->align - x->align;
+  }
+  return y->total_size - x->total_size;
+}
+
+static bool overlaps(slot_t *s, int offset, slot_t *t) {
+  if (s->end < t->start || t->end < s->start) {
+    return false;
+  }
+  int voffset = t->var->voffset;
+  return offset - s->var->type->total_size < voffset && voffset - t->var->type->total_size < offset;
+}
+
+// Places the local variables of func below offset; returns the frame size
+int frame_layout(parse_t *parse, node_t *func, int offset) {
+  layout_t lv;
+  lv.slots = vector_new();
+  lv.pos = 0;
+  // the prologue stores all register parameters at once; those in memory already have their offsets
+  for (int i = 0; i < func->fargs->size; i++) {
+    slot_t *s = touch(&lv, (node_t *)func->fargs->data[i]);
+    if (s != NULL) {
+      s->start = 0;
+    }
+  }
+  walk(&lv, func->fbody);
+  for (int i = 0; i < func->fargs->size; i++) {
+    slot_t *s = find_slot(&lv, (node_t *)func->fargs->data[i]);
+    if (s != NULL && s->pinned) {
+      // its address may be used until the function returns
+      s->end = lv.pos;
+    }
+  }
+
+  qsort(lv.slots->data, lv.slots->size, sizeof (void *), comp_slot);
+  int size = offset;
+  for (int i = 0; i < lv.slots->size; i++) {
+    slot_t *s = (slot_t *)lv.slots->data[i];
+    type_t *type = s->var->type;
+    int voffset = offset + type->total_size;
+    align(&voffset, type->align);
+    for (int j = 0; j < i; j++) {
+      slot_t *t = (slot_t *)lv.slots->data[j];
+      if (overlaps(s, voffset, t)) {
+        voffset = t->var->voffset + type->total_size;
+        align(&voffset, type->align);
+        j = -1;
+      }
+    }
+    s->var->voffset = voffset;
+    size = max(size, voffset);
+  }
+
+  while (lv.slots->size > 0) {
+    free(vector_pop(lv.slots));
+  }
+  vector_free(lv.slots);
+  return size;
+}
+
+static bool is_frame_operand(char *arg, long *disp) {
+  char *end;
+  *disp = strtol(arg, &end, 10);
+  return strcmp(end, "(%rbp)") == 0;
+}
+
+// Whether the body of f can address its frame through %rsp
+static bool is_frameless(vector_t *insts, frame_t *f) {
+  if (f->size + 8 > RED_ZONE) {
+    return false;
+  }
+  for (int i = f->body; i < f->end; i++) {
+    inst_t *inst = (inst_t *)insts->data[i];
+    if (inst->op == NULL) {
+      continue;
+    }
+    if (strcmp(inst->op, "call") == 0 || strcmp(inst->op, "push") == 0 || strcmp(inst->op, "pop") == 0) {
+      return false;
+    }
+    for (int j = 0; j < inst->nargs; j++) {
+      long disp;
+      if (strstr(inst->args[j], "%rsp") != NULL ||
+          (strstr(inst->args[j], "%rbp") != NULL && !is_frame_operand(inst->args[j], &disp))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void drop_frame(vector_t *insts, frame_t *f) {
+  for (int i = f->begin; i < f->body; i++) {
+    ((inst_t *)insts->data[i])->op = NULL;
+  }
+  for (int i = f->body; i < f->end; i++) {
+    inst_t *inst = (inst_t *)insts->data[i];
+    if (inst->op == NULL) {
+      continue;
+    }
+    if (strcmp(inst->op, "leave") == 0) {
+      inst->op = NULL;
+      continue;
+    }
+    for (int j = 0; j < inst->nargs; j++) {
+      long disp;
+      if (is_frame_operand(inst->args[j], &disp)) {
+        inst->args[j] = emit_format("%ld(%%rsp)", disp - 8);
+      }
+    }
+  }
+}
+
+void frame_finish(parse_t *parse) {
+  vector_t *insts = emit_insts();
+  for (int i = 0; i < parse->frames->size; i++) {
+    frame_t *f = (frame_t *)parse->frames->data[i];
+    bool frameless = is_frameless(insts, f);
+    if (frameless) {
+      drop_frame(insts, f);
+    }
+    if (parse->option->stats) {
+      fprintf(stderr, "frame %s %d%s\n", f->name, f->size, frameless ? " red-zone" : "");
+    }
+  }
+}
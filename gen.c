@@ -7,8 +7,19 @@
 #include <string.h>
 #include "hcc.h"
 
+#define SWITCH_CHAIN_MAX      4    // up to this many cases use a compare chain
+#define SWITCH_TABLE_DENSITY  3    // table when the value range <= cases * density
+#define SWITCH_TABLE_MAX_SIZE 4096
+
 static const char *REGS[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 static const char *MREGS[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+static const char *WREGS[] = {"di", "si", "dx", "cx", "r8w", "r9w"};
+static const char *BREGS[] = {"dil", "sil", "dl", "cl", "r8b", "r9b"};
+static const int TMP_REGS[] = {REG_R10, REG_R11};
+static const int XTMP_REGS[] = {REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11};
+// vectorized loops; see the limits in hcc.h
+static const char *VBASE_REGS[] = {"rsi", "rdi", "r8", "r9"};
+static const char *VEXPR_REGS[] = {"xmm0", "xmm1", "xmm8", "xmm9", "xmm10", "xmm11"};
 
 static void emitf_noindent(char *fmt, ...);
 static void emitf(char *fmt, ...);
@@ -17,6 +28,11 @@ static void emit_pop(parse_t *parse, const char *reg);
 static void emit_push_xmm(parse_t *parse, int n);
 static void emit_pop_xmm(parse_t *parse, int n);
 static void emit_add_rsp(parse_t *parse, int n);
+static bool has_call(node_t *node);
+static int tmp_reg_acquire(parse_t *parse, node_t *next, bool isfloat);
+static void tmp_reg_release(parse_t *parse, int reg);
+static int emit_push_tmp(parse_t *parse, node_t *next, bool isfloat);
+static void emit_pop_tmp(parse_t *parse, int reg, bool isfloat);
 static void emit_int(parse_t *parse, node_t *node);
 static void emit_float(parse_t *parse, node_t *node);
 static void emit_string(parse_t *parse, node_t *node);
@@ -30,7 +46,7 @@ static void emit_unary_op_expression(parse_t *parse, node_t *node);
 static void emit_declaration_init_array(parse_t *parse, node_t *var, type_t *type, vector_t *vals, int offset);
 static void emit_declaration_init_struct(parse_t *parse, node_t *var, type_t *type, vector_t *vals, int offset);
 static void emit_declaration_init(parse_t *parse, node_t *var, node_t *init);
-static void emit_call(parse_t *parse, node_t *node);
+static bool emit_call(parse_t *parse, node_t *node, bool tail);
 static void emit_if(parse_t *parse, node_t *node);
 static void emit_while(parse_t *parse, node_t *node);
 static void emit_do(parse_t *parse, node_t *node);
@@ -44,23 +60,22 @@ static void emit_expression(parse_t *parse, node_t *node);
 static void emit_function(parse_t *parse, node_t *node);
 static void emit_global(parse_t *parse, node_t *node);
 static void emit_data_section(parse_t *parse);
+static void emit_leave(parse_t *parse);
+static void emit_epilogue(parse_t *parse);
 static void emit_builtin_va_start(parse_t *parse, node_t *func);
 
 static void emitf_noindent(char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vfprintf(stdout, fmt, args);
+  emit_vline(false, fmt, args);
   va_end(args);
-  fprintf(stdout, "\n");
 }
 
 static void emitf(char *fmt, ...) {
   va_list args;
-  fprintf(stdout, "\t");
   va_start(args, fmt);
-  vfprintf(stdout, fmt, args);
+  emit_vline(true, fmt, args);
   va_end(args);
-  fprintf(stdout, "\n");
 }
 
 static void emit_push(parse_t *parse, const char *reg) {
@@ -94,6 +109,98 @@ static void emit_add_rsp(parse_t *parse, int n) {
   assert(parse->stackpos >= 0);
 }
 
+static bool has_call(node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_NOP:
+    case NODE_KIND_LITERAL:
+    case NODE_KIND_STRING_LITERAL:
+    case NODE_KIND_VARIABLE:
+      break;
+    case NODE_KIND_BINARY_OP:
+      if (has_call(node->left) || (node->op != '.' && has_call(node->right))) {
+        return true;
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if (has_call(node->operand)) {
+        return true;
+      }
+      break;
+    default:
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Temporary registers hold the left operand of a binary operation while
+ * the right one is evaluated. They are caller-saved, so they are only
+ * handed out when nothing evaluated in between (next) contains a call.
+ */
+static int tmp_reg_acquire(parse_t *parse, node_t *next, bool isfloat) {
+  if (parse->option->optimize < 1 || has_call(next)) {
+    return REG_NONE;
+  }
+  if (isfloat) {
+    if (parse->xtmpdepth >= (int)(sizeof (XTMP_REGS) / sizeof (XTMP_REGS[0]))) {
+      return REG_NONE;
+    }
+    return XTMP_REGS[parse->xtmpdepth++];
+  }
+  if (parse->tmpdepth >= (int)(sizeof (TMP_REGS) / sizeof (TMP_REGS[0]))) {
+    return REG_NONE;
+  }
+  return TMP_REGS[parse->tmpdepth++];
+}
+
+static void tmp_reg_release(parse_t *parse, int reg) {
+  if (reg == REG_NONE) {
+    return;
+  }
+  if (reg_is_xmm(reg)) {
+    parse->xtmpdepth--;
+    assert(XTMP_REGS[parse->xtmpdepth] == reg);
+  } else {
+    parse->tmpdepth--;
+    assert(TMP_REGS[parse->tmpdepth] == reg);
+  }
+}
+
+static int emit_push_tmp(parse_t *parse, node_t *next, bool isfloat) {
+  int reg = tmp_reg_acquire(parse, next, isfloat);
+  if (reg == REG_NONE) {
+    if (isfloat) {
+      emit_push_xmm(parse, 0);
+    } else {
+      emit_push(parse, "rax");
+    }
+  } else if (isfloat) {
+    emitf("movsd %%xmm0, %%%s", reg_name(reg, 8));
+  } else {
+    emitf("mov %%rax, %%%s", reg_name(reg, 8));
+  }
+  return reg;
+}
+
+static void emit_pop_tmp(parse_t *parse, int reg, bool isfloat) {
+  if (reg == REG_NONE) {
+    if (isfloat) {
+      emit_pop_xmm(parse, 0);
+    } else {
+      emit_pop(parse, "rax");
+    }
+    return;
+  }
+  if (isfloat) {
+    emitf("movsd %%%s, %%xmm0", reg_name(reg, 8));
+  } else {
+    emitf("mov %%%s, %%rax", reg_name(reg, 8));
+  }
+  tmp_reg_release(parse, reg);
+}
+
 static void emit_int(parse_t *parse, node_t *node) {
   emitf("mov $%ld, %%rax", node->ival);
 }
@@ -113,9 +220,7 @@ static void emit_string(parse_t *parse, node_t *node) {
 }
 
 static void emit_string_data(string_t *str) {
-  fprintf(stdout, "\t.string \"");
-  string_print_quote(str, stdout);
-  fprintf(stdout, "\"\n");
+  emit_string_literal(str);
 }
 
 static void emit_global_variable(parse_t *parse, node_t *node) {
@@ -160,6 +265,16 @@ static void emit_variable(parse_t *parse, node_t *node) {
     emit_global_variable(parse, node);
     return;
   }
+  if (node->vreg != REG_NONE) {
+    if (node->type->kind == TYPE_KIND_FLOAT) {
+      emitf("movss %%%s, %%xmm0", reg_name(node->vreg, 8));
+    } else if (type_is_float(node->type)) {
+      emitf("movsd %%%s, %%xmm0", reg_name(node->vreg, 8));
+    } else {
+      emitf("mov %%%s, %%rax", reg_name(node->vreg, 8));
+    }
+    return;
+  }
   switch (node->type->kind) {
   case TYPE_KIND_ARRAY:
     assert(node->type->parent != NULL);
@@ -236,11 +351,47 @@ static void emit_save_global_to(parse_t *parse, type_t *type, const char *name,
   }
 }
 
+static void emit_save_reg(parse_t *parse, type_t *type, int reg) {
+  const char *name = reg_name(reg, 8);
+  switch (type->kind) {
+  case TYPE_KIND_FLOAT:
+    emitf("movss %%xmm0, %%%s", name);
+    break;
+  case TYPE_KIND_DOUBLE:
+  case TYPE_KIND_LDOUBLE:
+    emitf("movsd %%xmm0, %%%s", name);
+    break;
+  default:
+    // keep the register in the same form a stack slot load would produce
+    switch (type->bytes) {
+    case 1:
+      emitf("movsbq %%al, %%%s", name);
+      break;
+    case 2:
+      emitf("movswq %%ax, %%%s", name);
+      break;
+    case 4:
+      emitf("movslq %%eax, %%%s", name);
+      break;
+    case 8:
+      emitf("mov %%rax, %%%s", name);
+      break;
+    default:
+      errorf("invalid variable type");
+    }
+  }
+}
+
 static void emit_save_to(parse_t *parse, node_t *var, type_t *type, int offset) {
   if (var->global) {
     emit_save_global_to(parse, type, var->vname, offset);
     return;
   }
+  if (var->vreg != REG_NONE) {
+    assert(offset == 0);
+    emit_save_reg(parse, type, var->vreg);
+    return;
+  }
   switch (type->kind) {
   case TYPE_KIND_FLOAT:
     emitf("movss %%xmm0, %d(%%rbp)", -var->voffset + offset);
@@ -287,18 +438,10 @@ static void emit_save(parse_t *parse, node_t *var, type_t *type, int base, int a
 
 static void emit_store_struct(parse_t *parse, node_t *var, type_t *type, int offset) {
   if (var->kind == NODE_KIND_UNARY_OP && var->op == '*') {
-    if (type_is_float(type)) {
-      emit_push_xmm(parse, 0);
-    } else {
-      emit_push(parse, "rax");
-    }
+    int tmp = emit_push_tmp(parse, var->operand, type_is_float(type));
     emit_expression(parse, var->operand);
     emitf("mov %%rax, %%rcx");
-    if (type_is_float(type)) {
-      emit_pop_xmm(parse, 0);
-    } else {
-      emit_pop(parse, "rax");
-    }
+    emit_pop_tmp(parse, tmp, type_is_float(type));
     switch (type->kind) {
     case TYPE_KIND_FLOAT:
       emitf("movss %%xmm0, %d(%%rcx)", offset);
@@ -336,18 +479,10 @@ static void emit_store_struct(parse_t *parse, node_t *var, type_t *type, int off
 static void emit_store(parse_t *parse, node_t *var, type_t *type) {
   emit_cast(parse, var->type, type);
   if (var->kind == NODE_KIND_UNARY_OP && var->op == '*') {
-    if (type_is_float(var->type)) {
-      emit_push_xmm(parse, 0);
-    } else {
-      emit_push(parse, "rax");
-    }
+    int tmp = emit_push_tmp(parse, var->operand, type_is_float(var->type));
     emit_expression(parse, var->operand);
     emitf("mov %%rax, %%rcx");
-    if (type_is_float(var->type)) {
-      emit_pop_xmm(parse, 0);
-    } else {
-      emit_pop(parse, "rax");
-    }
+    emit_pop_tmp(parse, tmp, type_is_float(var->type));
     switch (var->type->kind) {
     case TYPE_KIND_FLOAT:
       emitf("movss %%xmm0, (%%rcx)");
@@ -385,11 +520,19 @@ static void emit_store(parse_t *parse, node_t *var, type_t *type) {
 
 static void emit_cast_to_bool(parse_t *parse, type_t *type) {
   if (type_is_float(type)) {
-    emit_push_xmm(parse, 1);
-    emitf("xorpd %%xmm1, %%xmm1");
-    emitf("%s %%xmm1, %%xmm0", type->kind == TYPE_KIND_FLOAT ? "ucomiss" : "ucomisd");
-    emitf("setne %%al");
-    emit_pop_xmm(parse, 1);
+    int tmp = tmp_reg_acquire(parse, NULL, true);
+    if (tmp != REG_NONE) {
+      emitf("xorpd %%%s, %%%s", reg_name(tmp, 8), reg_name(tmp, 8));
+      emitf("%s %%%s, %%xmm0", type->kind == TYPE_KIND_FLOAT ? "ucomiss" : "ucomisd", reg_name(tmp, 8));
+      emitf("setne %%al");
+      tmp_reg_release(parse, tmp);
+    } else {
+      emit_push_xmm(parse, 1);
+      emitf("xorpd %%xmm1, %%xmm1");
+      emitf("%s %%xmm1, %%xmm0", type->kind == TYPE_KIND_FLOAT ? "ucomiss" : "ucomisd");
+      emitf("setne %%al");
+      emit_pop_xmm(parse, 1);
+    }
   } else {
     emitf("cmp $0, %%rax");
     emitf("setne %%al");
@@ -425,6 +568,14 @@ static void emit_cast_to_int(parse_t *parse, type_t *type) {
   }
 }
 
+// Whether converting from to the integer type to can change its value
+static bool is_narrowing(type_t *to, type_t *from) {
+  if (!type_is_int(to) || type_is_bool(to) || to->bytes >= 8) {
+    return false;
+  }
+  return !type_is_int(from) || to->bytes < from->bytes || to->sign != from->sign;
+}
+
 static void emit_cast(parse_t *parse, type_t *to, type_t *from) {
   if (type_is_bool(to)) {
     emit_cast_to_bool(parse, from);
@@ -445,39 +596,300 @@ static void emit_cast(parse_t *parse, type_t *to, type_t *from) {
   }
 }
 
-static void emit_arithmetic_int(parse_t *parse, int op, node_t *node) {
+/*
+ * Strength reduction of *, / and % by an integer constant at -O1. Like the
+ * div/idiv they replace, the sequences work on all 64 bits of %rax, signed
+ * when the left operand is, so they agree for every input. Division by a
+ * constant that is not a power of two multiplies by a magic reciprocal and
+ * keeps the high half of the product (Hacker's Delight, chapter 10). %rcx
+ * and %rdx are scratch, as for idiv.
+ */
+
+// Returns k when n is 2^k, or -1
+static int exact_log2(unsigned long n) {
+  if (n == 0 || (n & (n - 1)) != 0) {
+    return -1;
+  }
+  int k = 0;
+  while (n > 1) {
+    n >>= 1;
+    k++;
+  }
+  return k;
+}
+
+static bool fits_imm32(long n) {
+  return n >= INT32_MIN && n <= INT32_MAX;
+}
+
+static void magic_signed(long d, long *m, int *s) {
+  const unsigned long two63 = 1UL << 63;
+  unsigned long ad = d < 0 ? -(unsigned long)d : (unsigned long)d;
+  unsigned long t = two63 + ((unsigned long)d >> 63);
+  unsigned long anc = t - 1 - t % ad;
+  unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+  unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+  unsigned long delta;
+  int p = 63;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  *m = d < 0 ? -(long)(q2 + 1) : (long)(q2 + 1);
+  *s = p - 64;
+}
+
+static void magic_unsigned(unsigned long d, unsigned long *m, bool *add, int *s) {
+  const unsigned long two63 = 1UL << 63;
+  unsigned long nc = -1UL - (-d) % d;
+  unsigned long q1 = two63 / nc, r1 = two63 - q1 * nc;
+  unsigned long q2 = (two63 - 1) / d, r2 = (two63 - 1) - q2 * d;
+  unsigned long delta;
+  int p = 63;
+  *add = false;
+  do {
+    p++;
+    if (r1 >= nc - r1) {
+      q1 = 2 * q1 + 1;
+      r1 = 2 * r1 - nc;
+    } else {
+      q1 = 2 * q1;
+      r1 = 2 * r1;
+    }
+    if (r2 + 1 >= d - r2) {
+      if (q2 >= two63 - 1) {
+        *add = true;
+      }
+      q2 = 2 * q2 + 1;
+      r2 = 2 * r2 + 1 - d;
+    } else {
+      if (q2 >= two63) {
+        *add = true;
+      }
+      q2 = 2 * q2;
+      r2 = 2 * r2 + 1;
+    }
+    delta = d - 1 - r2;
+  } while (p < 128 && (q1 < delta || (q1 == delta && r1 == 0)));
+  *m = q2 + 1;
+  *s = p - 64;
+}
+
+static bool can_mul_const(long c) {
+  return fits_imm32(c) || exact_log2(c) >= 0;
+}
+
+static void emit_mul_const(long c) {
+  int k = exact_log2(c);
+  if (c == 0) {
+    emitf("xor %%eax, %%eax");
+  } else if (c == -1) {
+    emitf("neg %%rax");
+  } else if (k > 0) {
+    emitf("shl $%d, %%rax", k);
+  } else if (c == 3 || c == 5 || c == 9) {
+    emitf("lea (%%rax,%%rax,%d), %%rax", (int)c - 1);
+  } else if (c != 1) {
+    emitf("imul $%ld, %%rax", c);
+  }
+}
+
+static bool can_div_const(long d, bool sign) {
+  return d != 0 && (sign || d > 0);
+}
+
+// %rax = %rcx - %rax * d, the remainder of the dividend saved in %rcx
+static void emit_remainder(long d) {
+  if (fits_imm32(d)) {
+    emitf("imul $%ld, %%rax", d);
+  } else {
+    emitf("mov $%ld, %%rdx", d);
+    emitf("imul %%rdx, %%rax");
+  }
+  emitf("sub %%rax, %%rcx");
+  emitf("mov %%rcx, %%rax");
+}
+
+static void emit_div_const(int op, long d, type_t *type) {
+  bool sign = type->sign;
+  if (!sign && type->bytes == 4) {
+    // an unsigned int may be held sign-extended; the sequences below need all 64 bits
+    emitf("mov %%eax, %%eax");
+  }
+  if (d == 1 || (sign && d == -1)) {
+    if (op == '%') {
+      emitf("xor %%eax, %%eax");
+    } else if (d == -1) {
+      emitf("neg %%rax");
+    }
+    return;
+  }
+  unsigned long ad = sign && d < 0 ? -(unsigned long)d : (unsigned long)d;
+  int k = exact_log2(ad);
+  if (k >= 0 && !sign) {
+    if (op == '/') {
+      emitf("shr $%d, %%rax", k);
+    } else if (k < 32) {
+      emitf("and $%ld, %%rax", (1L << k) - 1);
+    } else {
+      emitf("shl $%d, %%rax", 64 - k);
+      emitf("shr $%d, %%rax", 64 - k);
+    }
+    return;
+  }
+  emitf("mov %%rax, %%rcx");
+  if (k >= 0) {
+    // bias a negative dividend by 2^k - 1 to round toward zero
+    emitf("mov %%rax, %%rdx");
+    emitf("sar $63, %%rdx");
+    emitf("shr $%d, %%rdx", 64 - k);
+    emitf("add %%rdx, %%rax");
+    emitf("sar $%d, %%rax", k);
+    if (op == '%') {
+      emitf("shl $%d, %%rax", k);
+      emitf("sub %%rax, %%rcx");
+      emitf("mov %%rcx, %%rax");
+    } else if (d < 0) {
+      emitf("neg %%rax");
+    }
+    return;
+  }
+  int s;
+  if (sign) {
+    long m;
+    magic_signed(d, &m, &s);
+    emitf("mov $%ld, %%rdx", m);
+    emitf("imul %%rdx");
+    if (d > 0 && m < 0) {
+      emitf("add %%rcx, %%rdx");
+    } else if (d < 0 && m > 0) {
+      emitf("sub %%rcx, %%rdx");
+    }
+    if (s > 0) {
+      emitf("sar $%d, %%rdx", s);
+    }
+    emitf("mov %%rdx, %%rax");
+    emitf("shr $63, %%rax");
+    emitf("add %%rdx, %%rax");
+  } else {
+    unsigned long m;
+    bool add;
+    magic_unsigned(d, &m, &add, &s);
+    emitf("mov $%ld, %%rdx", (long)m);
+    emitf("mul %%rdx");
+    if (add) {
+      emitf("mov %%rcx, %%rax");
+      emitf("sub %%rdx, %%rax");
+      emitf("shr $1, %%rax");
+      emitf("add %%rdx, %%rax");
+      if (s > 1) {
+        emitf("shr $%d, %%rax", s - 1);
+      }
+    } else {
+      emitf("mov %%rdx, %%rax");
+      if (s > 0) {
+        emitf("shr $%d, %%rax", s);
+      }
+    }
+  }
+  if (op == '%') {
+    emit_remainder(d);
+  }
+}
+
+static bool is_int_constant(node_t *node) {
+  return node->kind == NODE_KIND_LITERAL && type_is_int(node->type);
+}
+
+// Whether node multiplies or divides an integer by a constant that has a cheaper sequence
+static bool is_reducible(parse_t *parse, node_t *node) {
+  int op = node->op;
+  if (parse->option->optimize < 1 || !type_is_int(node->left->type) || !type_is_int(node->right->type)) {
+    return false;
+  }
+  if (op == '*') {
+    return (is_int_constant(node->right) && can_mul_const(node->right->ival)) ||
+           (is_int_constant(node->left) && can_mul_const(node->left->ival));
+  }
+  return (op == '/' || op == '%') && is_int_constant(node->right) &&
+         can_div_const(node->right->ival, node->left->type->sign);
+}
+
+static void emit_reduced_int(parse_t *parse, node_t *node) {
+  if (node->op == '*') {
+    bool right = is_int_constant(node->right) && can_mul_const(node->right->ival);
+    emit_expression(parse, right ? node->left : node->right);
+    emit_mul_const(right ? node->right->ival : node->left->ival);
+  } else {
+    emit_expression(parse, node->left);
+    emit_div_const(node->op, node->right->ival, node->left->type);
+  }
+}
+
+static void emit_arithmetic_int(parse_t *parse, int op, node_t *node, int tmp) {
   if (node->type->kind == TYPE_KIND_PTR || node->type->kind == TYPE_KIND_ARRAY) {
     assert(node->type->parent != NULL && (op == '+' || op == '-'));
-    if (node->type->parent->total_size > 1) {
-      emitf("imul $%d, %%rax", node->type->parent->total_size);
+    int size = node->type->parent->total_size;
+    if (parse->option->optimize >= 1) {
+      emit_mul_const(size);
+    } else if (size > 1) {
+      emitf("imul $%d, %%rax", size);
     }
   }
-  emitf("mov %%rax, %%rcx");
-  emit_pop(parse, "rax");
+  const char *rhs = "rcx";
+  if (tmp == REG_NONE) {
+    emitf("mov %%rax, %%rcx");
+    emit_pop(parse, "rax");
+  } else if (op == '-' || op == '/' || op == '%') {
+    // the left operand has to end up in rax
+    emitf("xchg %%rax, %%%s", reg_name(tmp, 8));
+    rhs = reg_name(tmp, 8);
+  } else {
+    // commutative, so operate on the right operand in place
+    rhs = reg_name(tmp, 8);
+  }
   if (op == '/' || op == '%') {
     if (node->type->sign) {
       emitf("cqto");
-      emitf("idiv %%rcx");
+      emitf("idiv %%%s", rhs);
     } else {
+      if (node->type->bytes == 4) {
+        // divide the 32-bit values, not their sign extensions
+        const char *rhs32 = tmp == REG_NONE ? "ecx" : reg_name(tmp, 4);
+        emitf("mov %%eax, %%eax");
+        emitf("mov %%%s, %%%s", rhs32, rhs32);
+      }
       emitf("xor %%edx, %%edx");
-      emitf("div %%rcx");
+      emitf("div %%%s", rhs);
     }
     if (op == '%') {
-      emitf("mov %%edx, %%eax");
+      emitf("mov %%rdx, %%rax");
     }
   } else {
     switch (op) {
     case '+':
-      emitf("add %%rcx, %%rax");
+      emitf("add %%%s, %%rax", rhs);
         break;
     case '-':
-      emitf("sub %%rcx, %%rax");
+      emitf("sub %%%s, %%rax", rhs);
       break;
     case '*':
-      emitf("imul %%rcx, %%rax");
+      emitf("imul %%%s, %%rax", rhs);
       break;
     case '^':
-      emitf("xor %%rcx, %%rax");
+      emitf("xor %%%s, %%rax", rhs);
       break;
     default:
       errorf("unknown operator");
@@ -485,30 +897,50 @@ static void emit_arithmetic_int(parse_t *parse, int op, node_t *node) {
   }
 }
 
-static void emit_arithmetic_float(parse_t *parse, int op, bool isdouble) {
-  emitf("%s %%xmm0, %%xmm1", isdouble ? "movsd" : "movss");
-  emit_pop_xmm(parse, 0);
+// pointer +/- literal whose scaled value fits an immediate
+static bool is_scaled_constant(node_t *node) {
+  node_t *left = node->left, *right = node->right;
+  if ((node->op != '+' && node->op != '-') || right->kind != NODE_KIND_LITERAL || !type_is_int(right->type) ||
+      (left->type->kind != TYPE_KIND_PTR && left->type->kind != TYPE_KIND_ARRAY)) {
+    return false;
+  }
+  long offset = right->ival * left->type->parent->total_size;
+  return offset >= INT32_MIN && offset <= INT32_MAX;
+}
+
+static void emit_arithmetic_float(parse_t *parse, int op, bool isdouble, int tmp) {
+  const char *lhs = "xmm0", *rhs = "xmm1";
+  if (tmp == REG_NONE) {
+    emitf("%s %%xmm0, %%xmm1", isdouble ? "movsd" : "movss");
+    emit_pop_xmm(parse, 0);
+  } else if (op == '-' || op == '/') {
+    lhs = reg_name(tmp, 8);
+    rhs = "xmm0";
+  } else {
+    rhs = reg_name(tmp, 8);
+  }
   switch (op) {
   case '+':
-    emitf("%s %%xmm1, %%xmm0", isdouble ? "addsd" : "addss");
+    emitf("%s %%%s, %%%s", isdouble ? "addsd" : "addss", rhs, lhs);
       break;
   case '-':
-    emitf("%s %%xmm1, %%xmm0", isdouble ? "subsd" : "subss");
+    emitf("%s %%%s, %%%s", isdouble ? "subsd" : "subss", rhs, lhs);
     break;
   case '*':
-    emitf("%s %%xmm1, %%xmm0", isdouble ? "mulsd" : "mulss");
+    emitf("%s %%%s, %%%s", isdouble ? "mulsd" : "mulss", rhs, lhs);
     break;
   case '/':
-    emitf("%s %%xmm1, %%xmm0", isdouble ? "divsd" : "divss");
+    emitf("%s %%%s, %%%s", isdouble ? "divsd" : "divss", rhs, lhs);
     break;
   default:
     errorf("unknown operator");
   }
+  if (strcmp(lhs, "xmm0") != 0) {
+    emitf("%s %%%s, %%xmm0", isdouble ? "movsd" : "movss", lhs);
+  }
 }
 
-static void emit_bitshift(parse_t *parse, int op, node_t *node) {
-  emitf("mov %%rax, %%rcx");
-  emit_pop(parse, "rax");
+static void emit_bitshift(parse_t *parse, int op, node_t *node, const char *count) {
   const char *opstr;
   if (op == OP_SAL) {
     opstr = "sal";
@@ -519,88 +951,191 @@ static void emit_bitshift(parse_t *parse, int op, node_t *node) {
   }
   switch (node->type->bytes) {
   case 1:
-    emitf("%s %%cl, %%al", opstr);
+    emitf("%s %s, %%al", opstr, count);
     break;
   case 2:
-    emitf("%s %%cl, %%ax", opstr);
+    emitf("%s %s, %%ax", opstr, count);
     break;
   case 4:
-    emitf("%s %%cl, %%eax", opstr);
+    emitf("%s %s, %%eax", opstr, count);
     break;
   case 8:
-    emitf("%s %%cl, %%rax", opstr);
+    emitf("%s %s, %%rax", opstr, count);
     break;
   default:
     errorf("invalid variable type");
   }
 }
 
-static void emit_arithmetic_bit(parse_t *parse, int op) {
+static void emit_arithmetic_bit(parse_t *parse, int op, int tmp) {
+  const char *rhs = "rcx";
+  if (tmp == REG_NONE) {
+    emit_pop(parse, "rcx");
+  } else {
+    rhs = reg_name(tmp, 8);
+  }
   switch (op) {
   case '&':
-    emit_pop(parse, "rcx");
-    emitf("and %%rcx, %%rax");
+    emitf("and %%%s, %%rax", rhs);
     break;
   case '|':
-    emit_pop(parse, "rcx");
-    emitf("or %%rcx, %%rax");
+    emitf("or %%%s, %%rax", rhs);
     break;
   default:
     errorf("unknown operator");
   }
 }
 
-static void emit_comp_int(parse_t *parse, int op, bool sign) {
-  emit_pop(parse, "rcx");
-  emitf("cmp %%rax, %%rcx");
+// Condition code of a comparison, the suffix of its setcc and jcc
+static const char *cond_code(int op, bool sign) {
   switch (op) {
   case OP_EQ:
-    emitf("sete %%al");
-    break;
+    return "e";
   case OP_NE:
-    emitf("setne %%al");
-    break;
+    return "ne";
   case '<':
-    emitf("%s %%al", sign ? "setl" : "setb");
-    break;
+    return sign ? "l" : "b";
   case OP_LE:
-    emitf("%s %%al", sign ? "setle" : "setbe");
-    break;
+    return sign ? "le" : "be";
   case '>':
-    emitf("%s %%al", sign ? "setg" : "seta");
-    break;
+    return sign ? "g" : "a";
   case OP_GE:
-    emitf("%s %%al", sign ? "setge" : "setae");
-    break;
+    return sign ? "ge" : "ae";
   }
-  emitf("movzb %%al, %%eax");
+  errorf("unknown operator");
+  return NULL;
 }
 
-static void emit_comp_float(parse_t *parse, int op, bool isdouble) {
-  emitf("%s %%xmm0, %%xmm1", isdouble ? "movsd" : "movss");
-  emit_pop_xmm(parse, 0);
-  emitf("%s %%xmm1, %%xmm0", isdouble ? "ucomisd" : "ucomiss");
+// The comparison that holds exactly when op does not hold on the same flags
+static int negate_comp(int op) {
   switch (op) {
   case OP_EQ:
-    emitf("sete %%al");
-    break;
+    return OP_NE;
   case OP_NE:
-    emitf("setne %%al");
-    break;
+    return OP_EQ;
   case '<':
-    emitf("setb %%al");
-    break;
+    return OP_GE;
   case OP_LE:
-    emitf("setbe %%al");
-    break;
+    return '>';
   case '>':
-    emitf("seta %%al");
-    break;
+    return OP_LE;
   case OP_GE:
-    emitf("setae %%al");
-    break;
+    return '<';
   }
-  emitf("movzb %%al, %%eax");
+  errorf("unknown operator");
+  return 0;
+}
+
+static bool is_comp(int op) {
+  return op == OP_EQ || op == OP_NE || op == '<' || op == OP_LE || op == '>' || op == OP_GE;
+}
+
+static void emit_cmp_int(parse_t *parse, int tmp) {
+  if (tmp == REG_NONE) {
+    emit_pop(parse, "rcx");
+    emitf("cmp %%rax, %%rcx");
+  } else {
+    emitf("cmp %%rax, %%%s", reg_name(tmp, 8));
+  }
+}
+
+static void emit_cmp_float(parse_t *parse, bool isdouble, int tmp) {
+  if (tmp == REG_NONE) {
+    emitf("%s %%xmm0, %%xmm1", isdouble ? "movsd" : "movss");
+    emit_pop_xmm(parse, 0);
+    emitf("%s %%xmm1, %%xmm0", isdouble ? "ucomisd" : "ucomiss");
+  } else {
+    emitf("%s %%xmm0, %%%s", isdouble ? "ucomisd" : "ucomiss", reg_name(tmp, 8));
+  }
+}
+
+// The register of an allocated integer variable, REG_NONE for anything else
+static int var_reg(node_t *node) {
+  if (node->kind != NODE_KIND_VARIABLE || node->global || node->vreg == REG_NONE || reg_is_xmm(node->vreg)) {
+    return REG_NONE;
+  }
+  return node->vreg;
+}
+
+static int emit_save_left(parse_t *parse, node_t *right) {
+  int tmp = tmp_reg_acquire(parse, right, false);
+  if (tmp == REG_NONE) {
+    emit_push(parse, "rcx");
+    emit_push(parse, "rax");
+  } else {
+    emitf("mov %%rax, %%%s", reg_name(tmp, 8));
+  }
+  return tmp;
+}
+
+// Evaluates left and keeps it while right is evaluated; allocated variables are copied straight to the temporary
+static int emit_left(parse_t *parse, node_t *left, node_t *right) {
+  if (var_reg(left) != REG_NONE) {
+    int tmp = tmp_reg_acquire(parse, right, false);
+    if (tmp != REG_NONE) {
+      emitf("mov %%%s, %%%s", reg_name(left->vreg, 8), reg_name(tmp, 8));
+      return tmp;
+    }
+  }
+  emit_expression(parse, left);
+  return emit_save_left(parse, right);
+}
+
+static void emit_release_left(parse_t *parse, int tmp) {
+  if (tmp == REG_NONE) {
+    emit_pop(parse, "rcx");
+  } else {
+    tmp_reg_release(parse, tmp);
+  }
+}
+
+// Sets the flags for the comparison node; returns whether they are to be read as signed
+static bool emit_compare(parse_t *parse, node_t *node) {
+  if (type_is_float(node->left->type) || type_is_float(node->right->type)) {
+    type_t *t = node->left->type;
+    if (type_is_int(t)) {
+      t = node->right->type;
+    } else if (node->right->type->kind == TYPE_KIND_DOUBLE || node->right->type->kind == TYPE_KIND_LDOUBLE) {
+      t = node->right->type;
+    }
+    assert(type_is_float(t));
+    emit_expression(parse, node->left);
+    emit_cast(parse, t, node->left->type);
+    int tmp = emit_push_tmp(parse, node->right, true);
+    emit_expression(parse, node->right);
+    emit_cast(parse, t, node->right->type);
+    emit_cmp_float(parse, t->kind == TYPE_KIND_DOUBLE || t->kind == TYPE_KIND_LDOUBLE, tmp);
+    tmp_reg_release(parse, tmp);
+    return false;
+  }
+  bool sign = node->left->type->sign && node->right->type->sign;
+  // allocated variables are compared in their registers
+  int left = var_reg(node->left), right = var_reg(node->right);
+  if (parse->option->optimize >= 1 && is_int_constant(node->right) && fits_imm32(node->right->ival)) {
+    if (left != REG_NONE) {
+      emitf("cmp $%ld, %%%s", node->right->ival, reg_name(left, 8));
+    } else {
+      emit_expression(parse, node->left);
+      emitf("cmp $%ld, %%rax", node->right->ival);
+    }
+    return sign;
+  }
+  if (right != REG_NONE) {
+    emit_expression(parse, node->left);
+    emitf("cmp %%%s, %%rax", reg_name(right, 8));
+    return sign;
+  }
+  if (left != REG_NONE) {
+    emit_expression(parse, node->right);
+    emitf("cmp %%rax, %%%s", reg_name(left, 8));
+    return sign;
+  }
+  emit_expression(parse, node->left);
+  int tmp = emit_save_left(parse, node->right);
+  emit_expression(parse, node->right);
+  emit_cmp_int(parse, tmp);
+  emit_release_left(parse, tmp);
+  return sign;
 }
 
 static void emit_logical(parse_t *parse, node_t *node) {
@@ -608,39 +1143,90 @@ static void emit_logical(parse_t *parse, node_t *node) {
   emitf("test %%rax, %%rax");
   if (node->op == OP_ANDAND) {
     emitf("mov $0, %%rax");
-    emitf("je .L%p", node);
+    emitf("je .L%p_end", node);
   } else {
     emitf("mov $1, %%rax");
-    emitf("jne .L%p", node);
+    emitf("jne .L%p_end", node);
   }
   emit_expression(parse, node->right);
   emitf("test %%rax, %%rax");
   if (node->op == OP_ANDAND) {
     emitf("mov $0, %%rax");
-    emitf("je .L%p", node);
+    emitf("je .L%p_end", node);
     emitf("mov $1, %%rax");
   } else {
     emitf("mov $1, %%rax");
-    emitf("jne .L%p", node);
+    emitf("jne .L%p_end", node);
     emitf("mov $0, %%rax");
   }
-  emitf(".L%p:", node);
+  emitf(".L%p_end:", node);
 }
 
-static void emit_binary_op_expression(parse_t *parse, node_t *node) {
-  int op = node->op;
-  if (op == '=') {
-    emit_expression(parse, node->right);
-    emit_store(parse, node->left, node->right->type);
-    return;
-  } else if (op == '.') {
-    emit_expression(parse, node->left);
-    if (node->type->kind == TYPE_KIND_ARRAY || node->type->kind == TYPE_KIND_STRUCT) {
-      emitf("lea %d(%%rax), %%rax", node->right->voffset);
-    } else if (node->type->kind == TYPE_KIND_FLOAT) {
-      emitf("movss %d(%%rax), %%xmm0", node->right->voffset);
-    } else if (node->type->kind == TYPE_KIND_DOUBLE) {
-      emitf("movsd %d(%%rax), %%xmm0", node->right->voffset);
+// Whether node is integer arithmetic that can take an allocated variable operand straight from its register
+static bool is_direct(node_t *node) {
+  switch (node->op) {
+  case '+': case '*': case '^': case '&': case '|':
+    break;
+  case '-':
+    if (var_reg(node->right) == REG_NONE) {
+      return false;
+    }
+    break;
+  default:
+    return false;
+  }
+  if (!type_is_int(node->left->type) || !type_is_int(node->right->type) || type_is_float(node->type)) {
+    return false;
+  }
+  return var_reg(node->right) != REG_NONE || var_reg(node->left) != REG_NONE;
+}
+
+static void emit_direct_int(parse_t *parse, node_t *node) {
+  int reg = var_reg(node->right);
+  if (reg != REG_NONE) {
+    emit_expression(parse, node->left);
+  } else {
+    // commutative, so the left operand can come second
+    reg = node->left->vreg;
+    emit_expression(parse, node->right);
+  }
+  const char *insn;
+  switch (node->op) {
+  case '+':
+    insn = "add";
+    break;
+  case '-':
+    insn = "sub";
+    break;
+  case '*':
+    insn = "imul";
+    break;
+  case '^':
+    insn = "xor";
+    break;
+  case '&':
+    insn = "and";
+    break;
+  default:
+    insn = "or";
+  }
+  emitf("%s %%%s, %%rax", insn, reg_name(reg, 8));
+}
+
+static void emit_binary_op_expression(parse_t *parse, node_t *node) {
+  int op = node->op;
+  if (op == '=') {
+    emit_expression(parse, node->right);
+    emit_store(parse, node->left, node->right->type);
+    return;
+  } else if (op == '.') {
+    emit_expression(parse, node->left);
+    if (node->type->kind == TYPE_KIND_ARRAY || node->type->kind == TYPE_KIND_STRUCT) {
+      emitf("lea %d(%%rax), %%rax", node->right->voffset);
+    } else if (node->type->kind == TYPE_KIND_FLOAT) {
+      emitf("movss %d(%%rax), %%xmm0", node->right->voffset);
+    } else if (node->type->kind == TYPE_KIND_DOUBLE) {
+      emitf("movsd %d(%%rax), %%xmm0", node->right->voffset);
     } else {
       switch (node->type->bytes) {
       case 1:
@@ -671,53 +1257,60 @@ static void emit_binary_op_expression(parse_t *parse, node_t *node) {
     emit_logical(parse, node);
     return;
   }
+  if (is_reducible(parse, node)) {
+    emit_reduced_int(parse, node);
+    return;
+  }
+  if (is_comp(op)) {
+    emitf("set%s %%al", cond_code(op, emit_compare(parse, node)));
+    emitf("movzb %%al, %%eax");
+    return;
+  }
 
-  emit_expression(parse, node->left);
+  if (is_direct(node)) {
+    emit_direct_int(parse, node);
+    return;
+  }
   if (type_is_float(node->type)) {
+    emit_expression(parse, node->left);
     emit_cast(parse, node->type, node->left->type);
-    emit_push_xmm(parse, 0);
+    int tmp = emit_push_tmp(parse, node->right, true);
     emit_expression(parse, node->right);
     emit_cast(parse, node->type, node->right->type);
-    emit_arithmetic_float(parse, op, node->type->kind == TYPE_KIND_DOUBLE || node->type->kind == TYPE_KIND_LDOUBLE);
+    emit_arithmetic_float(parse, op, node->type->kind == TYPE_KIND_DOUBLE || node->type->kind == TYPE_KIND_LDOUBLE, tmp);
+    tmp_reg_release(parse, tmp);
   } else if (op == OP_SAL || op == OP_SAR) {
+    emit_expression(parse, node->left);
+    if (parse->option->optimize >= 1 && node->right->kind == NODE_KIND_LITERAL) {
+      char count[32];
+      snprintf(count, sizeof (count), "$%ld", node->right->ival & 63);
+      emit_bitshift(parse, op, node->left, count);
+      return;
+    }
     emit_push(parse, "rcx");
     emit_push(parse, "rax");
     emit_expression(parse, node->right);
-    emit_bitshift(parse, op, node->left);
+    emitf("mov %%rax, %%rcx");
+    emit_pop(parse, "rax");
+    emit_bitshift(parse, op, node->left, "%cl");
     emit_pop(parse, "rcx");
   } else if (op == '&' || op == '|') {
-    emit_push(parse, "rcx");
-    emit_push(parse, "rax");
+    int tmp = emit_left(parse, node->left, node->right);
     emit_expression(parse, node->right);
-    emit_arithmetic_bit(parse, op);
-    emit_pop(parse, "rcx");
-  } else if (op == OP_EQ || op == OP_NE || op == '<' || op == OP_LE || op == '>' || op == OP_GE) {
-    if (type_is_float(node->left->type) || type_is_float(node->right->type)) {
-      type_t *t = node->left->type;
-      if (type_is_int(t)) {
-        t = node->right->type;
-      } else if (node->right->type->kind == TYPE_KIND_DOUBLE || node->right->type->kind == TYPE_KIND_LDOUBLE) {
-        t = node->right->type;
-      }
-      assert(type_is_float(t));
-      emit_cast(parse, t, node->left->type);
-      emit_push_xmm(parse, 0);
-      emit_expression(parse, node->right);
-      emit_cast(parse, t, node->right->type);
-      emit_comp_float(parse, op, t->kind == TYPE_KIND_DOUBLE || t->kind == TYPE_KIND_LDOUBLE);
-    } else {
-      emit_push(parse, "rcx");
-      emit_push(parse, "rax");
-      emit_expression(parse, node->right);
-      emit_comp_int(parse, op, node->left->type->sign && node->right->type->sign);
-      emit_pop(parse, "rcx");
+    emit_arithmetic_bit(parse, op, tmp);
+    emit_release_left(parse, tmp);
+  } else if (is_scaled_constant(node)) {
+    // the scaled offset is known, so add it as an immediate
+    emit_expression(parse, node->left);
+    long offset = node->right->ival * node->left->type->parent->total_size;
+    if (offset != 0) {
+      emitf("%s $%ld, %%rax", op == '+' ? "add" : "sub", offset);
     }
   } else {
-    emit_push(parse, "rcx");
-    emit_push(parse, "rax");
+    int tmp = emit_left(parse, node->left, node->right);
     emit_expression(parse, node->right);
-    emit_arithmetic_int(parse, op, node->left);
-    emit_pop(parse, "rcx");
+    emit_arithmetic_int(parse, op, node->left, tmp);
+    emit_release_left(parse, tmp);
   }
 }
 
@@ -730,8 +1323,9 @@ static void emit_unary_op_expression(parse_t *parse, node_t *node) {
     if (node->type->kind == TYPE_KIND_PTR) {
       n = node->type->parent->bytes;
     }
+    int tmp = REG_NONE;
     if (node->op == OP_PINC || node->op == OP_PDEC) {
-      emit_push(parse, "rax");
+      tmp = emit_push_tmp(parse, node->operand, false);
     }
     if (node->op == OP_INC || node->op == OP_PINC) {
       emitf("add $%d, %%rax", n);
@@ -740,7 +1334,7 @@ static void emit_unary_op_expression(parse_t *parse, node_t *node) {
     }
     emit_store(parse, node->operand, node->operand->type);
     if (node->op == OP_PINC || node->op == OP_PDEC) {
-      emit_pop(parse, "rax");
+      emit_pop_tmp(parse, tmp, false);
     }
     break;
   case '+': case '-': case '~': case '!':
@@ -802,6 +1396,10 @@ static void emit_unary_op_expression(parse_t *parse, node_t *node) {
   case OP_CAST:
     emit_expression(parse, node->operand);
     emit_cast(parse, node->type, node->operand->type);
+    if (is_narrowing(node->type, node->operand->type)) {
+      // the value is used without being stored, so truncate it here
+      emit_cast_to_int(parse, node->type);
+    }
     break;
   }
 }
@@ -866,7 +1464,51 @@ static void emit_declaration_init(parse_t *parse, node_t *var, node_t *init) {
   }
 }
 
-static void emit_call(parse_t *parse, node_t *node) {
+// Whether evaluating an argument touches no register but %rax and %xmm0
+static bool is_simple_arg(node_t *node) {
+  if (node->next != NULL) {
+    return false;
+  }
+  switch (node->kind) {
+  case NODE_KIND_LITERAL:
+  case NODE_KIND_STRING_LITERAL:
+  case NODE_KIND_VARIABLE:
+    return true;
+  case NODE_KIND_UNARY_OP:
+    return node->op == '&' && node->operand->kind == NODE_KIND_VARIABLE;
+  }
+  return false;
+}
+
+static void emit_arg(parse_t *parse, node_t *node, type_t *type) {
+  emit_expression(parse, node);
+  emit_cast(parse, type, node->type);
+}
+
+static void emit_move_xmm(type_t *type, int n) {
+  if (type->kind == TYPE_KIND_DOUBLE || type->kind == TYPE_KIND_LDOUBLE) {
+    emitf("movsd %%xmm0, %%xmm%d", n);
+  } else {
+    emitf("movss %%xmm0, %%xmm%d", n);
+  }
+}
+
+/*
+ * Register arguments are loaded so that none of them is live while other
+ * code runs: every argument that may clobber registers (calls, divisions,
+ * shifts, block copies) is evaluated first and spilled, except the last
+ * one which goes straight to its register. The spills are then popped and
+ * the simple arguments, which only touch %rax and %xmm0, are loaded last,
+ * with the first float argument after everything else. Nothing has to be
+ * saved around the call, and since the only bytes left on the stack at
+ * the call are the memory arguments the alignment padding is known
+ * statically.
+ *
+ * A tail call without memory arguments leaves the frame and jumps to the
+ * callee, or back to the top of the body when the function calls itself.
+ * Returns whether the call was emitted as a tail call.
+ */
+static bool emit_call(parse_t *parse, node_t *node, bool tail) {
   int i;
   vector_t *iargs = vector_new(), *iargtypes = vector_new();
   vector_t *xargs = vector_new(), *xargtypes = vector_new();
@@ -889,22 +1531,26 @@ static void emit_call(parse_t *parse, node_t *node) {
     }
   }
   int old_stackpos = parse->stackpos;
-  // store registers
-  for (i = 0; i < iargs->size; i++) {
-    emit_push(parse, REGS[i]);
-  }
-  for (i = 1; i < xargs->size; i++) {
-    emit_push_xmm(parse, i);
+  int rsize = 0;
+  for (i = 0; i < rargtypes->size; i++) {
+    type_t *t = (type_t *)rargtypes->data[i];
+    if (type_is_struct(t)) {
+      int size = t->total_size;
+      align(&size, 8);
+      rsize += size;
+    } else {
+      rsize += 8;
+    }
   }
+  tail = tail && rargs->size == 0;
   // fix sp
-  int padding = parse->stackpos % 16;
+  int padding = tail ? 0 : (parse->stackpos + rsize) % 16;
   emit_add_rsp(parse, -padding);
   // build arguments
   for (i = rargs->size - 1; i >= 0; i--) {
     node_t *n = (node_t *)rargs->data[i];
     type_t *t = (type_t *)rargtypes->data[i];
-    emit_expression(parse, n);
-    emit_cast(parse, t, n->type);
+    emit_arg(parse, n, t);
     if (type_is_struct(t)) {
       int size = t->total_size;
       align(&size, 8);
@@ -919,70 +1565,157 @@ static void emit_call(parse_t *parse, node_t *node) {
       emit_push(parse, "rax");
     }
   }
-  for (i = xargs->size - 1; i >= 0 ; i--) {
-    node_t *n = (node_t *)xargs->data[i];
-    type_t *t = (type_t *)xargtypes->data[i];
-    emit_expression(parse, n);
-    emit_cast(parse, t, n->type);
-    if (i != 0) {
-      if (t->kind == TYPE_KIND_DOUBLE || t->kind == TYPE_KIND_LDOUBLE) {
-        emitf("movsd %%xmm0, %%xmm%d", i);
+  bool indirect = node->func->kind == NODE_KIND_UNARY_OP;
+  if (indirect) {
+    assert(node->func->op == '*');
+    emit_expression(parse, node->func->operand);
+    emit_push(parse, "rax");
+  }
+  // complex register arguments, the first float one at the bottom
+  vector_t *spills = vector_new();
+  for (i = 0; i < xargs->size + iargs->size; i++) {
+    node_t *n = i < xargs->size ? xargs->data[i] : iargs->data[i - xargs->size];
+    if (!is_simple_arg(n)) {
+      vector_push(spills, (void *)(intptr_t)i);
+    }
+  }
+  int nsimple = xargs->size + iargs->size - spills->size;
+  for (int j = 0; j < spills->size; j++) {
+    i = (int)(intptr_t)spills->data[j];
+    bool last = j == spills->size - 1 && (i > 0 || xargs->size == 0 || nsimple == 0);
+    if (i < xargs->size) {
+      type_t *t = (type_t *)xargtypes->data[i];
+      emit_arg(parse, (node_t *)xargs->data[i], t);
+      if (!last) {
+        emit_push_xmm(parse, 0);
+      } else if (i > 0) {
+        emit_move_xmm(t, i);
+      }
+    } else {
+      int k = i - xargs->size;
+      emit_arg(parse, (node_t *)iargs->data[k], (type_t *)iargtypes->data[k]);
+      if (!last) {
+        emit_push(parse, "rax");
       } else {
-        emitf("movss %%xmm0, %%xmm%d", i);
+        emitf("mov %%rax, %%%s", REGS[k]);
       }
     }
   }
+  bool first_spilled = false;
+  for (int j = spills->size - 2; j >= 0; j--) {
+    i = (int)(intptr_t)spills->data[j];
+    if (i == 0 && xargs->size > 0) {
+      first_spilled = true;
+    } else if (i < xargs->size) {
+      emit_pop_xmm(parse, i);
+    } else {
+      emit_pop(parse, REGS[i - xargs->size]);
+    }
+  }
+  if (spills->size == 1 && (intptr_t)spills->data[0] == 0 && xargs->size > 0 && nsimple > 0) {
+    first_spilled = true;
+  }
+  // simple register arguments
   for (i = 0; i < iargs->size; i++) {
     node_t *n = (node_t *)iargs->data[i];
-    type_t *t = (type_t *)iargtypes->data[i];
-    emit_expression(parse, n);
-    emit_cast(parse, t, n->type);
-    emitf("mov %%rax, %%%s", REGS[i]);
+    if (is_simple_arg(n)) {
+      emit_arg(parse, n, (type_t *)iargtypes->data[i]);
+      emitf("mov %%rax, %%%s", REGS[i]);
+    }
+  }
+  for (i = xargs->size - 1; i >= 0 ; i--) {
+    node_t *n = (node_t *)xargs->data[i];
+    if (is_simple_arg(n)) {
+      type_t *t = (type_t *)xargtypes->data[i];
+      emit_arg(parse, n, t);
+      if (i != 0) {
+        emit_move_xmm(t, i);
+      }
+    }
+  }
+  if (first_spilled) {
+    emit_pop_xmm(parse, 0);
+  }
+  if (indirect) {
+    emit_pop(parse, "r11");
   }
   // call function
-  emitf("mov $%d, %%eax", xargs->size);
-  if (node->func->kind == NODE_KIND_IDENTIFIER) {
-    emitf("call %s", node->func->identifier);
-  } else if (node->func->kind == NODE_KIND_VARIABLE) {
-    emitf("call %s", node->func->vname);
+  node_t *func = parse->current_function;
+  if (tail && node->func->kind == NODE_KIND_VARIABLE && strcmp(node->func->vname, func->fvar->vname) == 0) {
+    emitf("jmp .L%p", func);
   } else {
-    assert(node->func->kind == NODE_KIND_UNARY_OP && node->func->op == '*');
-    emit_expression(parse, node->func->operand);
-    emitf("call *%%rax");
-  }
-  // restore registers
-  int rsize = padding;
-  for (int i = 0; i < rargtypes->size; i++) {
-    type_t *t = (type_t *)rargtypes->data[i];
-    if (type_is_struct(t)) {
-      int size = t->total_size;
-      align(&size, 8);
-      rsize += size;
+    char *insn = tail ? "jmp" : "call";
+    emitf("mov $%d, %%eax", xargs->size);
+    if (tail) {
+      emit_leave(parse);
+    }
+    if (node->func->kind == NODE_KIND_IDENTIFIER) {
+      emitf("%s %s", insn, node->func->identifier);
+    } else if (node->func->kind == NODE_KIND_VARIABLE) {
+      emitf("%s %s", insn, node->func->vname);
     } else {
-      rsize += 8;
+      emitf("%s *%%r11", insn);
     }
   }
-  emit_add_rsp(parse, rsize);
-  for (i = xargs->size - 1; i > 0; i--) {
-    emit_pop_xmm(parse, i);
-  }
-  for (i = iargs->size - 1; i >= 0; i--) {
-    emit_pop(parse, REGS[i]);
-  }
+  emit_add_rsp(parse, padding + rsize);
   assert(old_stackpos == parse->stackpos);
 
+  vector_free(spills);
   vector_free(iargs);
   vector_free(iargtypes);
   vector_free(xargs);
   vector_free(xargtypes);
   vector_free(rargs);
   vector_free(rargtypes);
+  return tail;
 }
 
-static void emit_if(parse_t *parse, node_t *node) {
-  emit_expression(parse, node->cond);
+/*
+ * Conditions that only decide a jump are compiled to the jump itself at
+ * -O1: a comparison becomes cmp/ucomis followed by the matching jcc, !
+ * swaps the sense of the branch, and && and || become chains of jumps
+ * that skip the right operand, so no 0/1 is ever materialized in %rax.
+ */
+// Jumps to label if node is nonzero (zero when !when), falling through otherwise
+static void emit_branch(parse_t *parse, node_t *node, bool when, char *label) {
+  if (parse->option->optimize >= 1 && node->next == NULL) {
+    if (is_int_constant(node)) {
+      if ((node->ival != 0) == when) {
+        emitf("jmp %s", label);
+      }
+      return;
+    }
+    if (node->kind == NODE_KIND_UNARY_OP && node->op == '!' && !type_is_float(node->operand->type)) {
+      emit_branch(parse, node->operand, !when, label);
+      return;
+    }
+    if (node->kind == NODE_KIND_BINARY_OP && (node->op == OP_ANDAND || node->op == OP_OROR)) {
+      // the left operand alone decides the jump when it is false for && and true for ||
+      bool decides = node->op == OP_OROR;
+      if (when == decides) {
+        emit_branch(parse, node->left, when, label);
+      } else {
+        emit_branch(parse, node->left, decides, emit_format(".L%p_skip", node));
+      }
+      emit_branch(parse, node->right, when, label);
+      if (when != decides) {
+        emitf(".L%p_skip:", node);
+      }
+      return;
+    }
+    if (node->kind == NODE_KIND_BINARY_OP && is_comp(node->op)) {
+      int op = when ? node->op : negate_comp(node->op);
+      emitf("j%s %s", cond_code(op, emit_compare(parse, node)), label);
+      return;
+    }
+  }
+  emit_expression(parse, node);
   emitf("test %%rax, %%rax");
-  emitf("je .L%p", node->then_body);
+  emitf("%s %s", when ? "jne" : "je", label);
+}
+
+static void emit_if(parse_t *parse, node_t *node) {
+  emit_branch(parse, node->cond, false, emit_format(".L%p", node->then_body));
   emit_expression(parse, node->then_body);
   if (node->else_body) {
     emitf("jmp .L%p", node->else_body);
@@ -994,60 +1727,387 @@ static void emit_if(parse_t *parse, node_t *node) {
   }
 }
 
+/*
+ * Loops are rotated so that each iteration runs a single conditional
+ * branch at the bottom. Entry jumps down to the test, or at -O1 a copy of
+ * a condition that defines no labels guards the loop instead, giving a
+ * guarded do-while. The loop header is aligned at -O1, and continue jumps
+ * to .L<loop>_next, in front of the step and test.
+ */
+// Whether node can be emitted twice: no calls and no labels, except those of a top-level && or ||
+static bool is_duplicable(node_t *node, bool logical) {
+  if (node->next != NULL) {
+    return false;
+  }
+  switch (node->kind) {
+  case NODE_KIND_LITERAL:
+  case NODE_KIND_VARIABLE:
+    return true;
+  case NODE_KIND_UNARY_OP:
+    return is_duplicable(node->operand, logical && node->op == '!');
+  case NODE_KIND_BINARY_OP:
+    if (node->op == OP_ANDAND || node->op == OP_OROR) {
+      return logical && is_duplicable(node->left, false) && is_duplicable(node->right, false);
+    }
+    return is_duplicable(node->left, false) && (node->op == '.' || is_duplicable(node->right, false));
+  }
+  return false;
+}
+
+// Enters the loop node, whose condition cond is tested at label test
+static void emit_loop_entry(parse_t *parse, node_t *node, node_t *cond, char *test) {
+  if (parse->option->optimize >= 1 && is_duplicable(cond, true)) {
+    emit_branch(parse, cond, false, emit_format(".L%p", node->lbody));
+  } else {
+    emitf("jmp %s", test);
+  }
+  if (parse->option->optimize >= 1) {
+    emitf(".p2align 4");
+  }
+}
+
 static void emit_while(parse_t *parse, node_t *node) {
+  emit_loop_entry(parse, node, node->lcond, emit_format(".L%p_next", node));
   emitf(".L%p:", node);
-  emit_expression(parse, node->lcond);
-  emitf("test %%rax, %%rax");
-  emitf("je .L%p", node->lbody);
   emit_expression(parse, node->lbody);
-  emitf("jmp .L%p", node);
+  emitf(".L%p_next:", node);
+  emit_branch(parse, node->lcond, true, emit_format(".L%p", node));
   emitf(".L%p:", node->lbody);
 }
 
 static void emit_do(parse_t *parse, node_t *node) {
+  if (parse->option->optimize >= 1) {
+    emitf(".p2align 4");
+  }
   emitf(".L%p:", node);
   emit_expression(parse, node->lbody);
-  emit_expression(parse, node->lcond);
-  emitf("test %%rax, %%rax");
-  emitf("je .L%p", node->lbody);
-  emitf("jmp .L%p", node);
+  emitf(".L%p_next:", node);
+  emit_branch(parse, node->lcond, true, emit_format(".L%p", node));
   emitf(".L%p:", node->lbody);
 }
 
+static char *vfixed_reg(int fixed) {
+  return emit_format("xmm%d", 2 + fixed);
+}
+
+// base[iv + offset] of the vector iteration at %rcx
+static char *vloop_element(vloop_t *vl, int base, int offset) {
+  int size = vl->elem->bytes;
+  return emit_format("%d(%%%s,%%rcx,%d)", offset * size, VBASE_REGS[base], size);
+}
+
+static const char *vloop_move(vloop_t *vl) {
+  switch (vl->elem->kind) {
+  case TYPE_KIND_FLOAT:
+    return "movups";
+  case TYPE_KIND_DOUBLE:
+    return "movupd";
+  }
+  return "movdqu";
+}
+
+static const char *vloop_op(vloop_t *vl, int op) {
+  bool isdouble = vl->elem->kind == TYPE_KIND_DOUBLE;
+  switch (op) {
+  case '+':
+    return type_is_int(vl->elem) ? "paddd" : isdouble ? "addpd" : "addps";
+  case '-':
+    return type_is_int(vl->elem) ? "psubd" : isdouble ? "subpd" : "subps";
+  case '*':
+    return isdouble ? "mulpd" : "mulps";
+  case '/':
+    return isdouble ? "divpd" : "divps";
+  case '&':
+    return "pand";
+  case '|':
+    return "por";
+  case '^':
+    return "pxor";
+  }
+  errorf("internal error: invalid vector operator %d", op);
+  return NULL;
+}
+
+// Multiplies the 32-bit lanes of a by b; t is clobbered, as is b
+static void emit_vloop_mul(const char *a, const char *b, const char *t) {
+  emitf("pshufd $0xf5, %%%s, %%%s", a, t);
+  emitf("pmuludq %%%s, %%%s", b, a);
+  emitf("pshufd $0xf5, %%%s, %%%s", b, b);
+  emitf("pmuludq %%%s, %%%s", b, t);
+  emitf("pshufd $0x08, %%%s, %%%s", a, a);
+  emitf("pshufd $0x08, %%%s, %%%s", t, t);
+  emitf("punpckldq %%%s, %%%s", t, a);
+}
+
+// acc = x < acc ? x : acc for op '<', or x > acc ? x : acc for '>'; x and t are clobbered
+static void emit_vloop_select(int op, const char *acc, const char *x, const char *t) {
+  if (op == '<') {
+    emitf("movaps %%%s, %%%s", acc, t);
+    emitf("pcmpgtd %%%s, %%%s", x, t);
+  } else {
+    emitf("movaps %%%s, %%%s", x, t);
+    emitf("pcmpgtd %%%s, %%%s", acc, t);
+  }
+  emitf("pand %%%s, %%%s", t, x);
+  emitf("pandn %%%s, %%%s", acc, t);
+  emitf("por %%%s, %%%s", x, t);
+  emitf("movaps %%%s, %%%s", t, acc);
+}
+
+// Evaluates e into VEXPR_REGS[depth]
+static void emit_vexpr(vloop_t *vl, vexpr_t *e, int depth) {
+  const char *dst = VEXPR_REGS[depth];
+  switch (e->kind) {
+  case VEXPR_LOAD:
+    emitf("%s %s, %%%s", vloop_move(vl), vloop_element(vl, e->base, e->offset), dst);
+    return;
+  case VEXPR_BROADCAST:
+    emitf("movaps %%%s, %%%s", vfixed_reg(e->fixed), dst);
+    return;
+  }
+  emit_vexpr(vl, e->left, depth);
+  bool imul = e->op == '*' && type_is_int(vl->elem);
+  const char *src;
+  if (e->right->kind == VEXPR_BROADCAST && !imul) {
+    src = vfixed_reg(e->right->fixed);
+  } else {
+    emit_vexpr(vl, e->right, depth + 1);
+    src = VEXPR_REGS[depth + 1];
+  }
+  if (imul) {
+    emit_vloop_mul(dst, src, VEXPR_REGS[depth + 2]);
+  } else {
+    emitf("%s %%%s, %%%s", vloop_op(vl, e->op), src, dst);
+  }
+}
+
+// Fills every lane of fixed register i with the value of expr
+static void emit_vloop_broadcast(parse_t *parse, vloop_t *vl, node_t *expr, int fixed) {
+  char *reg = vfixed_reg(fixed);
+  emit_expression(parse, expr);
+  switch (vl->elem->kind) {
+  case TYPE_KIND_FLOAT:
+    emitf("pshufd $0, %%xmm0, %%%s", reg);
+    break;
+  case TYPE_KIND_DOUBLE:
+    emitf("pshufd $0x44, %%xmm0, %%%s", reg);
+    break;
+  default:
+    emitf("movd %%eax, %%%s", reg);
+    emitf("pshufd $0, %%%s, %%%s", reg, reg);
+  }
+}
+
+// Fails over to the scalar loop when the ranges of bases a and b accessed from %rcx to %rdx overlap
+static void emit_vloop_check(vloop_t *vl, node_t *node, int a, int b) {
+  vbase_t *x = (vbase_t *)vl->bases->data[a], *y = (vbase_t *)vl->bases->data[b];
+  int size = vl->elem->bytes;
+  emitf("lea %d(%%%s,%%rcx,%d), %%rax", x->lo * size, VBASE_REGS[a], size);
+  emitf("lea %d(%%%s,%%rdx,%d), %%r10", y->hi * size, VBASE_REGS[b], size);
+  emitf("cmp %%r10, %%rax");
+  emitf("jae .L%p_disjoint_%d_%d", node, a, b);
+  emitf("lea %d(%%%s,%%rcx,%d), %%rax", y->lo * size, VBASE_REGS[b], size);
+  emitf("lea %d(%%%s,%%rdx,%d), %%r10", x->hi * size, VBASE_REGS[a], size);
+  emitf("cmp %%r10, %%rax");
+  emitf("jb .L%p_scalar", node);
+  emitf(".L%p_disjoint_%d_%d:", node, a, b);
+}
+
+/*
+ * Runs the iterations of a vectorized for loop that fill whole vectors.
+ * Invariants and accumulators live in %xmm2-%xmm7, array bases in %rsi,
+ * %rdi, %r8 and %r9, the induction variable in %rcx and the end of the
+ * vector iterations in %rdx; none of them is touched by the expressions
+ * evaluated here, which make no calls. The scalar loop that follows runs
+ * the remaining iterations, or all of them when the arrays overlap.
+ */
+static void emit_vector_loop(parse_t *parse, node_t *node) {
+  vloop_t *vl = node->vloop;
+  for (int i = 0; i < vl->fixed->size; i++) {
+    if (vl->fixed->data[i] != NULL) {
+      emit_vloop_broadcast(parse, vl, (node_t *)vl->fixed->data[i], i);
+    }
+  }
+  for (int i = 0; i < vl->bases->size; i++) {
+    emit_expression(parse, ((vbase_t *)vl->bases->data[i])->var);
+    emitf("mov %%rax, %%%s", VBASE_REGS[i]);
+  }
+  emit_expression(parse, vl->bound);
+  if (vl->bound->type->bytes == 4) {
+    emitf("movslq %%eax, %%rax");
+  }
+  emitf("mov %%rax, %%rdx");
+  emit_expression(parse, vl->iv);
+  emitf("mov %%rax, %%rcx");
+  emitf("sub %%rcx, %%rdx");
+  emitf("cmp $%d, %%rdx", vl->lanes);
+  emitf("jl .L%p_scalar", node);
+  emitf("and $%d, %%rdx", -vl->lanes);
+  emitf("add %%rcx, %%rdx");
+
+  for (int i = 0; i < vl->bases->size; i++) {
+    for (int j = i + 1; j < vl->bases->size; j++) {
+      vbase_t *a = (vbase_t *)vl->bases->data[i], *b = (vbase_t *)vl->bases->data[j];
+      if ((a->stored || b->stored) &&
+          (a->var->type->kind != TYPE_KIND_ARRAY || b->var->type->kind != TYPE_KIND_ARRAY)) {
+        emit_vloop_check(vl, node, i, j);
+      }
+    }
+  }
+  for (int i = 0; i < vl->stmts->size; i++) {
+    vstmt_t *s = (vstmt_t *)vl->stmts->data[i];
+    if (s->op == '+' || s->op == '-') {
+      emitf("pxor %%%s, %%%s", vfixed_reg(s->fixed), vfixed_reg(s->fixed));
+    } else if (s->op != '=') {
+      emit_vloop_broadcast(parse, vl, s->var, s->fixed);
+    }
+  }
+
+  emitf(".p2align 4");
+  emitf(".L%p_vector:", node);
+  for (int i = 0; i < vl->stmts->size; i++) {
+    vstmt_t *s = (vstmt_t *)vl->stmts->data[i];
+    emit_vexpr(vl, s->value, 0);
+    switch (s->op) {
+    case '=':
+      emitf("%s %%xmm0, %s", vloop_move(vl), vloop_element(vl, s->base, 0));
+      break;
+    case '+':
+    case '-':
+      emitf("%s %%xmm0, %%%s", vloop_op(vl, s->op), vfixed_reg(s->fixed));
+      break;
+    default:
+      emit_vloop_select(s->op, vfixed_reg(s->fixed), "xmm0", "xmm1");
+    }
+  }
+  emitf("add $%d, %%rcx", vl->lanes);
+  emitf("cmp %%rdx, %%rcx");
+  emitf("jl .L%p_vector", node);
+
+  emitf("mov %%rcx, %%rax");
+  emit_save(parse, vl->iv, vl->iv->type, 0, 0);
+  for (int i = 0; i < vl->stmts->size; i++) {
+    vstmt_t *s = (vstmt_t *)vl->stmts->data[i];
+    if (s->op == '=') {
+      continue;
+    }
+    // fold the four lanes into the first
+    char *acc = vfixed_reg(s->fixed);
+    static const char *shuffles[] = {"0x4e", "0xb1"};
+    for (int j = 0; j < 2; j++) {
+      emitf("pshufd $%s, %%%s, %%xmm0", shuffles[j], acc);
+      if (s->op == '<' || s->op == '>') {
+        emit_vloop_select(s->op, acc, "xmm0", "xmm1");
+      } else {
+        emitf("paddd %%xmm0, %%%s", acc);
+      }
+    }
+    if (s->op == '<' || s->op == '>') {
+      emitf("movd %%%s, %%eax", acc);
+    } else {
+      emit_expression(parse, s->var);
+      emitf("movd %%%s, %%ecx", acc);
+      emitf("add %%ecx, %%eax");
+    }
+    emit_save(parse, s->var, s->var->type, 0, 0);
+  }
+  emitf(".L%p_scalar:", node);
+}
+
 static void emit_for(parse_t *parse, node_t *node) {
   if (node->linit) {
     emit_expression(parse, node->linit);
   }
+  if (node->vloop != NULL) {
+    emit_vector_loop(parse, node);
+  }
   if (node->lcond) {
-    emitf("jmp .L%p", node->lcond);
+    emit_loop_entry(parse, node, node->lcond, emit_format(".L%p_test", node));
+  } else if (parse->option->optimize >= 1) {
+    emitf(".p2align 4");
   }
   emitf(".L%p:", node);
   emit_expression(parse, node->lbody);
+  emitf(".L%p_next:", node);
   if (node->lstep) {
-    emitf(".L%p:", node->lstep);
     emit_expression(parse, node->lstep);
   }
   if (node->lcond) {
-    emitf(".L%p:", node->lcond);
-    emit_expression(parse, node->lcond);
-    emitf("test %%rax, %%rax");
-    emitf("jne .L%p", node);
+    emitf(".L%p_test:", node);
+    emit_branch(parse, node->lcond, true, emit_format(".L%p", node));
+  } else {
+    emitf("jmp .L%p", node);
   }
   emitf(".L%p:", node->lbody);
 }
 
+static int comp_case(const void *a, const void *b) {
+  long x = (*(node_t **)a)->cval->ival, y = (*(node_t **)b)->cval->ival;
+  return x < y ? -1 : x > y;
+}
+
+static void emit_switch_chain(node_t **cases, int n, node_t *dflt) {
+  for (int i = 0; i < n; i++) {
+    emitf("cmp $%ld, %%rax", cases[i]->cval->ival);
+    emitf("je .L%p", cases[i]);
+  }
+  emitf("jmp .L%p", dflt);
+}
+
+static void emit_switch_tree(node_t *node, node_t **cases, int lo, int hi, node_t *dflt) {
+  if (hi - lo <= SWITCH_CHAIN_MAX) {
+    emit_switch_chain(cases + lo, hi - lo, dflt);
+    return;
+  }
+  int mid = (lo + hi) / 2;
+  emitf("cmp $%ld, %%rax", cases[mid]->cval->ival);
+  emitf("je .L%p", cases[mid]);
+  emitf("jg .L%p_%d", node, mid);
+  emit_switch_tree(node, cases, lo, mid, dflt);
+  emitf(".L%p_%d:", node, mid);
+  emit_switch_tree(node, cases, mid + 1, hi, dflt);
+}
+
+static void emit_switch_table(node_t *node, node_t **cases, int n, node_t *dflt) {
+  long min = cases[0]->cval->ival, max = cases[n - 1]->cval->ival;
+  if (min != 0) {
+    emitf("sub $%ld, %%rax", min);
+  }
+  emitf("cmp $%ld, %%rax", max - min);
+  emitf("ja .L%p", dflt);
+  emitf("lea .L%p_table(%%rip), %%rcx", node);
+  emitf("jmp *(%%rcx,%%rax,8)");
+  emitf(".section .rodata");
+  emitf(".align 8");
+  emitf(".L%p_table:", node);
+  for (long v = min, i = 0; v <= max; v++) {
+    while (i < n && cases[i]->cval->ival < v) {
+      i++;
+    }
+    emitf(".quad .L%p", i < n && cases[i]->cval->ival == v ? cases[i] : dflt);
+  }
+  emitf(".text");
+}
+
 static void emit_switch(parse_t *parse, node_t *node) {
   emit_expression(parse, node->sexpr);
-  for (int i = 0; i < node->cases->size; i++) {
-    node_t *n = (node_t *)node->cases->data[i];
-    emitf("cmp $%ld, %%rax", n->cval->ival);
-    emitf("je .L%p", n);
-  }
-  if (node->default_case != NULL) {
-    emitf("jmp .L%p", node->default_case);
+  node_t *dflt = node->default_case != NULL ? node->default_case : node->sbody;
+  int n = node->cases->size;
+  node_t **cases = (node_t **)malloc(sizeof (node_t *) * max(n, 1));
+  memcpy(cases, node->cases->data, sizeof (node_t *) * n);
+  qsort(cases, n, sizeof (node_t *), comp_case);
+
+  // case values are compared as sign extended 32-bit immediates, so
+  // ordering based strategies are only used when all of them fit
+  long min = n > 0 ? cases[0]->cval->ival : 0, max = n > 0 ? cases[n - 1]->cval->ival : 0;
+  if (n <= SWITCH_CHAIN_MAX || min < INT32_MIN || max > INT32_MAX) {
+    emit_switch_chain(cases, n, dflt);
+  } else if (max - min < SWITCH_TABLE_MAX_SIZE && max - min < (long)n * SWITCH_TABLE_DENSITY) {
+    emit_switch_table(node, cases, n, dflt);
   } else {
-    emitf("jmp .L%p", node->sbody);
+    emit_switch_tree(node, cases, 0, n, dflt);
   }
+  free(cases);
   emit_expression(parse, node->sbody);
   emitf(".L%p:", node->sbody);
 }
@@ -1059,12 +2119,7 @@ static void emit_case(parse_t *parse, node_t *node) {
 
 static void emit_continue(parse_t *parse, node_t *node) {
   assert(node->cscope->parent_node != NULL);
-  node_t *loop_node = node->cscope->parent_node;
-  if (loop_node->kind == NODE_KIND_FOR && loop_node->lstep != NULL) {
-    emitf("jmp .L%p", loop_node->lstep);
-  } else {
-    emitf("jmp .L%p", loop_node);
-  }
+  emitf("jmp .L%p_next", node->cscope->parent_node);
 }
 
 static void emit_break(parse_t *parse, node_t *node) {
@@ -1077,10 +2132,30 @@ static void emit_break(parse_t *parse, node_t *node) {
 }
 
 static void emit_return(parse_t *parse, node_t *node) {
-  if (node->retval) {
-    emit_expression(parse, node->retval);
+  node_t *val = node->retval;
+  if (val != NULL && val->kind == NODE_KIND_CALL && val->next == NULL && parse->tail_calls &&
+      !type_is_struct(val->type) && emit_call(parse, val, true)) {
+    return;
+  }
+  if (val) {
+    emit_expression(parse, val);
+  }
+  emit_epilogue(parse);
+}
+
+static void emit_leave(parse_t *parse) {
+  int offset = parse->saved_offset;
+  for (int reg = 0; reg < REG_NUM; reg++) {
+    if (parse->saved_regs & (1 << reg)) {
+      offset += 8;
+      emitf("mov %d(%%rbp), %%%s", -offset, reg_name(reg, 8));
+    }
   }
   emitf("leave");
+}
+
+static void emit_epilogue(parse_t *parse) {
+  emit_leave(parse);
   emitf("ret");
 }
 
@@ -1097,6 +2172,7 @@ static void emit_expression(parse_t *parse, node_t *node) {
       break;
     case NODE_KIND_LITERAL:
       switch (node->type->kind) {
+      case TYPE_KIND_BOOL:
       case TYPE_KIND_CHAR:
       case TYPE_KIND_SHORT:
       case TYPE_KIND_INT:
@@ -1131,7 +2207,7 @@ static void emit_expression(parse_t *parse, node_t *node) {
           break;
         }
       }
-      emit_call(parse, node);
+      emit_call(parse, node, false);
       break;
     case NODE_KIND_BLOCK:
       for (int i = 0; i < node->statements->size; i++) {
@@ -1171,22 +2247,73 @@ static void emit_expression(parse_t *parse, node_t *node) {
   }
 }
 
-static int placement_variables(node_t *node, int offset) {
-  for (map_entry_t *e = node->vars->top; e != NULL; e = e->next) {
-    node_t *n = (node_t *)e->val;
-    if (n->kind != NODE_KIND_VARIABLE || n->voffset != 0) {
-      continue;
+// Moves integer argument i (-1 once it was parked in %rax) into reg, in the form emit_save_reg() leaves it
+static void emit_move_arg(parse_t *parse, type_t *type, int i, int reg) {
+  const char *name = reg_name(reg, 8);
+  if (i < 0) {
+    emit_save_reg(parse, type, reg);
+    return;
+  }
+  switch (type->bytes) {
+  case 1:
+    emitf("movsbq %%%s, %%%s", BREGS[i], name);
+    break;
+  case 2:
+    emitf("movswq %%%s, %%%s", WREGS[i], name);
+    break;
+  case 4:
+    emitf("movslq %%%s, %%%s", MREGS[i], name);
+    break;
+  case 8:
+    if (strcmp(REGS[i], name) != 0) {
+      emitf("mov %%%s, %%%s", REGS[i], name);
     }
-    offset += n->type->total_size;
-    align(&offset, n->type->align);
-    n->voffset = offset;
+    break;
+  default:
+    errorf("invalid variable type");
   }
-  int max_offset = offset;
-  for (int i = 0; i < node->child_blocks->size; i++) {
-    node_t *b = (node_t *)node->child_blocks->data[i];
-    max_offset = max(max_offset, placement_variables(b, offset));
+}
+
+// Moves the allocated integer parameters out of the argument registers, which may be allocated themselves
+static void emit_move_args(parse_t *parse, vector_t *iregs) {
+  int src[6];
+  node_t *dst[6];
+  int n = 0;
+  for (int i = 0; i < iregs->size; i++) {
+    node_t *p = (node_t *)iregs->data[i];
+    if (p->vreg != REG_NONE) {
+      src[n] = i;
+      dst[n++] = p;
+    }
+  }
+  while (n > 0) {
+    // a move whose target no other pending move still reads
+    int k;
+    for (k = 0; k < n; k++) {
+      const char *name = reg_name(dst[k]->vreg, 8);
+      int j;
+      for (j = 0; j < n; j++) {
+        if (j != k && src[j] >= 0 && strcmp(REGS[src[j]], name) == 0) {
+          break;
+        }
+      }
+      if (j == n) {
+        break;
+      }
+    }
+    if (k == n) {
+      // only cycles are left; break one by parking its source in %rax
+      for (k = 0; src[k] < 0; k++) {
+      }
+      emitf("mov %%%s, %%rax", REGS[src[k]]);
+      src[k] = -1;
+      continue;
+    }
+    emit_move_arg(parse, dst[k]->type, src[k], dst[k]->vreg);
+    n--;
+    src[k] = src[n];
+    dst[k] = dst[n];
   }
-  return max_offset;
 }
 
 static void emit_function(parse_t *parse, node_t *node) {
@@ -1194,12 +2321,19 @@ static void emit_function(parse_t *parse, node_t *node) {
   parse->current_function = node;
 
   parse->stackpos = 8;
+  parse->tmpdepth = 0;
+  parse->xtmpdepth = 0;
+  parse->saved_regs = regalloc(parse, node);
   emitf(".text");
   node_t *var = node->fvar;
   if (var->sclass != STORAGE_CLASS_STATIC) {
     emitf_noindent(".global %s", var->vname);
   }
   emitf_noindent("%s:", var->vname);
+  frame_t *frame = (frame_t *)malloc(sizeof (frame_t));
+  frame->name = var->vname;
+  frame->begin = emit_insts()->size;
+  vector_push(parse->frames, frame);
   emit_push(parse, "rbp");
   emitf("mov %%rsp, %%rbp");
 
@@ -1219,46 +2353,91 @@ static void emit_function(parse_t *parse, node_t *node) {
     }
   }
 
-  if (var->type->is_vaargs) {
-    emit_add_rsp(parse, -(8 * 6 + 16 * 8));
-  } else {
-    emit_add_rsp(parse, -(8 * iregs->size + 16 * xregs->size));
-  }
-
-  // fix xregs positions
+  // fix register fargs positions; va_start needs them next to its register save area, otherwise
+  // frame_layout() places them like any other local
+  int xsave[8], isave[6];
   if (var->type->is_vaargs) {
     for (int i = 8 - 1; i >= xregs->size; i--) {
       offset += 16;
-      emitf("movsd %%xmm%d, %d(%%rbp)", i, -offset);
+      xsave[i] = offset;
+    }
+    for (int i = xregs->size - 1; i >= 0; i--) {
+      node_t *n = (node_t *)xregs->data[i];
+      // the register save area of va_start keeps xmm registers 16 bytes apart
+      offset += 16;
+      n->voffset = offset;
+    }
+    for (int i = 6 - 1; i >= iregs->size; i--) {
+      offset += 8;
+      isave[i] = offset;
+    }
+    for (int i = iregs->size - 1; i >= 0 ; i--) {
+      node_t *n = (node_t *)iregs->data[i];
+      offset += 8;
+      n->voffset = offset;
     }
   }
-  for (int i = xregs->size - 1; i >= 0; i--) {
-    node_t *n = (node_t *)xregs->data[i];
-    offset += 16;
-    n->voffset = offset;
-  }
-  for (int i = 0; i < xregs->size; i++) {
-    node_t *n = (node_t *)xregs->data[i];
-    if (n->type->kind == TYPE_KIND_FLOAT) {
-      emitf("movss %%xmm%d, %d(%%rbp)", i, -n->voffset);
+  // fix stack fargs positions
+  int spoffset = 16;
+  for (int i = 0; i < stack->size; i++) {
+    node_t *n = (node_t *)stack->data[i];
+    if (type_is_float(n->type)) {
+      n->voffset = -spoffset;
+      spoffset += 8;
+    } else if (type_is_struct(n->type)) {
+      int size = n->type->total_size;
+      align(&size, 8);
+      n->voffset = -spoffset;
+      spoffset += size;
     } else {
-      emitf("movsd %%xmm%d, %d(%%rbp)", i, -n->voffset);
+      n->voffset = -spoffset;
+      spoffset += 8;
+    }
+  }
+
+  offset = frame_layout(parse, node, offset);
+  align(&offset, 8);
+  // callee-saved registers used by register allocated variables
+  parse->saved_offset = offset;
+  for (int reg = 0; reg < REG_NUM; reg++) {
+    if (parse->saved_regs & (1 << reg)) {
+      offset += 8;
     }
   }
-  // fix iregs positions
+
+  emit_add_rsp(parse, -offset);
+  frame->body = emit_insts()->size;
+  frame->size = offset;
   if (var->type->is_vaargs) {
+    for (int i = 8 - 1; i >= xregs->size; i--) {
+      emitf("movsd %%xmm%d, %d(%%rbp)", i, -xsave[i]);
+    }
     for (int i = 6 - 1; i >= iregs->size; i--) {
-      offset += 8;
-      emitf("movq %%%s, %d(%%rbp)", REGS[i], -offset);
+      emitf("movq %%%s, %d(%%rbp)", REGS[i], -isave[i]);
     }
   }
-  for (int i = iregs->size - 1; i >= 0 ; i--) {
-    node_t *n = (node_t *)iregs->data[i];
-    offset += 8;
-    n->voffset = offset;
+  for (int reg = 0, save = parse->saved_offset; reg < REG_NUM; reg++) {
+    if (parse->saved_regs & (1 << reg)) {
+      save += 8;
+      emitf("mov %%%s, %d(%%rbp)", reg_name(reg, 8), -save);
+    }
+  }
+  // self tail calls jump here with the new arguments in registers
+  emitf(".L%p:", node);
+  for (int i = 0; i < xregs->size; i++) {
+    node_t *n = (node_t *)xregs->data[i];
+    const char *mov = n->type->kind == TYPE_KIND_FLOAT ? "movss" : "movsd";
+    if (n->vreg != REG_NONE) {
+      emitf("%s %%xmm%d, %%%s", mov, i, reg_name(n->vreg, 8));
+    } else {
+      emitf("%s %%xmm%d, %d(%%rbp)", mov, i, -n->voffset);
+    }
   }
   for (int i = 0; i < iregs->size; i++) {
     node_t *n = (node_t *)iregs->data[i];
+    if (n->vreg != REG_NONE) {
+      continue;
+    }
     switch (n->type->bytes) {
     case 1:
       emitf("movl %%%s, %%eax", MREGS[i]);
@@ -1278,35 +2457,15 @@ static void emit_function(parse_t *parse, node_t *node) {
       errorf("invalid variable type");
     }
   }
-  // fix stack fargs positions
-  int spoffset = 16;
-  for (int i = 0; i < stack->size; i++) {
-    node_t *n = (node_t *)stack->data[i];
-    if (type_is_float(n->type)) {
-      n->voffset = -spoffset;
-      spoffset += 8;
-    } else if (type_is_struct(n->type)) {
-      int size = n->type->total_size;
-      align(&size, 8);
-      n->voffset = -spoffset;
-      spoffset += size;
-    } else {
-      n->voffset = -spoffset;
-      spoffset += 8;
-    }
-  }
+  emit_move_args(parse, iregs);
 
   vector_free(iregs);
   vector_free(xregs);
   vector_free(stack);
 
-  offset = placement_variables(node->fbody, offset);
-  align(&offset, 8);
-
-  emit_add_rsp(parse, -offset);
   emit_expression(parse, node->fbody);
-  emitf("leave");
-  emitf("ret");
+  emit_epilogue(parse);
+  frame->end = emit_insts()->size;
   parse->current_function = old_function;
 }
 
@@ -1319,8 +2478,12 @@ static void emit_global_data(parse_t *parse, type_t *type, node_t *val) {
   if (val->kind == NODE_KIND_LITERAL) {
     long n;
     switch (val->type->kind) {
+    case TYPE_KIND_BOOL:
     case TYPE_KIND_CHAR:
+    case TYPE_KIND_SHORT:
     case TYPE_KIND_INT:
+    case TYPE_KIND_LONG:
+    case TYPE_KIND_LLONG:
       n = val->ival;
       break;
     default:
@@ -1454,7 +2617,17 @@ static void emit_builtin_va_start(parse_t *parse, node_t *node) {
   emitf("movq %%rax, %d(%%rbp)", -arg0->voffset + 16); // reg_save_area
 }
 
-void gen(parse_t *parse) {
+void gen(parse_t *parse, FILE *out) {
+  if (parse->option->optimize >= 1) {
+    inline_functions(parse);
+  }
+  dce(parse);
+  if (parse->option->optimize >= 1) {
+    licm(parse);
+    vectorize(parse);
+    induction(parse);
+  }
+  parse->frames = vector_new();
   emit_data_section(parse);
   for (int i = 0; i < parse->statements->size; i++) {
     node_t *node = (node_t *)parse->statements->data[i];
@@ -1470,4 +2643,15 @@ void gen(parse_t *parse) {
       errorf("the node type is not supported at toplevel");
     }
   }
+  peephole(parse);
+  frame_finish(parse);
+  if (parse->option->emit_object) {
+    asm_write_object(out);
+  } else {
+    emit_flush(out);
+  }
+  while (parse->frames->size > 0) {
+    free(vector_pop(parse->frames));
+  }
+  vector_free(parse->frames);
 }
@@ -3,6 +3,7 @@
 #ifndef HCC_H_
 #define HCC_H_
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdnoreturn.h>
@@ -43,6 +44,28 @@ struct map {
   map_entry_t *bottom;
 };
 
+typedef struct arena_chunk arena_chunk_t;
+typedef struct arena arena_t;
+struct arena {
+  int obj_size;
+  int chunk_objs;
+  arena_chunk_t *chunks;
+  char *p;
+  char *end;
+  vector_t *owners;
+};
+
+typedef struct option option_t;
+struct option {
+  int optimize;
+  bool no_free;
+  char *emit_pch;
+  char *include_pch;
+  bool emit_object;
+  bool stats;
+  char *output;
+};
+
 typedef struct string string_t;
 struct string {
   char *buf;
@@ -135,6 +158,7 @@ enum {
   TOKEN_KEYWORD_STATIC,
   TOKEN_KEYWORD_EXTERN,
   TOKEN_KEYWORD_CONST,
+  TOKEN_KEYWORD_INLINE,
   TOKEN_KEYWORD_ELLIPSIS,
   TOKEN_KEYWORD_TYPECODE,
   TOKEN_KEYWORD_TYPECODE_COMPARE,
@@ -182,12 +206,14 @@ struct token {
 typedef struct file file_t;
 struct file {
   char *file_name;
-  string_t *src;
+  string_t *src;  // NULL when buf is mmap'ed
+  char *buf;
+  long size;
   char *p;
   vector_t *tbuf;
   int line;
   int column;
-  vector_t *lines;
+  vector_t *line_index;
 };
 
 typedef struct lex lex_t;
@@ -196,7 +222,7 @@ struct lex {
   char *mark_p;
   int mark_line;
   int mark_column;
-  vector_t *tokens;
+  arena_t *token_arena;
   bool is_space;
 };
 
@@ -224,6 +250,34 @@ enum {
   NODE_KIND_CASE,
 };
 
+enum {
+  REG_NONE = -1,
+  // callee-saved, used for local variables
+  REG_RBX,
+  REG_R12,
+  REG_R13,
+  REG_R14,
+  REG_R15,
+  // caller-saved, used for local variables of functions that make no calls
+  REG_RSI,
+  REG_RDI,
+  REG_R8,
+  REG_R9,
+  // scratch, used for expression temporaries
+  REG_R10,
+  REG_R11,
+  REG_XMM8,
+  REG_XMM9,
+  REG_XMM10,
+  REG_XMM11,
+  // scratch, used for float variables not live across calls
+  REG_XMM12,
+  REG_XMM13,
+  REG_XMM14,
+  REG_XMM15,
+  REG_NUM,
+};
+
 enum {
   BLOCK_KIND_DEFAULT,
   BLOCK_KIND_LOOP,
@@ -237,6 +291,8 @@ enum {
   STORAGE_CLASS_EXTERN,
 };
 
+typedef struct vloop vloop_t;
+
 typedef struct node node_t;
 struct node {
   int kind;
@@ -263,6 +319,9 @@ struct node {
       bool global;
       int sclass;
       int voffset;
+      int vreg;
+      // value of a const scalar with a literal initializer
+      node_t *vconst;
     };
     // Binary/Unary operator
     struct {
@@ -287,6 +346,7 @@ struct node {
       node_t *fvar;
       vector_t *fargs;
       bool is_vaargs;
+      bool is_inline;
       node_t *fbody;
     };
     // Function call
@@ -323,6 +383,8 @@ struct node {
       node_t *lcond;
       node_t *lstep;
       node_t *lbody;
+      // packed form of a counted for loop, planned by vectorize()
+      vloop_t *vloop;
     };
     // switch
     struct {
@@ -339,6 +401,58 @@ struct node {
   };
 };
 
+enum {
+  IR_IMM,    // dst = ival
+  IR_FIMM,   // dst = float literal node
+  IR_STR,    // dst = address of string literal node
+  IR_VAR,    // dst = value of variable node (address for arrays/structs)
+  IR_ADDR,   // dst = address of variable node
+  IR_ASSIGN, // variable node = src1
+  IR_MOV,    // dst = src1
+  IR_LOAD,   // dst = *src1
+  IR_STORE,  // *src1 = src2
+  IR_BINOP,  // dst = src1 op src2
+  IR_UNOP,   // dst = op src1
+  IR_CAST,   // dst = (type)src1
+  IR_CALL,   // dst = node(args...) or (*src1)(args...)
+  IR_JMP,    // goto then_block
+  IR_BR,     // if src1 goto then_block else goto else_block
+  IR_RET,    // return src1
+};
+
+typedef struct ir_block ir_block_t;
+
+typedef struct ir ir_t;
+struct ir {
+  int kind;
+  int op;
+  type_t *type;
+  int dst;
+  int src1;
+  int src2;
+  long ival;
+  node_t *node;
+  vector_t *args;
+  ir_block_t *then_block;
+  ir_block_t *else_block;
+  int stmt;  // the statement the instruction was lowered from
+};
+
+struct ir_block {
+  int id;
+  vector_t *insts;
+  vector_t *preds;
+  vector_t *succs;
+};
+
+typedef struct ir_func ir_func_t;
+struct ir_func {
+  node_t *func;
+  vector_t *blocks;
+  int ntemps;
+  int nstmts;
+};
+
 typedef struct macro macro_t;
 struct macro {
   map_t *args;
@@ -346,17 +460,110 @@ struct macro {
   bool is_vaargs;
 };
 
+#define EMIT_MAX_ARGS 3
+
+// one emitted assembly line; op is NULL once the line is deleted
+typedef struct inst inst_t;
+struct inst {
+  char *op;
+  char *args[EMIT_MAX_ARGS];
+  int nargs;
+  bool indent;
+};
+
+// instruction range of one emitted function, for frame_finish
+typedef struct frame frame_t;
+struct frame {
+  char *name;
+  int begin;  // first prologue instruction
+  int body;   // first instruction after the prologue
+  int end;
+  int size;
+};
+
+#define VLOOP_MAX_BASES 4  // held in %rsi, %rdi, %r8 and %r9
+#define VLOOP_MAX_FIXED 6  // broadcasts and accumulators, held in %xmm2-%xmm7
+#define VLOOP_MAX_DEPTH 6  // expression registers %xmm0, %xmm1 and %xmm8-%xmm11
+
+enum {
+  VEXPR_LOAD,       // base[iv + offset]
+  VEXPR_BROADCAST,  // a loop invariant in every lane
+  VEXPR_OP,
+};
+
+// element-wise expression of a vectorized loop
+typedef struct vexpr vexpr_t;
+struct vexpr {
+  int kind;
+  int op;
+  int base;     // VEXPR_LOAD: index into vloop->bases
+  int offset;   // VEXPR_LOAD: elements from the induction variable
+  int fixed;    // VEXPR_BROADCAST: index into vloop->fixed
+  vexpr_t *left;
+  vexpr_t *right;
+};
+
+// array variable indexed by the induction variable
+typedef struct vbase vbase_t;
+struct vbase {
+  node_t *var;
+  int lo;       // smallest and largest element offset accessed
+  int hi;
+  bool stored;
+};
+
+// statement of a vectorized loop: '=' stores value to base[iv], '+' and
+// '-' add it to var, '<' and '>' keep the minimum or maximum in var
+typedef struct vstmt vstmt_t;
+struct vstmt {
+  int op;
+  int base;
+  node_t *var;
+  int fixed;    // accumulator of a reduction: index into vloop->fixed
+  vexpr_t *value;
+};
+
+struct vloop {
+  type_t *elem;     // float, double or 32-bit integer elements
+  int lanes;
+  node_t *iv;
+  node_t *bound;    // the loop runs while iv < bound
+  vector_t *bases;  // vbase_t
+  vector_t *fixed;  // broadcast invariants, then NULL for each accumulator
+  vector_t *stmts;  // vstmt_t
+};
+
+// what a loop may change, collected by loop_scan
+typedef struct loop_info loop_info_t;
+struct loop_info {
+  vector_t *addressed;  // local variables whose address is taken
+  vector_t *written;    // variables assigned in the loop
+  bool calls;           // the loop makes calls
+  bool stores;          // or stores through a pointer
+  node_t *iv;           // a variable that varies without being in written
+  node_t *skip;         // a statement loop_scan leaves out
+};
+
+typedef struct include_guard include_guard_t;
+struct include_guard {
+  char *macro;
+  bool once;
+};
+
 typedef struct parse parse_t;
 struct parse {
+  option_t *option;
   lex_t *lex;
   vector_t *statements;
   vector_t *data;
-  vector_t *nodes;
+  arena_t *node_arena;
+  arena_t *type_arena;
   map_t *vars;
   map_t *types;
   map_t *tags;
   map_t *macros;
   node_t *current_function;
+  bool is_inline;  // 'inline' seen by declaration_specifier
   node_t *current_scope;
   node_t *next_scope;
   // builtin types
@@ -381,8 +588,16 @@ struct parse {
   type_t *type_va_listp;
   // gen state
   int stackpos;
+  int tmpdepth;
+  int xtmpdepth;
+  int saved_regs;
+  int saved_offset;
+  bool tail_calls;  // nothing points into the frame, tail calls may reuse it
+  vector_t *frames;
   // preprocessor
   vector_t *include_path;
+  map_t *include_probes;
+  map_t *include_guards;
 };
 
 // vector.c
@@ -410,6 +625,7 @@ void string_add(string_t *str, char c);
 void string_append(string_t *str, char *s);
 void string_appendf(string_t *str, char *fmt, ...);
 string_t *string_dup(string_t *str0);
+void string_append_quote(string_t *str, string_t *src);
 void string_print_quote(string_t *str, FILE *out);
 
 // util.c
@@ -419,13 +635,13 @@ void align(int *np, int a);
 string_t *fullpath(char *path);
 
 // type.c
-type_t *type_new_with_size(char *name, int kind, int sign, type_t *parent, int size);
-type_t *type_new(char *name, int kind, int sign, type_t *ptr);
-type_t *type_new_struct(char *name, bool is_struct);
-type_t *type_new_typedef(char *name, type_t *type);
-type_t *type_new_enum(char *name);
-type_t *type_new_const(type_t *type);
-type_t *type_new_stub();
+type_t *type_new_with_size(parse_t *parse, char *name, int kind, int sign, type_t *parent, int size);
+type_t *type_new(parse_t *parse, char *name, int kind, int sign, type_t *ptr);
+type_t *type_new_struct(parse_t *parse, char *name, bool is_struct);
+type_t *type_new_typedef(parse_t *parse, char *name, type_t *type);
+type_t *type_new_enum(parse_t *parse, char *name);
+type_t *type_new_const(parse_t *parse, type_t *type);
+type_t *type_new_stub(parse_t *parse);
 void type_free(type_t *t);
 type_t *type_find(parse_t *parse, char *name);
 void type_add(parse_t *parse, char *name, type_t *type);
@@ -445,11 +661,23 @@ bool type_is_float(type_t *type);
 bool type_is_struct(type_t *type);
 bool type_is_function(type_t *type);
 
+// emit.c
+void emit_vline(bool indent, char *fmt, va_list args);
+void emit_string_literal(string_t *str);
+char *emit_format(char *fmt, ...);
+vector_t *emit_insts(void);
+void emit_flush(FILE *out);
+void emit_clear(void);
+
+// asm.c
+void asm_write_object(FILE *out);
+
 // file.c
 file_t *file_new(FILE *fp);
 file_t *file_new_filename(char *file_name);
 file_t *file_new_string(string_t *str);
 void file_free(file_t *f);
+char *file_get_line(file_t *f, int line, int *lenp);
 char file_get_char(file_t *f);
 void file_unget_char(file_t *f, char c);
 
@@ -505,13 +733,15 @@ node_t *node_new_do(parse_t *parse, node_t *cond, node_t *body);
 node_t *node_new_for(parse_t *parse, node_t *init, node_t *cond, node_t *step, node_t *body);
 node_t *node_new_switch(parse_t *parse, node_t *expr, node_t *body);
 node_t *node_new_case(parse_t *parse, node_t *val, node_t *body);
+bool node_is_assign(node_t *node);
+bool node_is_incdec(node_t *node);
 void node_free(node_t *node);
 void node_debug(node_t *node);
 
 // parse.c
 type_t *parse_make_empty_struct_type(parse_t *parse, char *tag, bool is_struct);
 void parse_free(parse_t *parse);
-parse_t *parse_file(FILE *fp);
+parse_t *parse_file(FILE *fp, option_t *option);
 void parse_include(parse_t *parse, char *file_name);
 node_t *parse_constant_expression(parse_t *parse);
 
@@ -527,13 +757,71 @@ token_t *cpp_expect_token_is(parse_t *parse, int k);
 token_t *cpp_next_keyword_is(parse_t *parse, int k);
 void cpp_expect_keyword_is(parse_t *parse, int k);
 
+// arena.c
+arena_t *arena_new(int obj_size);
+void *arena_alloc(arena_t *arena);
+void arena_own(arena_t *arena, void *obj);
+void arena_free(arena_t *arena, void (*release_fn)(void *));
+
+// atom.c
+char *atom_new(const char *s);
+char *atom_new_with_len(const char *s, int len);
+unsigned atom_hash(const char *atom);
+
 // builtin.c
 void builtin_init(parse_t *parse);
 
+// pch.c
+void pch_write(parse_t *parse, char *file_name);
+void pch_read(parse_t *parse, char *file_name);
+
+// inline.c
+void inline_functions(parse_t *parse);
+
+// dce.c
+void dce(parse_t *parse);
+
+// loop.c
+bool loop_has_label(node_t *node);
+void loop_scan(loop_info_t *info, node_t *node);
+bool loop_is_scalar(type_t *type);
+bool loop_is_local(loop_info_t *info, node_t *var);
+bool loop_is_invariant(loop_info_t *info, node_t *node);
+bool loop_same_expr(node_t *a, node_t *b);
+void loop_collect_addressed(vector_t *vars, node_t *node);
+
+// licm.c
+void licm(parse_t *parse);
+
+// vectorize.c
+void vectorize(parse_t *parse);
+
+// induction.c
+void induction(parse_t *parse);
+
+// frame.c
+int frame_layout(parse_t *parse, node_t *func, int offset);
+void frame_finish(parse_t *parse);
+
+// peephole.c
+void peephole(parse_t *parse);
+
+// regalloc.c
+int regalloc(parse_t *parse, node_t *func);
+bool reg_is_xmm(int reg);
+const char *reg_name(int reg, int bytes);
+
+// ir.c
+ir_func_t *ir_lower_function(parse_t *parse, node_t *func);
+void ir_free_function(ir_func_t *f);
+void ir_dump_function(ir_func_t *f, FILE *out);
+void ir_dump(parse_t *parse, FILE *out);
+
 // gen.c
-void gen(parse_t *parse);
+void gen(parse_t *parse, FILE *out);
 
 // error.c
+void error_set_lex(lex_t *lex);
 noreturn void errorf(char *fmt, ...);
 void warnf(char *fmt, ...);
 
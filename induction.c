@@ -0,0 +1,466 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Induction-variable strength reduction.
+ *
+ * A basic induction variable of a for loop is a signed local integer that
+ * the loop only changes in its step, by adding or subtracting a constant.
+ * Each address computed in the condition or body as ptr + idx, with ptr
+ * invariant and idx a linear function of the induction variable, becomes
+ * a pointer variable: it is initialized after the loop's init, replaces
+ * the address computation, and is advanced in the step by the scaled
+ * stride, so the multiply and add per access become one add per loop.
+ *
+ * Linear function test replacement then removes the induction variable
+ * from the loop altogether when it is declared by the init and only read
+ * by a condition comparing it with an invariant bound: the condition is
+ * rewritten against the first derived pointer, compared with that pointer
+ * evaluated at the bound, and the update of the index is dropped.
+ *
+ * Initial values and bounds are evaluated before the first test, so, as
+ * for loop-invariant code motion, their invariant parts must not trap.
+ */
+
+#define INDUCTION_MAX_POINTERS 4  // derived pointers per loop, each takes a register
+
+typedef struct derived derived_t;
+struct derived {
+  node_t *expr;
+  node_t *var;
+  long coef;
+};
+
+typedef struct induction induction_t;
+struct induction {
+  parse_t *parse;
+  loop_info_t loop;     // side effects of the current loop; loop.iv is the induction variable
+  long step;
+  vector_t *derived;
+  int pointers;
+  int tests;
+};
+
+static void walk(induction_t *ind, node_t **slot);
+
+// Whether node adds a constant to a variable; sets var and step
+static bool is_update(node_t *node, node_t **var, long *step) {
+  if (node->kind == NODE_KIND_UNARY_OP && node_is_incdec(node)) {
+    *var = node->operand;
+    *step = node->op == OP_INC || node->op == OP_PINC ? 1 : -1;
+  } else if (node->kind == NODE_KIND_BINARY_OP &&
+             (node->op == ('+' | OP_ASSIGN_MASK) || node->op == ('-' | OP_ASSIGN_MASK)) &&
+             node->right->kind == NODE_KIND_LITERAL && type_is_int(node->right->type)) {
+    *var = node->left;
+    *step = node->op == ('+' | OP_ASSIGN_MASK) ? node->right->ival : -node->right->ival;
+  } else {
+    return false;
+  }
+  return (*var)->kind == NODE_KIND_VARIABLE && *step != 0;
+}
+
+// Whether node is coef * iv + an invariant
+static bool is_linear(induction_t *ind, node_t *node, long *coef) {
+  if (node->next != NULL || !type_is_int(node->type) || node->type->bytes < 4) {
+    return false;
+  }
+  if (node == ind->loop.iv) {
+    *coef = 1;
+    return true;
+  }
+  if (node->kind != NODE_KIND_BINARY_OP) {
+    return false;
+  }
+  long c;
+  switch (node->op) {
+  case '+':
+    if (is_linear(ind, node->left, &c) && loop_is_invariant(&ind->loop, node->right)) {
+      *coef = c;
+      return true;
+    }
+    if (loop_is_invariant(&ind->loop, node->left) && is_linear(ind, node->right, &c)) {
+      *coef = c;
+      return true;
+    }
+    break;
+  case '-':
+    if (is_linear(ind, node->left, &c) && loop_is_invariant(&ind->loop, node->right)) {
+      *coef = c;
+      return true;
+    }
+    if (loop_is_invariant(&ind->loop, node->left) && is_linear(ind, node->right, &c)) {
+      *coef = -c;
+      return true;
+    }
+    break;
+  case '*':
+    if (is_linear(ind, node->left, &c) && node->right->kind == NODE_KIND_LITERAL) {
+      *coef = c * node->right->ival;
+      return *coef != 0;
+    }
+    if (node->left->kind == NODE_KIND_LITERAL && is_linear(ind, node->right, &c)) {
+      *coef = c * node->left->ival;
+      return *coef != 0;
+    }
+    break;
+  }
+  return false;
+}
+
+// Replaces the address ptr + idx at *slot with a derived pointer, if it is one
+static bool derive(induction_t *ind, node_t **slot) {
+  node_t *node = *slot;
+  long coef;
+  if (node->kind != NODE_KIND_BINARY_OP || node->op != '+' || node->next != NULL ||
+      node->type->kind != TYPE_KIND_PTR || node->type->parent->total_size <= 0 ||
+      (node->left->type->kind != TYPE_KIND_PTR && node->left->type->kind != TYPE_KIND_ARRAY) ||
+      !loop_is_invariant(&ind->loop, node->left) || !is_linear(ind, node->right, &coef)) {
+    return false;
+  }
+  for (int i = 0; i < ind->derived->size; i++) {
+    derived_t *d = (derived_t *)ind->derived->data[i];
+    if (loop_same_expr(d->expr, node)) {
+      *slot = d->var;
+      return true;
+    }
+  }
+  if (ind->derived->size >= INDUCTION_MAX_POINTERS) {
+    return false;
+  }
+  derived_t *d = (derived_t *)malloc(sizeof (derived_t));
+  d->expr = node;
+  d->var = node_new_variable(ind->parse, node->type, NULL, STORAGE_CLASS_NONE, false);
+  d->coef = coef;
+  vector_push(ind->derived, d);
+  *slot = d->var;
+  return true;
+}
+
+static void reduce(induction_t *ind, node_t **slot) {
+  for (; *slot; slot = &(*slot)->next) {
+    if (derive(ind, slot)) {
+      continue;
+    }
+    node_t *node = *slot;
+    switch (node->kind) {
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        reduce(ind, (node_t **)&node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      reduce(ind, &node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      reduce(ind, &node->left);
+      if (node->op != '.') {
+        reduce(ind, &node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      reduce(ind, &node->operand);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        reduce(ind, (node_t **)&node->args->data[i]);
+      }
+      if (node->func->kind != NODE_KIND_VARIABLE) {
+        reduce(ind, &node->func);
+      }
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        reduce(ind, (node_t **)&node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      reduce(ind, &node->cond);
+      reduce(ind, &node->then_body);
+      reduce(ind, &node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      reduce(ind, &node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      reduce(ind, &node->linit);
+      reduce(ind, &node->lcond);
+      reduce(ind, &node->lstep);
+      reduce(ind, &node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      reduce(ind, &node->sexpr);
+      reduce(ind, &node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      reduce(ind, &node->cstmt);
+      break;
+    }
+  }
+}
+
+// Counts the occurrences of var in node, skipping the node skip
+static int count_uses(node_t *node, node_t *var, node_t *skip) {
+  int n = 0;
+  for (; node; node = node->next) {
+    if (node == skip) {
+      continue;
+    }
+    switch (node->kind) {
+    case NODE_KIND_VARIABLE:
+      n += node == var;
+      break;
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        n += count_uses((node_t *)node->init_list->data[i], var, skip);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      n += count_uses(node->dec_init, var, skip);
+      break;
+    case NODE_KIND_BINARY_OP:
+      n += count_uses(node->left, var, skip);
+      if (node->op != '.') {
+        n += count_uses(node->right, var, skip);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      n += count_uses(node->operand, var, skip);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        n += count_uses((node_t *)node->args->data[i], var, skip);
+      }
+      n += count_uses(node->func, var, skip);
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        n += count_uses((node_t *)node->statements->data[i], var, skip);
+      }
+      break;
+    case NODE_KIND_IF:
+      n += count_uses(node->cond, var, skip) + count_uses(node->then_body, var, skip) +
+           count_uses(node->else_body, var, skip);
+      break;
+    case NODE_KIND_RETURN:
+      n += count_uses(node->retval, var, skip);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      n += count_uses(node->linit, var, skip) + count_uses(node->lcond, var, skip) +
+           count_uses(node->lstep, var, skip) + count_uses(node->lbody, var, skip);
+      break;
+    case NODE_KIND_SWITCH:
+      n += count_uses(node->sexpr, var, skip) + count_uses(node->sbody, var, skip);
+      break;
+    case NODE_KIND_CASE:
+      n += count_uses(node->cstmt, var, skip);
+      break;
+    }
+  }
+  return n;
+}
+
+// A copy of node with var replaced by val
+static node_t *substitute(induction_t *ind, node_t *node, node_t *var, node_t *val) {
+  switch (node->kind) {
+  case NODE_KIND_VARIABLE:
+    return node == var ? val : node;
+  case NODE_KIND_BINARY_OP:
+    return node_new_binary_op(ind->parse, node->type, node->op,
+                              substitute(ind, node->left, var, val), substitute(ind, node->right, var, val));
+  case NODE_KIND_UNARY_OP:
+    return node_new_unary_op(ind->parse, node->type, node->op, substitute(ind, node->operand, var, val));
+  }
+  return node;
+}
+
+static int swap_comp(int op) {
+  switch (op) {
+  case '<':
+    return '>';
+  case OP_LE:
+    return OP_GE;
+  case '>':
+    return '<';
+  case OP_GE:
+    return OP_LE;
+  }
+  return op;
+}
+
+static bool declares(node_t *init, node_t *var) {
+  for (; init; init = init->next) {
+    if (init->kind == NODE_KIND_DECLARATION && init->dec_var == var) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void append(node_t **slot, node_t *node) {
+  while (*slot) {
+    slot = &(*slot)->next;
+  }
+  *slot = node;
+}
+
+static void unlink_node(node_t **slot, node_t *node) {
+  for (; *slot; slot = &(*slot)->next) {
+    if (*slot == node) {
+      *slot = node->next;
+      node->next = NULL;
+      return;
+    }
+  }
+}
+
+// Rewrites the test iv REL bound against the first derived pointer
+static void replace_test(induction_t *ind, node_t *loop, node_t *update) {
+  node_t *cond = loop->lcond;
+  if (cond == NULL || cond->next != NULL || cond->kind != NODE_KIND_BINARY_OP || !declares(loop->linit, ind->loop.iv)) {
+    return;
+  }
+  int op = cond->op;
+  node_t *bound;
+  if (op != OP_EQ && op != OP_NE && op != '<' && op != OP_LE && op != '>' && op != OP_GE) {
+    return;
+  }
+  if (cond->left == ind->loop.iv) {
+    bound = cond->right;
+  } else if (cond->right == ind->loop.iv) {
+    bound = cond->left;
+    op = swap_comp(op);
+  } else {
+    return;
+  }
+  // the bound stands in for the index in its address computation
+  if (!cond->left->type->sign || !cond->right->type->sign || !type_is_int(bound->type) ||
+      bound->type->bytes > ind->loop.iv->type->bytes) {
+    return;
+  }
+  if (!loop_is_invariant(&ind->loop, bound) || count_uses(loop->lcond, ind->loop.iv, NULL) != 1 ||
+      count_uses(loop->lbody, ind->loop.iv, NULL) != 0 || count_uses(loop->lstep, ind->loop.iv, update) != 0) {
+    return;
+  }
+
+  derived_t *d = (derived_t *)ind->derived->data[0];
+  node_t *end = node_new_variable(ind->parse, d->var->type, NULL, STORAGE_CLASS_NONE, false);
+  append(&loop->linit, node_new_declaration(ind->parse, end->type, end, substitute(ind, d->expr, ind->loop.iv, bound)));
+  if (d->coef < 0) {
+    op = swap_comp(op);
+  }
+  loop->lcond = node_new_binary_op(ind->parse, cond->type, op, d->var, end);
+  unlink_node(&loop->lstep, update);
+  ind->tests++;
+}
+
+static void process_loop(induction_t *ind, node_t *loop) {
+  walk(ind, &loop->linit);
+  walk(ind, &loop->lbody);
+  if (loop->kind != NODE_KIND_FOR || loop->vloop != NULL || loop_has_label(loop->lbody)) {
+    return;
+  }
+
+  node_t *update = NULL;
+  node_t *iv = NULL;
+  long step = 0;
+  for (node_t *n = loop->lstep; n; n = n->next) {
+    if (is_update(n, &iv, &step)) {
+      update = n;
+      break;
+    }
+  }
+  if (update == NULL || iv->global || iv->sclass != STORAGE_CLASS_NONE || !type_is_int(iv->type) ||
+      !iv->type->sign || iv->type->bytes < 4 || vector_exists(ind->loop.addressed, iv)) {
+    return;
+  }
+
+  ind->loop.written = vector_new();
+  ind->loop.calls = false;
+  ind->loop.stores = false;
+  ind->loop.iv = NULL;
+  ind->loop.skip = update;
+  ind->derived = vector_new();
+  loop_scan(&ind->loop, loop->lcond);
+  loop_scan(&ind->loop, loop->lstep);
+  loop_scan(&ind->loop, loop->lbody);
+  if (!vector_exists(ind->loop.written, iv)) {
+    ind->loop.iv = iv;
+    ind->step = step;
+    reduce(ind, &loop->lcond);
+    reduce(ind, &loop->lbody);
+  }
+
+  if (ind->derived->size > 0) {
+    for (int i = 0; i < ind->derived->size; i++) {
+      derived_t *d = (derived_t *)ind->derived->data[i];
+      append(&loop->linit, node_new_declaration(ind->parse, d->var->type, d->var, d->expr));
+      node_t *stride = node_new_int(ind->parse, ind->parse->type_long, d->coef * step);
+      append(&loop->lstep, node_new_binary_op(ind->parse, d->var->type, '+' | OP_ASSIGN_MASK, d->var, stride));
+      ind->pointers++;
+    }
+    replace_test(ind, loop, update);
+  }
+  while (ind->derived->size > 0) {
+    free(vector_pop(ind->derived));
+  }
+  vector_free(ind->derived);
+  vector_free(ind->loop.written);
+  ind->loop.iv = NULL;
+  ind->loop.skip = NULL;
+}
+
+static void walk(induction_t *ind, node_t **slot) {
+  for (; *slot; slot = &(*slot)->next) {
+    node_t *node = *slot;
+    switch (node->kind) {
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        walk(ind, (node_t **)&node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      walk(ind, &node->then_body);
+      walk(ind, &node->else_body);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      process_loop(ind, node);
+      break;
+    case NODE_KIND_SWITCH:
+      walk(ind, &node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      walk(ind, &node->cstmt);
+      break;
+    }
+  }
+}
+
+void induction(parse_t *parse) {
+  induction_t ind = {0};
+  ind.parse = parse;
+  vector_t *stmts = parse->statements;
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind != NODE_KIND_FUNCTION) {
+      continue;
+    }
+    ind.loop.addressed = vector_new();
+    loop_collect_addressed(ind.loop.addressed, node->fbody);
+    walk(&ind, &node->fbody);
+    vector_free(ind.loop.addressed);
+  }
+
+  if (parse->option->stats) {
+    fprintf(stderr, "induction pointers %d\n", ind.pointers);
+    fprintf(stderr, "induction tests %d\n", ind.tests);
+  }
+}
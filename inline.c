@@ -0,0 +1,409 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Function inliner.
+ *
+ * A static function whose body is a single `return expr;` is substituted
+ * into its callers, with each parameter replaced by the argument (cast to
+ * the parameter type). Callees are processed before their callers, so a
+ * call is only inlined into a finished body and recursion is never
+ * expanded. Substitution must not change what is evaluated or in which
+ * order, which limits the arguments a call may have:
+ *
+ *  - if the body has side effects, each argument is a literal or a local
+ *    variable whose address is never taken;
+ *  - otherwise arguments are free of side effects, and an argument used
+ *    more than once is a literal or a variable.
+ */
+
+#define INLINE_MAX_NODES      8   // size limit of a static function body
+#define INLINE_HINT_MAX_NODES 32  // and of one declared inline
+
+enum {
+  INLINE_UNVISITED,
+  INLINE_VISITING,
+  INLINE_DONE,
+};
+
+typedef struct candidate candidate_t;
+struct candidate {
+  node_t *func;
+  int state;
+  node_t *expr;
+  bool side_effects;
+};
+
+typedef struct inliner inliner_t;
+struct inliner {
+  parse_t *parse;
+  map_t *candidates;
+  vector_t *addressed;
+  int hits;
+};
+
+static void process(inliner_t *in, candidate_t *c);
+
+static int count_nodes(node_t *node) {
+  if (node == NULL) {
+    return 0;
+  }
+  if (node->next != NULL) {
+    // comma expressions are not substituted
+    return INLINE_HINT_MAX_NODES + 1;
+  }
+  int n = 1;
+  switch (node->kind) {
+  case NODE_KIND_BINARY_OP:
+    n += count_nodes(node->left);
+    if (node->op != '.') {
+      n += count_nodes(node->right);
+    }
+    break;
+  case NODE_KIND_UNARY_OP:
+    n += count_nodes(node->operand);
+    break;
+  case NODE_KIND_CALL:
+    for (int i = 0; i < node->args->size; i++) {
+      n += count_nodes((node_t *)node->args->data[i]);
+    }
+    break;
+  case NODE_KIND_IF:
+    n += count_nodes(node->cond) + count_nodes(node->then_body) + count_nodes(node->else_body);
+    break;
+  case NODE_KIND_LITERAL:
+  case NODE_KIND_STRING_LITERAL:
+  case NODE_KIND_VARIABLE:
+    break;
+  default:
+    // statements cannot be substituted into an expression
+    return INLINE_HINT_MAX_NODES + 1;
+  }
+  return n;
+}
+
+static bool has_side_effects(node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_CALL:
+      return true;
+    case NODE_KIND_BINARY_OP:
+      if (node_is_assign(node) || has_side_effects(node->left) ||
+          (node->op != '.' && has_side_effects(node->right))) {
+        return true;
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if (node_is_incdec(node) || has_side_effects(node->operand)) {
+        return true;
+      }
+      break;
+    case NODE_KIND_IF:
+      if (has_side_effects(node->cond) || has_side_effects(node->then_body) ||
+          has_side_effects(node->else_body)) {
+        return true;
+      }
+      break;
+    }
+  }
+  return false;
+}
+
+// Counts the reads of var in node; -1 if it is written or its address is taken
+static int count_uses(node_t *node, node_t *var) {
+  int n = 0;
+  for (; node; node = node->next) {
+    int m = 0;
+    switch (node->kind) {
+    case NODE_KIND_VARIABLE:
+      m = node == var;
+      break;
+    case NODE_KIND_BINARY_OP:
+      if (node_is_assign(node) && node->left == var) {
+        return -1;
+      }
+      m = count_uses(node->left, var);
+      if (m >= 0 && node->op != '.') {
+        int r = count_uses(node->right, var);
+        m = r < 0 ? r : m + r;
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if ((node_is_incdec(node) || node->op == '&') && node->operand == var) {
+        return -1;
+      }
+      m = count_uses(node->operand, var);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size && m >= 0; i++) {
+        int r = count_uses((node_t *)node->args->data[i], var);
+        m = r < 0 ? r : m + r;
+      }
+      break;
+    case NODE_KIND_IF: {
+      int c = count_uses(node->cond, var), t = count_uses(node->then_body, var);
+      int e = count_uses(node->else_body, var);
+      m = c < 0 || t < 0 || e < 0 ? -1 : c + t + e;
+      break;
+    }
+    }
+    if (m < 0) {
+      return -1;
+    }
+    n += m;
+  }
+  return n;
+}
+
+// Returns the expression that can replace calls to func, or NULL
+static node_t *inline_body(node_t *func) {
+  node_t *var = func->fvar;
+  type_t *ret = var->type->parent;
+  if (var->sclass != STORAGE_CLASS_STATIC || var->type->is_vaargs ||
+      ret->kind == TYPE_KIND_VOID || type_is_struct(ret)) {
+    return NULL;
+  }
+  node_t *stmt = NULL;
+  vector_t *stmts = func->fbody->statements;
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *s = (node_t *)stmts->data[i];
+    if (s->kind == NODE_KIND_NOP) {
+      continue;
+    }
+    if (stmt != NULL) {
+      return NULL;
+    }
+    stmt = s;
+  }
+  if (stmt == NULL || stmt->kind != NODE_KIND_RETURN || stmt->retval == NULL || stmt->retval->next != NULL) {
+    return NULL;
+  }
+  node_t *expr = stmt->retval;
+  int limit = func->is_inline ? INLINE_HINT_MAX_NODES : INLINE_MAX_NODES;
+  if (count_nodes(expr) > limit) {
+    return NULL;
+  }
+  for (int i = 0; i < func->fargs->size; i++) {
+    node_t *param = (node_t *)func->fargs->data[i];
+    if (type_is_struct(param->type) || count_uses(expr, param) < 0) {
+      return NULL;
+    }
+  }
+  return expr;
+}
+
+static bool is_trivial(node_t *node) {
+  return node->kind == NODE_KIND_LITERAL || node->kind == NODE_KIND_VARIABLE;
+}
+
+static bool can_inline(inliner_t *in, candidate_t *c, vector_t *args) {
+  vector_t *params = c->func->fargs;
+  if (args->size != params->size) {
+    return false;
+  }
+  for (int i = 0; i < args->size; i++) {
+    node_t *arg = (node_t *)args->data[i];
+    if (arg->next != NULL) {
+      return false;
+    }
+    if (c->side_effects) {
+      if (arg->kind == NODE_KIND_LITERAL) {
+        continue;
+      }
+      if (arg->kind != NODE_KIND_VARIABLE || arg->global || vector_exists(in->addressed, arg)) {
+        return false;
+      }
+    } else {
+      if (has_side_effects(arg)) {
+        return false;
+      }
+      if (count_uses(c->expr, (node_t *)params->data[i]) > 1 && !is_trivial(arg)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static node_t *substitute(inliner_t *in, node_t *node, vector_t *params, vector_t *args) {
+  if (node == NULL) {
+    return NULL;
+  }
+  parse_t *parse = in->parse;
+  node_t *copy = node;
+  switch (node->kind) {
+  case NODE_KIND_VARIABLE:
+    for (int i = 0; i < params->size; i++) {
+      if (node != params->data[i]) {
+        continue;
+      }
+      node_t *arg = (node_t *)args->data[i];
+      if (arg->type == node->type || arg->type->kind == TYPE_KIND_ARRAY) {
+        return arg;
+      }
+      return node_new_unary_op(parse, node->type, OP_CAST, arg);
+    }
+    return node;
+  case NODE_KIND_BINARY_OP: {
+    node_t *right = node->op == '.' ? node->right : substitute(in, node->right, params, args);
+    copy = node_new_binary_op(parse, node->type, node->op, substitute(in, node->left, params, args), right);
+    break;
+  }
+  case NODE_KIND_UNARY_OP:
+    copy = node_new_unary_op(parse, node->type, node->op, substitute(in, node->operand, params, args));
+    break;
+  case NODE_KIND_CALL: {
+    vector_t *cargs = vector_new();
+    for (int i = 0; i < node->args->size; i++) {
+      vector_push(cargs, substitute(in, (node_t *)node->args->data[i], params, args));
+    }
+    copy = node_new_call(parse, node->type, substitute(in, node->func, params, args), cargs);
+    break;
+  }
+  case NODE_KIND_IF:
+    copy = node_new_if(parse,
+                       substitute(in, node->cond, params, args),
+                       substitute(in, node->then_body, params, args),
+                       substitute(in, node->else_body, params, args));
+    copy->type = node->type;
+    break;
+  }
+  return copy;
+}
+
+static void try_inline(inliner_t *in, node_t **slot) {
+  node_t *call = *slot;
+  node_t *func = call->func;
+  if (func->kind != NODE_KIND_VARIABLE || !func->global) {
+    return;
+  }
+  candidate_t *c = (candidate_t *)map_get(in->candidates, func->vname);
+  if (c == NULL || c->state == INLINE_VISITING) {
+    return;
+  }
+  if (c->state == INLINE_UNVISITED) {
+    process(in, c);
+  }
+  if (c->expr == NULL || !can_inline(in, c, call->args)) {
+    return;
+  }
+  node_t *node = substitute(in, c->expr, c->func->fargs, call->args);
+  if (node->type != call->type || (call->next != NULL && is_trivial(node))) {
+    node = node_new_unary_op(in->parse, call->type, OP_CAST, node);
+  }
+  node->next = call->next;
+  *slot = node;
+  in->hits++;
+}
+
+static void walk(inliner_t *in, node_t **slot) {
+  for (; *slot; slot = &(*slot)->next) {
+    node_t *node = *slot;
+    switch (node->kind) {
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        walk(in, (node_t **)&node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      walk(in, &node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      walk(in, &node->left);
+      if (node->op != '.') {
+        walk(in, &node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      walk(in, &node->operand);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        walk(in, (node_t **)&node->args->data[i]);
+      }
+      try_inline(in, slot);
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        walk(in, (node_t **)&node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      walk(in, &node->cond);
+      walk(in, &node->then_body);
+      walk(in, &node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      walk(in, &node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      walk(in, &node->linit);
+      walk(in, &node->lcond);
+      walk(in, &node->lstep);
+      walk(in, &node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      walk(in, &node->sexpr);
+      walk(in, &node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      walk(in, &node->cstmt);
+      break;
+    }
+  }
+}
+
+static void process(inliner_t *in, candidate_t *c) {
+  c->state = INLINE_VISITING;
+  vector_t *addressed = in->addressed;
+  in->addressed = vector_new();
+  loop_collect_addressed(in->addressed, c->func->fbody);
+  walk(in, &c->func->fbody);
+  vector_free(in->addressed);
+  in->addressed = addressed;
+  c->state = INLINE_DONE;
+  c->expr = inline_body(c->func);
+  c->side_effects = c->expr != NULL && has_side_effects(c->expr);
+}
+
+void inline_functions(parse_t *parse) {
+  inliner_t in = {0};
+  in.parse = parse;
+  in.candidates = map_new();
+
+  vector_t *stmts = parse->statements;
+  vector_t *candidates = vector_new();
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind != NODE_KIND_FUNCTION) {
+      continue;
+    }
+    candidate_t *c = (candidate_t *)calloc(1, sizeof (candidate_t));
+    c->func = node;
+    vector_push(candidates, c);
+    if (node->fvar->sclass == STORAGE_CLASS_STATIC) {
+      map_add(in.candidates, node->fvar->vname, c);
+    }
+  }
+  for (int i = 0; i < candidates->size; i++) {
+    candidate_t *c = (candidate_t *)candidates->data[i];
+    if (c->state == INLINE_UNVISITED) {
+      process(&in, c);
+    }
+  }
+
+  if (parse->option->stats) {
+    fprintf(stderr, "inline calls %d\n", in.hits);
+  }
+
+  for (int i = 0; i < candidates->size; i++) {
+    free(candidates->data[i]);
+  }
+  vector_free(candidates);
+  map_free(in.candidates);
+}
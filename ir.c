@@ -0,0 +1,737 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Three-address intermediate representation.
+ *
+ * A function is lowered into basic blocks of instructions that read and
+ * write numbered temporaries. Every block ends with exactly one terminator
+ * (jmp, br or ret) and the CFG edges are recorded in preds/succs.
+ * Temporaries are not in SSA form: the result of a conditional expression
+ * is written with mov in each arm. Operations keep the C types of the
+ * AST, so pointer arithmetic is still scaled by the pointee size.
+ *
+ * Each instruction also records which statement it came from, since gen.c
+ * does not evaluate the operands of a statement in IR order.
+ *
+ * The register allocator computes liveness on the IR and -emit-ir dumps
+ * it. Code generation and the optimization passes still work on the AST.
+ */
+
+typedef struct ir_target ir_target_t;
+struct ir_target {
+  node_t *node;
+  ir_block_t *brk;
+  ir_block_t *cont;
+};
+
+typedef struct ir_builder ir_builder_t;
+struct ir_builder {
+  parse_t *parse;
+  ir_func_t *func;
+  ir_block_t *cur;
+  int stmt;
+  vector_t *targets;
+  vector_t *case_nodes;
+  vector_t *case_blocks;
+};
+
+static int lower(ir_builder_t *b, node_t *node);
+static int lower_addr(ir_builder_t *b, node_t *node);
+
+static ir_block_t *block_new(void) {
+  ir_block_t *bb = (ir_block_t *)malloc(sizeof (ir_block_t));
+  bb->id = -1;
+  bb->insts = vector_new();
+  bb->preds = vector_new();
+  bb->succs = vector_new();
+  return bb;
+}
+
+static void block_free(ir_block_t *bb) {
+  while (bb->insts->size > 0) {
+    ir_t *ir = (ir_t *)vector_pop(bb->insts);
+    if (ir->args != NULL) {
+      vector_free(ir->args);
+    }
+    free(ir);
+  }
+  vector_free(bb->insts);
+  vector_free(bb->preds);
+  vector_free(bb->succs);
+  free(bb);
+}
+
+static ir_t *last_inst(ir_block_t *bb) {
+  if (bb->insts->size == 0) {
+    return NULL;
+  }
+  return (ir_t *)bb->insts->data[bb->insts->size - 1];
+}
+
+static bool is_terminated(ir_block_t *bb) {
+  ir_t *ir = last_inst(bb);
+  return ir != NULL && (ir->kind == IR_JMP || ir->kind == IR_BR || ir->kind == IR_RET);
+}
+
+static ir_t *emit(ir_builder_t *b, int kind, type_t *type) {
+  ir_t *ir = (ir_t *)malloc(sizeof (ir_t));
+  ir->kind = kind;
+  ir->op = 0;
+  ir->type = type;
+  ir->dst = -1;
+  ir->src1 = -1;
+  ir->src2 = -1;
+  ir->ival = 0;
+  ir->node = NULL;
+  ir->args = NULL;
+  ir->then_block = NULL;
+  ir->else_block = NULL;
+  ir->stmt = b->stmt;
+  if (is_terminated(b->cur)) {
+    // code after a jump is unreachable, but still gets its own block
+    ir_block_t *bb = block_new();
+    vector_push(b->func->blocks, bb);
+    b->cur = bb;
+  }
+  vector_push(b->cur->insts, ir);
+  return ir;
+}
+
+static int emit_value(ir_builder_t *b, int kind, type_t *type, node_t *node) {
+  ir_t *ir = emit(b, kind, type);
+  ir->dst = b->func->ntemps++;
+  ir->node = node;
+  return ir->dst;
+}
+
+static void emit_jmp(ir_builder_t *b, ir_block_t *bb) {
+  emit(b, IR_JMP, NULL)->then_block = bb;
+}
+
+static void emit_br(ir_builder_t *b, int cond, ir_block_t *then_block, ir_block_t *else_block) {
+  ir_t *ir = emit(b, IR_BR, NULL);
+  ir->src1 = cond;
+  ir->then_block = then_block;
+  ir->else_block = else_block;
+}
+
+static void next_stmt(ir_builder_t *b) {
+  b->stmt = b->func->nstmts++;
+}
+
+static void start_block(ir_builder_t *b, ir_block_t *bb) {
+  if (!is_terminated(b->cur)) {
+    emit_jmp(b, bb);
+  }
+  vector_push(b->func->blocks, bb);
+  b->cur = bb;
+}
+
+static int emit_imm(ir_builder_t *b, type_t *type, long ival) {
+  ir_t *ir = emit(b, IR_IMM, type);
+  ir->dst = b->func->ntemps++;
+  ir->ival = ival;
+  return ir->dst;
+}
+
+static int emit_binop(ir_builder_t *b, type_t *type, int op, int src1, int src2) {
+  ir_t *ir = emit(b, IR_BINOP, type);
+  ir->dst = b->func->ntemps++;
+  ir->op = op;
+  ir->src1 = src1;
+  ir->src2 = src2;
+  return ir->dst;
+}
+
+static void emit_mov(ir_builder_t *b, type_t *type, int dst, int src) {
+  ir_t *ir = emit(b, IR_MOV, type);
+  ir->dst = dst;
+  ir->src1 = src;
+}
+
+static void emit_store(ir_builder_t *b, type_t *type, int addr, int val) {
+  ir_t *ir = emit(b, IR_STORE, type);
+  ir->src1 = addr;
+  ir->src2 = val;
+}
+
+static int emit_offset(ir_builder_t *b, int addr, int offset) {
+  if (offset == 0) {
+    return addr;
+  }
+  int n = emit_imm(b, b->parse->type_long, offset);
+  return emit_binop(b, b->parse->type_voidp, '+', addr, n);
+}
+
+static ir_target_t *find_target(ir_builder_t *b, node_t *node) {
+  for (int i = b->targets->size - 1; i >= 0; i--) {
+    ir_target_t *t = (ir_target_t *)b->targets->data[i];
+    if (t->node == node) {
+      return t;
+    }
+  }
+  errorf("jump target not found");
+}
+
+static void push_target(ir_builder_t *b, node_t *node, ir_block_t *brk, ir_block_t *cont) {
+  ir_target_t *t = (ir_target_t *)malloc(sizeof (ir_target_t));
+  t->node = node;
+  t->brk = brk;
+  t->cont = cont;
+  vector_push(b->targets, t);
+}
+
+static void pop_target(ir_builder_t *b) {
+  free(vector_pop(b->targets));
+}
+
+static bool is_aggregate(type_t *type) {
+  return type->kind == TYPE_KIND_ARRAY || type->kind == TYPE_KIND_STRUCT || type->kind == TYPE_KIND_FUNCTION;
+}
+
+static int load(ir_builder_t *b, type_t *type, int addr) {
+  if (is_aggregate(type)) {
+    return addr;
+  }
+  ir_t *ir = emit(b, IR_LOAD, type);
+  ir->dst = b->func->ntemps++;
+  ir->src1 = addr;
+  return ir->dst;
+}
+
+static void store(ir_builder_t *b, node_t *lhs, int val) {
+  if (lhs->kind == NODE_KIND_VARIABLE) {
+    ir_t *ir = emit(b, IR_ASSIGN, lhs->type);
+    ir->node = lhs;
+    ir->src1 = val;
+    return;
+  }
+  emit_store(b, lhs->type, lower_addr(b, lhs), val);
+}
+
+static int lower_addr(ir_builder_t *b, node_t *node) {
+  if (node->kind == NODE_KIND_VARIABLE) {
+    return emit_value(b, IR_ADDR, node->type, node);
+  } else if (node->kind == NODE_KIND_UNARY_OP && node->op == '*') {
+    return lower(b, node->operand);
+  } else if (node->kind == NODE_KIND_BINARY_OP && node->op == '.') {
+    return emit_offset(b, lower(b, node->left), node->right->voffset);
+  }
+  errorf("lvalue required");
+}
+
+static void lower_init(ir_builder_t *b, type_t *type, node_t *var, node_t *val, int offset) {
+  if (val->kind == NODE_KIND_INIT_LIST) {
+    if (type->kind == TYPE_KIND_ARRAY) {
+      for (int i = 0; i < val->init_list->size; i++) {
+        lower_init(b, type->parent, var, (node_t *)val->init_list->data[i], offset + type->parent->total_size * i);
+      }
+    } else {
+      map_entry_t *e = type->fields->top;
+      for (int i = 0; i < val->init_list->size && e != NULL; i++, e = e->next) {
+        node_t *field = (node_t *)e->val;
+        lower_init(b, field->type, var, (node_t *)val->init_list->data[i], offset + field->voffset);
+      }
+    }
+    return;
+  }
+  if (type->kind == TYPE_KIND_ARRAY && val->kind == NODE_KIND_STRING_LITERAL) {
+    char *p = val->sval->buf;
+    for (int i = 0; i < type->size; i++) {
+      int c = emit_imm(b, b->parse->type_char, i < val->sval->size ? p[i] : '\0');
+      emit_store(b, b->parse->type_char, emit_offset(b, lower_addr(b, var), offset + i), c);
+    }
+    return;
+  }
+  int v = lower(b, val);
+  if (offset == 0 && type == var->type) {
+    store(b, var, v);
+  } else {
+    emit_store(b, type, emit_offset(b, lower_addr(b, var), offset), v);
+  }
+}
+
+static int lower_logical(ir_builder_t *b, node_t *node) {
+  ir_block_t *rhs = block_new(), *end = block_new();
+  int result = emit_imm(b, b->parse->type_int, node->op == OP_ANDAND ? 0 : 1);
+  int l = lower(b, node->left);
+  if (node->op == OP_ANDAND) {
+    emit_br(b, l, rhs, end);
+  } else {
+    emit_br(b, l, end, rhs);
+  }
+  start_block(b, rhs);
+  int r = lower(b, node->right);
+  int zero = emit_imm(b, b->parse->type_int, 0);
+  emit_mov(b, b->parse->type_int, result, emit_binop(b, b->parse->type_int, OP_NE, r, zero));
+  start_block(b, end);
+  return result;
+}
+
+static int lower_binary(ir_builder_t *b, node_t *node) {
+  int op = node->op;
+  if (op == '=') {
+    int v = lower(b, node->right);
+    store(b, node->left, v);
+    return v;
+  } else if (op == '.') {
+    return load(b, node->type, emit_offset(b, lower(b, node->left), node->right->voffset));
+  } else if (op == OP_ANDAND || op == OP_OROR) {
+    return lower_logical(b, node);
+  }
+  int l = lower(b, node->left);
+  int r = lower(b, node->right);
+  int v = emit_binop(b, node->type, op & ~OP_ASSIGN_MASK, l, r);
+  if (op & OP_ASSIGN_MASK) {
+    store(b, node->left, v);
+  }
+  return v;
+}
+
+static int lower_unary(ir_builder_t *b, node_t *node) {
+  switch (node->op) {
+  case OP_INC: case OP_DEC:
+  case OP_PINC: case OP_PDEC: {
+    int v = lower(b, node->operand);
+    int n = emit_imm(b, b->parse->type_int, node->type->kind == TYPE_KIND_PTR ? node->type->parent->bytes : 1);
+    int nv = emit_binop(b, node->type, node->op == OP_INC || node->op == OP_PINC ? '+' : '-', v, n);
+    store(b, node->operand, nv);
+    return node->op == OP_PINC || node->op == OP_PDEC ? v : nv;
+  }
+  case '&':
+    return lower_addr(b, node->operand);
+  case '*':
+    return load(b, node->type, lower(b, node->operand));
+  case OP_CAST: {
+    int v = lower(b, node->operand);
+    ir_t *ir = emit(b, IR_CAST, node->type);
+    ir->dst = b->func->ntemps++;
+    ir->src1 = v;
+    ir->node = node->operand;
+    return ir->dst;
+  }
+  }
+  int v = lower(b, node->operand);
+  ir_t *ir = emit(b, IR_UNOP, node->type);
+  ir->dst = b->func->ntemps++;
+  ir->op = node->op;
+  ir->src1 = v;
+  return ir->dst;
+}
+
+static int lower_call(ir_builder_t *b, node_t *node) {
+  vector_t *args = vector_new();
+  for (int i = 0; i < node->args->size; i++) {
+    vector_push(args, (void *)(intptr_t)lower(b, (node_t *)node->args->data[i]));
+  }
+  int callee = -1;
+  if (node->func->kind == NODE_KIND_UNARY_OP) {
+    callee = lower(b, node->func->operand);
+  }
+  ir_t *ir = emit(b, IR_CALL, node->type);
+  ir->dst = b->func->ntemps++;
+  ir->src1 = callee;
+  ir->node = node->func;
+  ir->args = args;
+  return ir->dst;
+}
+
+static int lower_if(ir_builder_t *b, node_t *node) {
+  ir_block_t *then_block = block_new(), *else_block = NULL, *end = block_new();
+  int result = -1;
+  if (node->type != NULL) {
+    result = b->func->ntemps++;
+  }
+  if (node->else_body != NULL) {
+    else_block = block_new();
+  }
+  emit_br(b, lower(b, node->cond), then_block, else_block != NULL ? else_block : end);
+  start_block(b, then_block);
+  if (result < 0) {
+    next_stmt(b);
+  }
+  int v = lower(b, node->then_body);
+  if (result >= 0) {
+    emit_mov(b, node->type, result, v);
+  }
+  if (else_block != NULL) {
+    emit_jmp(b, end);
+    start_block(b, else_block);
+    if (result < 0) {
+      next_stmt(b);
+    }
+    v = lower(b, node->else_body);
+    if (result >= 0) {
+      emit_mov(b, node->type, result, v);
+    }
+  }
+  start_block(b, end);
+  return result;
+}
+
+static void lower_loop(ir_builder_t *b, node_t *node) {
+  ir_block_t *cond = block_new(), *body = block_new(), *exit = block_new();
+  ir_block_t *cont = cond;
+  if (node->kind == NODE_KIND_FOR) {
+    if (node->linit != NULL) {
+      next_stmt(b);
+      lower(b, node->linit);
+    }
+    if (node->lstep != NULL) {
+      cont = block_new();
+    }
+  }
+  push_target(b, node, exit, cont);
+  if (node->kind == NODE_KIND_DO) {
+    start_block(b, body);
+    next_stmt(b);
+    lower(b, node->lbody);
+    start_block(b, cond);
+    next_stmt(b);
+    emit_br(b, lower(b, node->lcond), body, exit);
+  } else {
+    start_block(b, cond);
+    if (node->lcond != NULL) {
+      next_stmt(b);
+      emit_br(b, lower(b, node->lcond), body, exit);
+    }
+    start_block(b, body);
+    next_stmt(b);
+    lower(b, node->lbody);
+    if (cont != cond) {
+      start_block(b, cont);
+      next_stmt(b);
+      lower(b, node->lstep);
+    }
+    emit_jmp(b, cond);
+  }
+  pop_target(b);
+  start_block(b, exit);
+}
+
+static void lower_switch(ir_builder_t *b, node_t *node) {
+  ir_block_t *exit = block_new();
+  int v = lower(b, node->sexpr);
+  for (int i = 0; i < node->cases->size; i++) {
+    node_t *n = (node_t *)node->cases->data[i];
+    ir_block_t *bb = block_new(), *next = block_new();
+    vector_push(b->case_nodes, n);
+    vector_push(b->case_blocks, bb);
+    int c = emit_imm(b, n->cval->type, n->cval->ival);
+    emit_br(b, emit_binop(b, b->parse->type_int, OP_EQ, v, c), bb, next);
+    start_block(b, next);
+  }
+  if (node->default_case != NULL) {
+    ir_block_t *bb = block_new();
+    vector_push(b->case_nodes, node->default_case);
+    vector_push(b->case_blocks, bb);
+    emit_jmp(b, bb);
+  } else {
+    emit_jmp(b, exit);
+  }
+  push_target(b, node, exit, NULL);
+  next_stmt(b);
+  lower(b, node->sbody);
+  pop_target(b);
+  start_block(b, exit);
+}
+
+static void lower_case(ir_builder_t *b, node_t *node) {
+  for (int i = 0; i < b->case_nodes->size; i++) {
+    if (b->case_nodes->data[i] == node) {
+      start_block(b, (ir_block_t *)b->case_blocks->data[i]);
+      next_stmt(b);
+      lower(b, node->cstmt);
+      return;
+    }
+  }
+  errorf("case label not in switch");
+}
+
+static int lower(ir_builder_t *b, node_t *node) {
+  int v = -1;
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_NOP:
+      v = -1;
+      break;
+    case NODE_KIND_LITERAL:
+      if (type_is_float(node->type)) {
+        v = emit_value(b, IR_FIMM, node->type, node);
+      } else {
+        v = emit_imm(b, node->type, node->ival);
+      }
+      break;
+    case NODE_KIND_STRING_LITERAL:
+    case NODE_KIND_VARIABLE:
+      v = emit_value(b, node->kind == NODE_KIND_VARIABLE ? IR_VAR : IR_STR, node->type, node);
+      break;
+    case NODE_KIND_DECLARATION:
+      if (node->dec_init != NULL) {
+        lower_init(b, node->dec_var->type, node->dec_var, node->dec_init, 0);
+      }
+      v = -1;
+      break;
+    case NODE_KIND_BINARY_OP:
+      v = lower_binary(b, node);
+      break;
+    case NODE_KIND_UNARY_OP:
+      v = lower_unary(b, node);
+      break;
+    case NODE_KIND_CALL:
+      v = lower_call(b, node);
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        next_stmt(b);
+        lower(b, (node_t *)node->statements->data[i]);
+      }
+      v = -1;
+      break;
+    case NODE_KIND_IF:
+      v = lower_if(b, node);
+      break;
+    case NODE_KIND_CONTINUE:
+      emit_jmp(b, find_target(b, node->cscope->parent_node)->cont);
+      v = -1;
+      break;
+    case NODE_KIND_BREAK:
+      emit_jmp(b, find_target(b, node->cscope->parent_node)->brk);
+      v = -1;
+      break;
+    case NODE_KIND_RETURN: {
+      int r = node->retval != NULL ? lower(b, node->retval) : -1;
+      emit(b, IR_RET, node->type)->src1 = r;
+      v = -1;
+      break;
+    }
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      lower_loop(b, node);
+      v = -1;
+      break;
+    case NODE_KIND_SWITCH:
+      lower_switch(b, node);
+      v = -1;
+      break;
+    case NODE_KIND_CASE:
+      lower_case(b, node);
+      v = -1;
+      break;
+    default:
+      errorf("unknown expression node: %d", node->kind);
+    }
+  }
+  return v;
+}
+
+static void add_edge(ir_block_t *from, ir_block_t *to) {
+  vector_push(from->succs, to);
+  vector_push(to->preds, from);
+}
+
+static void build_cfg(ir_func_t *f) {
+  for (int i = 0; i < f->blocks->size; i++) {
+    ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+    bb->id = i;
+    ir_t *ir = last_inst(bb);
+    if (ir->kind == IR_JMP) {
+      add_edge(bb, ir->then_block);
+    } else if (ir->kind == IR_BR) {
+      add_edge(bb, ir->then_block);
+      add_edge(bb, ir->else_block);
+    }
+  }
+}
+
+ir_func_t *ir_lower_function(parse_t *parse, node_t *func) {
+  ir_builder_t b;
+  b.parse = parse;
+  b.func = (ir_func_t *)malloc(sizeof (ir_func_t));
+  b.func->func = func;
+  b.func->blocks = vector_new();
+  b.func->ntemps = 0;
+  b.func->nstmts = 1;
+  b.cur = block_new();
+  b.stmt = 0;
+  b.targets = vector_new();
+  b.case_nodes = vector_new();
+  b.case_blocks = vector_new();
+  vector_push(b.func->blocks, b.cur);
+
+  lower(&b, func->fbody);
+  if (!is_terminated(b.cur)) {
+    emit(&b, IR_RET, NULL);
+  }
+  // blocks that were jumped to but never started, such as the exit of an
+  // infinite loop, are empty and get an explicit return
+  for (int i = 0; i < b.func->blocks->size; i++) {
+    ir_block_t *bb = (ir_block_t *)b.func->blocks->data[i];
+    ir_t *ir = last_inst(bb);
+    if (ir == NULL || (ir->kind != IR_JMP && ir->kind != IR_BR)) {
+      continue;
+    }
+    ir_block_t *targets[] = {ir->then_block, ir->else_block};
+    for (int j = 0; j < 2; j++) {
+      if (targets[j] != NULL && !vector_exists(b.func->blocks, targets[j])) {
+        b.cur = targets[j];
+        vector_push(b.func->blocks, targets[j]);
+        emit(&b, IR_RET, NULL);
+      }
+    }
+  }
+  build_cfg(b.func);
+
+  vector_free(b.targets);
+  vector_free(b.case_nodes);
+  vector_free(b.case_blocks);
+  return b.func;
+}
+
+void ir_free_function(ir_func_t *f) {
+  for (int i = 0; i < f->blocks->size; i++) {
+    block_free((ir_block_t *)f->blocks->data[i]);
+  }
+  vector_free(f->blocks);
+  free(f);
+}
+
+static const char *op_name(int op) {
+  static char buf[2];
+  switch (op) {
+  case OP_SAL:
+    return "<<";
+  case OP_SAR:
+    return ">>";
+  case OP_EQ:
+    return "==";
+  case OP_NE:
+    return "!=";
+  case OP_LE:
+    return "<=";
+  case OP_GE:
+    return ">=";
+  }
+  buf[0] = op;
+  buf[1] = '\0';
+  return buf;
+}
+
+static const char *type_name(type_t *type) {
+  if (type == NULL || type->name == NULL) {
+    return "?";
+  }
+  return type->name;
+}
+
+static void dump_inst(ir_t *ir, FILE *out) {
+  if (ir->dst >= 0 && ir->kind != IR_MOV) {
+    fprintf(out, "t%d = ", ir->dst);
+  }
+  switch (ir->kind) {
+  case IR_IMM:
+    fprintf(out, "%ld", ir->ival);
+    break;
+  case IR_FIMM:
+    fprintf(out, "%f", ir->node->fval);
+    break;
+  case IR_STR:
+    fprintf(out, "\"");
+    string_print_quote(ir->node->sval, out);
+    fprintf(out, "\"");
+    break;
+  case IR_VAR:
+    fprintf(out, "%s", ir->node->vname);
+    break;
+  case IR_ADDR:
+    fprintf(out, "&%s", ir->node->vname);
+    break;
+  case IR_ASSIGN:
+    fprintf(out, "%s = t%d", ir->node->vname, ir->src1);
+    break;
+  case IR_MOV:
+    fprintf(out, "t%d = t%d", ir->dst, ir->src1);
+    break;
+  case IR_LOAD:
+    fprintf(out, "load %s t%d", type_name(ir->type), ir->src1);
+    break;
+  case IR_STORE:
+    fprintf(out, "store %s t%d, t%d", type_name(ir->type), ir->src1, ir->src2);
+    break;
+  case IR_BINOP:
+    fprintf(out, "t%d %s t%d", ir->src1, op_name(ir->op), ir->src2);
+    break;
+  case IR_UNOP:
+    fprintf(out, "%s t%d", op_name(ir->op), ir->src1);
+    break;
+  case IR_CAST:
+    fprintf(out, "cast %s t%d", type_name(ir->type), ir->src1);
+    break;
+  case IR_CALL:
+    if (ir->src1 >= 0) {
+      fprintf(out, "call *t%d(", ir->src1);
+    } else {
+      fprintf(out, "call %s(", ir->node->kind == NODE_KIND_VARIABLE ? ir->node->vname : ir->node->identifier);
+    }
+    for (int i = 0; i < ir->args->size; i++) {
+      fprintf(out, "%st%d", i > 0 ? ", " : "", (int)(intptr_t)ir->args->data[i]);
+    }
+    fprintf(out, ")");
+    break;
+  case IR_JMP:
+    fprintf(out, "jmp bb%d", ir->then_block->id);
+    break;
+  case IR_BR:
+    fprintf(out, "br t%d, bb%d, bb%d", ir->src1, ir->then_block->id, ir->else_block->id);
+    break;
+  case IR_RET:
+    if (ir->src1 >= 0) {
+      fprintf(out, "ret t%d", ir->src1);
+    } else {
+      fprintf(out, "ret");
+    }
+    break;
+  }
+  fprintf(out, "\n");
+}
+
+void ir_dump_function(ir_func_t *f, FILE *out) {
+  fprintf(out, "func %s(", f->func->fvar->vname);
+  for (int i = 0; i < f->func->fargs->size; i++) {
+    node_t *n = (node_t *)f->func->fargs->data[i];
+    fprintf(out, "%s%s %s", i > 0 ? ", " : "", type_name(n->type), n->vname != NULL ? n->vname : "");
+  }
+  fprintf(out, ")\n");
+  for (int i = 0; i < f->blocks->size; i++) {
+    ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+    fprintf(out, "bb%d:", bb->id);
+    if (bb->preds->size > 0) {
+      fprintf(out, " ; preds");
+      for (int j = 0; j < bb->preds->size; j++) {
+        fprintf(out, " bb%d", ((ir_block_t *)bb->preds->data[j])->id);
+      }
+    }
+    fprintf(out, "\n");
+    for (int j = 0; j < bb->insts->size; j++) {
+      fprintf(out, "\t");
+      dump_inst((ir_t *)bb->insts->data[j], out);
+    }
+  }
+}
+
+void ir_dump(parse_t *parse, FILE *out) {
+  for (int i = 0; i < parse->statements->size; i++) {
+    node_t *node = (node_t *)parse->statements->data[i];
+    if (node->kind != NODE_KIND_FUNCTION) {
+      continue;
+    }
+    ir_func_t *f = ir_lower_function(parse, node);
+    ir_dump_function(f, out);
+    ir_free_function(f);
+  }
+}
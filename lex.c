@@ -10,7 +10,7 @@ static lex_t *lex_new_file(file_t *f) {
   lex_t *lex = (lex_t *)malloc(sizeof (lex_t));
   lex->files = vector_new();
   vector_push(lex->files, f);
-  lex->tokens = vector_new();
+  lex->token_arena = arena_new(sizeof (token_t));
   return lex;
 }
 
@@ -27,11 +27,7 @@ void lex_free(lex_t *lex) {
     file_free((file_t *)lex->files->data[i]);
   }
   vector_free(lex->files);
-  while (lex->tokens->size > 0) {
-    token_t *token = (token_t *)vector_pop(lex->tokens);
-    token_free(token);
-  }
-  vector_free(lex->tokens);
+  arena_free(lex->token_arena, (void (*)(void *))token_free);
   free(lex);
 }
 
@@ -217,21 +213,97 @@ static token_t *new_keyword(lex_t *lex, int k) {
   return token;
 }
 
-static token_t *read_identifier(lex_t *lex) {
-  string_t *ident = string_new();
-  for (;;) {
-    char c = lex_get_char(lex);
-    if (isalnum(c) || c == '_') {
-      string_add(ident, c);
-    } else {
-      lex_unget_char(lex, c);
+static int keyword(const char *s, const char *kw, int len, int k) {
+  return memcmp(s, kw, len) == 0 ? k : -1;
+}
+
+/*
+ * Keywords are looked up by length and first character, so a plain
+ * identifier costs at most a couple of memcmp calls.
+ */
+static int find_keyword(const char *s, int len) {
+  switch (len) {
+  case 2:
+    switch (s[0]) {
+    case 'i': return keyword(s, "if", len, TOKEN_KEYWORD_IF);
+    case 'd': return keyword(s, "do", len, TOKEN_KEYWORD_DO);
+    }
+    break;
+  case 3:
+    if (s[0] == 'f') {
+      return keyword(s, "for", len, TOKEN_KEYWORD_FOR);
+    }
+    break;
+  case 4:
+    switch (s[0]) {
+    case 'e':
+      if (s[1] == 'l') {
+        return keyword(s, "else", len, TOKEN_KEYWORD_ELSE);
+      }
+      return keyword(s, "enum", len, TOKEN_KEYWORD_ENUM);
+    case 'c': return keyword(s, "case", len, TOKEN_KEYWORD_CASE);
+    }
+    break;
+  case 5:
+    switch (s[0]) {
+    case 'w': return keyword(s, "while", len, TOKEN_KEYWORD_WHILE);
+    case 'b': return keyword(s, "break", len, TOKEN_KEYWORD_BREAK);
+    case 'u': return keyword(s, "union", len, TOKEN_KEYWORD_UNION);
+    case 'c': return keyword(s, "const", len, TOKEN_KEYWORD_CONST);
+    }
+    break;
+  case 6:
+    switch (s[0]) {
+    case 'r': return keyword(s, "return", len, TOKEN_KEYWORD_RETURN);
+    case 'e': return keyword(s, "extern", len, TOKEN_KEYWORD_EXTERN);
+    case 'i': return keyword(s, "inline", len, TOKEN_KEYWORD_INLINE);
+    case 's':
+      switch (s[2]) {
+      case 'g': return keyword(s, "signed", len, TOKEN_KEYWORD_SIGNED);
+      case 'r': return keyword(s, "struct", len, TOKEN_KEYWORD_STRUCT);
+      case 'z': return keyword(s, "sizeof", len, OP_SIZEOF);
+      case 'i': return keyword(s, "switch", len, TOKEN_KEYWORD_SWITCH);
+      case 'a': return keyword(s, "static", len, TOKEN_KEYWORD_STATIC);
+      }
       break;
     }
+    break;
+  case 7:
+    switch (s[0]) {
+    case 'd': return keyword(s, "default", len, TOKEN_KEYWORD_DEFAULT);
+    case 't': return keyword(s, "typedef", len, TOKEN_KEYWORD_TYPEDEF);
+    }
+    break;
+  case 8:
+    switch (s[0]) {
+    case 'c': return keyword(s, "continue", len, TOKEN_KEYWORD_CONTINUE);
+    case 'u': return keyword(s, "unsigned", len, TOKEN_KEYWORD_UNSIGNED);
+    }
+    break;
+  case 18:
+    return keyword(s, "__builtin_typecode", len, TOKEN_KEYWORD_TYPECODE);
+  case 26:
+    return keyword(s, "__builtin_typecode_compare", len, TOKEN_KEYWORD_TYPECODE_COMPARE);
+  }
+  return -1;
+}
+
+static token_t *read_identifier(lex_t *lex) {
+  // identifiers never span lines, so scan the source buffer directly
+  file_t *f = lex_current_file(lex);
+  char *s = f->p;
+  while (isalnum(*f->p) || *f->p == '_') {
+    f->p++;
+  }
+  int len = f->p - s;
+  assert(len > 0);
+  f->column += len;
+  int k = find_keyword(s, len);
+  if (k >= 0) {
+    return new_keyword(lex, k);
   }
-  assert(ident->size > 0);
   token_t *token = token_new(lex, TOKEN_KIND_IDENTIFIER);
-  token->identifier = strdup(ident->buf);
-  string_free(ident);
+  token->identifier = token->str;
   return token;
 }
 
@@ -312,78 +384,7 @@ retry:
   }
   if (isalpha(c) || c == '_') {
     lex_unget_char(lex, c);
-    token_t *token = read_identifier(lex);
-    assert(token->kind == TOKEN_KIND_IDENTIFIER);
-    if (strcmp("if", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_IF);
-    }
-    if (strcmp("else", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_ELSE);
-    }
-    if (strcmp("return", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_RETURN);
-    }
-    if (strcmp("while", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_WHILE);
-    }
-    if (strcmp("do", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_DO);
-    }
-    if (strcmp("for", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_FOR);
-    }
-    if (strcmp("break", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_BREAK);
-    }
-    if (strcmp("continue", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_CONTINUE);
-    }
-    if (strcmp("signed", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_SIGNED);
-    }
-    if (strcmp("unsigned", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_UNSIGNED);
-    }
-    if (strcmp("struct", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_STRUCT);
-    }
-    if (strcmp("union", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_UNION);
-    }
-    if (strcmp("enum", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_ENUM);
-    }
-    if (strcmp("sizeof", token->identifier) == 0) {
-      return new_keyword(lex, OP_SIZEOF);
-    }
-    if (strcmp("switch", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_SWITCH);
-    }
-    if (strcmp("case", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_CASE);
-    }
-    if (strcmp("default", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_DEFAULT);
-    }
-    if (strcmp("typedef", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_TYPEDEF);
-    }
-    if (strcmp("static", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_STATIC);
-    }
-    if (strcmp("extern", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_EXTERN);
-    }
-    if (strcmp("const", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_CONST);
-    }
-    if (strcmp("__builtin_typecode", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_TYPECODE);
-    }
-    if (strcmp("__builtin_typecode_compare", token->identifier) == 0) {
-      return new_keyword(lex, TOKEN_KEYWORD_TYPECODE_COMPARE);
-    }
-    return token;
+    return read_identifier(lex);
   }
   switch (c) {
   case '+':
@@ -0,0 +1,228 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Loop-invariant code motion.
+ *
+ * Loops are visited innermost first. The maximal subexpressions of the
+ * condition, step and body of a loop that are computed from invariant
+ * values are moved into temporaries declared just in front of the loop,
+ * so they are computed once instead of on every iteration. What counts
+ * as invariant is decided by loop_is_invariant() in loop.c.
+ *
+ * The preheader runs even if the loop body never does, and only once for
+ * subexpressions the loop may evaluate conditionally; this is why
+ * invariant expressions are limited to ones that cannot trap.
+ */
+
+typedef struct hoisted hoisted_t;
+struct hoisted {
+  node_t *expr;
+  node_t *var;
+};
+
+typedef struct licm licm_t;
+struct licm {
+  parse_t *parse;
+  loop_info_t loop;     // side effects of the current loop
+  vector_t *hoisted;    // subexpressions moved out of the current loop
+  int hits;
+};
+
+static void walk(licm_t *lc, node_t **slot);
+
+// Whether node computes something, rather than just naming or converting a value
+static bool is_computation(node_t *node) {
+  switch (node->kind) {
+  case NODE_KIND_BINARY_OP:
+    return true;
+  case NODE_KIND_UNARY_OP:
+    return node->op != OP_CAST || is_computation(node->operand);
+  }
+  return false;
+}
+
+static bool reads_variable(node_t *node) {
+  switch (node->kind) {
+  case NODE_KIND_VARIABLE:
+    return true;
+  case NODE_KIND_BINARY_OP:
+    return reads_variable(node->left) || reads_variable(node->right);
+  case NODE_KIND_UNARY_OP:
+    return reads_variable(node->operand);
+  }
+  return false;
+}
+
+// Replaces *slot with the temporary holding its value
+static void hoist(licm_t *lc, node_t **slot) {
+  node_t *expr = *slot;
+  for (int i = 0; i < lc->hoisted->size; i++) {
+    hoisted_t *h = (hoisted_t *)lc->hoisted->data[i];
+    if (loop_same_expr(h->expr, expr)) {
+      *slot = h->var;
+      return;
+    }
+  }
+  hoisted_t *h = (hoisted_t *)malloc(sizeof (hoisted_t));
+  h->expr = expr;
+  h->var = node_new_variable(lc->parse, expr->type, NULL, STORAGE_CLASS_NONE, false);
+  vector_push(lc->hoisted, h);
+  *slot = h->var;
+}
+
+// Hoists the invariant subexpressions of the statements or expressions at slot
+static void hoist_walk(licm_t *lc, node_t **slot) {
+  for (; *slot; slot = &(*slot)->next) {
+    node_t *node = *slot;
+    if (is_computation(node) && loop_is_scalar(node->type) && loop_is_invariant(&lc->loop, node) &&
+        reads_variable(node)) {
+      hoist(lc, slot);
+      continue;
+    }
+    switch (node->kind) {
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        hoist_walk(lc, (node_t **)&node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      hoist_walk(lc, &node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      hoist_walk(lc, &node->left);
+      if (node->op != '.') {
+        hoist_walk(lc, &node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      hoist_walk(lc, &node->operand);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        hoist_walk(lc, (node_t **)&node->args->data[i]);
+      }
+      if (node->func->kind != NODE_KIND_VARIABLE) {
+        hoist_walk(lc, &node->func);
+      }
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        hoist_walk(lc, (node_t **)&node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      hoist_walk(lc, &node->cond);
+      hoist_walk(lc, &node->then_body);
+      hoist_walk(lc, &node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      hoist_walk(lc, &node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      hoist_walk(lc, &node->linit);
+      hoist_walk(lc, &node->lcond);
+      hoist_walk(lc, &node->lstep);
+      hoist_walk(lc, &node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      hoist_walk(lc, &node->sexpr);
+      hoist_walk(lc, &node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      hoist_walk(lc, &node->cstmt);
+      break;
+    }
+  }
+}
+
+// Optimizes the loop at *slot; returns the slot that now holds the loop
+static node_t **process_loop(licm_t *lc, node_t **slot) {
+  node_t *loop = *slot;
+  walk(lc, &loop->linit);
+  walk(lc, &loop->lcond);
+  walk(lc, &loop->lstep);
+  walk(lc, &loop->lbody);
+  if (loop_has_label(loop->lbody)) {
+    return slot;
+  }
+
+  lc->loop.written = vector_new();
+  lc->loop.calls = false;
+  lc->loop.stores = false;
+  lc->hoisted = vector_new();
+  loop_scan(&lc->loop, loop->linit);
+  loop_scan(&lc->loop, loop->lcond);
+  loop_scan(&lc->loop, loop->lstep);
+  loop_scan(&lc->loop, loop->lbody);
+  hoist_walk(lc, &loop->lcond);
+  hoist_walk(lc, &loop->lstep);
+  hoist_walk(lc, &loop->lbody);
+
+  // the preheader: declarations of the temporaries, chained in front of the loop
+  for (int i = 0; i < lc->hoisted->size; i++) {
+    hoisted_t *h = (hoisted_t *)lc->hoisted->data[i];
+    node_t *dec = node_new_declaration(lc->parse, h->var->type, h->var, h->expr);
+    dec->next = *slot;
+    *slot = dec;
+    slot = &dec->next;
+    lc->hits++;
+    free(h);
+  }
+  vector_free(lc->hoisted);
+  vector_free(lc->loop.written);
+  return slot;
+}
+
+static void walk(licm_t *lc, node_t **slot) {
+  for (; *slot; slot = &(*slot)->next) {
+    node_t *node = *slot;
+    switch (node->kind) {
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        walk(lc, (node_t **)&node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      walk(lc, &node->then_body);
+      walk(lc, &node->else_body);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      slot = process_loop(lc, slot);
+      break;
+    case NODE_KIND_SWITCH:
+      walk(lc, &node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      walk(lc, &node->cstmt);
+      break;
+    }
+  }
+}
+
+void licm(parse_t *parse) {
+  licm_t lc = {0};
+  lc.parse = parse;
+  vector_t *stmts = parse->statements;
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind != NODE_KIND_FUNCTION) {
+      continue;
+    }
+    lc.loop.addressed = vector_new();
+    loop_collect_addressed(lc.loop.addressed, node->fbody);
+    walk(&lc, &node->fbody);
+    vector_free(lc.loop.addressed);
+  }
+
+  if (parse->option->stats) {
+    fprintf(stderr, "licm hoisted %d\n", lc.hits);
+  }
+}
@@ -0,0 +1,283 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Analysis shared by the loop passes.
+ *
+ * loop_scan() collects what a loop may change: the variables it assigns,
+ * and whether it makes calls or stores through pointers. Against that,
+ * loop_is_invariant() tells whether an expression has the same value on
+ * every iteration. A global, static or address-taken variable is only
+ * invariant in a loop without calls and without stores through pointers;
+ * loop_collect_addressed() finds the address-taken locals of a function.
+ *
+ * Invariant expressions may be evaluated before the loop, even when the
+ * loop would never evaluate them, so they must not trap: they are limited
+ * to arithmetic, comparisons and casts, and to integer division by a
+ * constant other than 0 and -1. Loads through pointers are never invariant.
+ */
+
+// Whether a case label inside node can transfer control into it
+bool loop_has_label(node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_CASE:
+      return true;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        if (loop_has_label((node_t *)node->statements->data[i])) {
+          return true;
+        }
+      }
+      break;
+    case NODE_KIND_IF:
+      if (loop_has_label(node->then_body) || loop_has_label(node->else_body)) {
+        return true;
+      }
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      if (loop_has_label(node->lbody)) {
+        return true;
+      }
+      break;
+    }
+  }
+  return false;
+}
+
+// Records a store to target: the variable it names, or a store through a pointer
+static void store(loop_info_t *info, node_t *target) {
+  while (target->kind == NODE_KIND_BINARY_OP && target->op == '.') {
+    target = target->left;
+  }
+  if (target->kind == NODE_KIND_VARIABLE) {
+    vector_push(info->written, target);
+  } else {
+    info->stores = true;
+  }
+}
+
+// Collects the side effects of node, leaving out info->skip
+void loop_scan(loop_info_t *info, node_t *node) {
+  for (; node; node = node->next) {
+    if (node == info->skip) {
+      continue;
+    }
+    switch (node->kind) {
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        loop_scan(info, (node_t *)node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      vector_push(info->written, node->dec_var);
+      loop_scan(info, node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      if (node_is_assign(node)) {
+        store(info, node->left);
+      }
+      loop_scan(info, node->left);
+      if (node->op != '.') {
+        loop_scan(info, node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if (node_is_incdec(node)) {
+        store(info, node->operand);
+      }
+      loop_scan(info, node->operand);
+      break;
+    case NODE_KIND_CALL:
+      info->calls = true;
+      for (int i = 0; i < node->args->size; i++) {
+        loop_scan(info, (node_t *)node->args->data[i]);
+      }
+      loop_scan(info, node->func);
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        loop_scan(info, (node_t *)node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      loop_scan(info, node->cond);
+      loop_scan(info, node->then_body);
+      loop_scan(info, node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      loop_scan(info, node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      loop_scan(info, node->linit);
+      loop_scan(info, node->lcond);
+      loop_scan(info, node->lstep);
+      loop_scan(info, node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      loop_scan(info, node->sexpr);
+      loop_scan(info, node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      loop_scan(info, node->cstmt);
+      break;
+    }
+  }
+}
+
+bool loop_is_scalar(type_t *type) {
+  return type_is_int(type) || type_is_float(type) || type->kind == TYPE_KIND_PTR || type->kind == TYPE_KIND_ENUM;
+}
+
+// Whether var is a local that only assignments by name can change
+bool loop_is_local(loop_info_t *info, node_t *var) {
+  return var->kind == NODE_KIND_VARIABLE && !var->global && var->sclass == STORAGE_CLASS_NONE &&
+         !vector_exists(info->addressed, var);
+}
+
+static bool is_invariant_var(loop_info_t *info, node_t *var) {
+  if (var->type->kind == TYPE_KIND_ARRAY) {
+    // only its address is read
+    return true;
+  }
+  if (var == info->iv || !loop_is_scalar(var->type) || vector_exists(info->written, var)) {
+    return false;
+  }
+  return loop_is_local(info, var) || (!info->calls && !info->stores);
+}
+
+// Whether node has the same value on every iteration and can be evaluated before the loop
+bool loop_is_invariant(loop_info_t *info, node_t *node) {
+  if (node->next != NULL) {
+    return false;
+  }
+  switch (node->kind) {
+  case NODE_KIND_LITERAL:
+  case NODE_KIND_STRING_LITERAL:
+    return true;
+  case NODE_KIND_VARIABLE:
+    return is_invariant_var(info, node);
+  case NODE_KIND_BINARY_OP:
+    if (!loop_is_scalar(node->type)) {
+      return false;
+    }
+    switch (node->op) {
+    case '/':
+    case '%':
+      if (type_is_int(node->type) &&
+          (node->right->kind != NODE_KIND_LITERAL || node->right->ival == 0 || node->right->ival == -1)) {
+        return false;
+      }
+      break;
+    case '+': case '-': case '*': case '&': case '|': case '^':
+    case OP_SAL: case OP_SAR:
+    case OP_EQ: case OP_NE: case '<': case OP_LE: case '>': case OP_GE:
+      break;
+    default:
+      return false;
+    }
+    return loop_is_invariant(info, node->left) && loop_is_invariant(info, node->right);
+  case NODE_KIND_UNARY_OP:
+    if (node->op == '*') {
+      // a row of a multidimensional array: an address, not a load
+      return node->type->kind == TYPE_KIND_ARRAY && loop_is_invariant(info, node->operand);
+    }
+    if (!loop_is_scalar(node->type) || !loop_is_scalar(node->operand->type)) {
+      return false;
+    }
+    if (node->op != '-' && node->op != '~' && node->op != '!' && node->op != OP_CAST) {
+      return false;
+    }
+    return loop_is_invariant(info, node->operand);
+  }
+  return false;
+}
+
+// Whether a and b compute the same value from the same variables
+bool loop_same_expr(node_t *a, node_t *b) {
+  if (a->kind != b->kind || a->type != b->type) {
+    return false;
+  }
+  switch (a->kind) {
+  case NODE_KIND_LITERAL:
+    return type_is_int(a->type) ? a->ival == b->ival : a->fval == b->fval;
+  case NODE_KIND_BINARY_OP:
+    return a->op == b->op && loop_same_expr(a->left, b->left) && loop_same_expr(a->right, b->right);
+  case NODE_KIND_UNARY_OP:
+    return a->op == b->op && loop_same_expr(a->operand, b->operand);
+  }
+  return a == b;
+}
+
+// Collects the variables whose address is taken
+void loop_collect_addressed(vector_t *vars, node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_INIT_LIST:
+      for (int i = 0; i < node->init_list->size; i++) {
+        loop_collect_addressed(vars, (node_t *)node->init_list->data[i]);
+      }
+      break;
+    case NODE_KIND_DECLARATION:
+      loop_collect_addressed(vars, node->dec_init);
+      break;
+    case NODE_KIND_BINARY_OP:
+      loop_collect_addressed(vars, node->left);
+      if (node->op != '.') {
+        loop_collect_addressed(vars, node->right);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      if (node->op == '&') {
+        node_t *n = node->operand;
+        while (n->kind == NODE_KIND_BINARY_OP && n->op == '.') {
+          n = n->left;
+        }
+        if (n->kind == NODE_KIND_VARIABLE) {
+          vector_push(vars, n);
+        }
+      }
+      loop_collect_addressed(vars, node->operand);
+      break;
+    case NODE_KIND_CALL:
+      for (int i = 0; i < node->args->size; i++) {
+        loop_collect_addressed(vars, (node_t *)node->args->data[i]);
+      }
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        loop_collect_addressed(vars, (node_t *)node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      loop_collect_addressed(vars, node->cond);
+      loop_collect_addressed(vars, node->then_body);
+      loop_collect_addressed(vars, node->else_body);
+      break;
+    case NODE_KIND_RETURN:
+      loop_collect_addressed(vars, node->retval);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      loop_collect_addressed(vars, node->linit);
+      loop_collect_addressed(vars, node->lcond);
+      loop_collect_addressed(vars, node->lstep);
+      loop_collect_addressed(vars, node->lbody);
+      break;
+    case NODE_KIND_SWITCH:
+      loop_collect_addressed(vars, node->sexpr);
+      loop_collect_addressed(vars, node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      loop_collect_addressed(vars, node->cstmt);
+      break;
+    }
+  }
+}
@@ -2,19 +2,49 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "hcc.h"
 
 int main(int argc, char **argv) {
   char c;
   int fats = 0;
+  int fir = 0;
   FILE *fp = stdin;
+  option_t option = {0};
 
   while (*++argv != NULL) {
-    if (**argv == '-') {
+    if (strcmp(*argv, "-emit-ir") == 0) {
+      fir = 1;
+    } else if (strcmp(*argv, "-stats") == 0) {
+      option.stats = true;
+    } else if (strcmp(*argv, "-fno-free") == 0) {
+      option.no_free = true;
+    } else if (strcmp(*argv, "-emit-pch") == 0 || strcmp(*argv, "-include-pch") == 0) {
+      if (argv[1] == NULL) {
+        errorf("missing file name after %s", *argv);
+      }
+      if (strcmp(*argv, "-emit-pch") == 0) {
+        option.emit_pch = *++argv;
+      } else {
+        option.include_pch = *++argv;
+      }
+    } else if (**argv == '-') {
       switch (c = *(*argv + 1)) {
       case 'a':
         fats = 1;
         break;
+      case 'c':
+        option.emit_object = true;
+        break;
+      case 'o':
+        if (argv[1] == NULL) {
+          errorf("missing file name after -o");
+        }
+        option.output = *++argv;
+        break;
+      case 'O':
+        option.optimize = atoi(*argv + 2);
+        break;
       default:
         errorf("unknown option %c\n", c);
       }
@@ -23,7 +53,20 @@ int main(int argc, char **argv) {
     }
   }
 
-  parse_t *parse = parse_file(fp);
+  if (option.emit_object && option.output == NULL) {
+    errorf("-c requires an output file given with -o");
+  }
+
+  // the output file is only written once compilation has succeeded, so a
+  // failed run never leaves a truncated object behind
+  FILE *out = stdout;
+  char *buf = NULL;
+  size_t size = 0;
+  if (option.output != NULL) {
+    out = open_memstream(&buf, &size);
+  }
+
+  parse_t *parse = parse_file(fp, &option);
   if (fats) {
     for (int i = 0; i < parse->statements->size; i++) {
       node_t *node = NULL;
@@ -44,10 +87,26 @@ int main(int argc, char **argv) {
       i = j;
       node_debug(node);
     }
+  } else if (option.emit_pch != NULL) {
+    pch_write(parse, option.emit_pch);
+  } else if (fir) {
+    ir_dump(parse, out);
   } else {
-    gen(parse);
+    gen(parse, out);
+  }
+  if (out != stdout) {
+    fclose(out);
+    FILE *fp = fopen(option.output, "wb");
+    if (fp == NULL) {
+      errorf("cannot open %s", option.output);
+    }
+    fwrite(buf, 1, size, fp);
+    fclose(fp);
+    free(buf);
+  }
+  if (!option.no_free) {
+    parse_free(parse);
   }
-  parse_free(parse);
 
   return 0;
 }
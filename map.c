@@ -34,29 +34,9 @@ map_t *map_new() {
   return map_new_with(MAP_MIN_SLOT_SIZE_BIT);
 }
 
-static int map_comp_str(char *str1, char *str2) {
-  if (str1 == str2) {
-    return 0;
-  }
-  if (str1 == 0) {
-    return -1;
-  }
-  if (str2 == 0) {
-    return 1;
-  }
-
-  return strcmp((char *)str1, (char *)str2);
-}
-
+// keys are atoms, so the hash is precomputed and equality is identity
 static int map_calc_str(map_t *map, char *str) {
-  int sum = 0;
-  char *p = (char *)str;
-
-  for (; *p; p++) {
-    sum = (sum << 5) - sum + *p;
-  }
-
-  return sum & (map->slot_size - 1);
+  return atom_hash(str) & (map->slot_size - 1);
 }
 
 map_entry_t *map_find(map_t *map, void *key) {
@@ -65,7 +45,7 @@ map_entry_t *map_find(map_t *map, void *key) {
 
   for (entry = map->slot + i; !MAP_ENTRY_IS_EMPTY(entry); entry = map->slot + i) {
     if (!MAP_ENTRY_IS_DELETE(entry)) {
-      if (map_comp_str(key, entry->key) == 0) {
+      if (key == entry->key) {
         return entry;
       }
     }
@@ -82,7 +62,6 @@ void map_free(map_t *map) {
 }
 
 static void clear_entry(map_t *map, map_entry_t *entry) {
-  free(entry->key);
   if (map->free_val_fn) {
     (*map->free_val_fn)(entry->val);
   }
@@ -162,7 +141,7 @@ void map_add(map_t *map, char *key, void *val) {
   int i = map_calc_str(map, key);
 
   for (entry = map->slot + i; MAP_ENTRY_IS_EXIST(entry); entry = map->slot + i) {
-    if (map_comp_str(key, entry->key) == 0) {
+    if (key == entry->key) {
       if (map->free_val_fn) {
         (*map->free_val_fn)(entry->val);
       }
@@ -171,7 +150,7 @@ void map_add(map_t *map, char *key, void *val) {
     }
     i = MAP_NEXT(map, i);
   }
-  entry->key = strdup(key);
+  entry->key = key;
   entry->val = val;
   map->size++;
   if (MAP_ENTRY_IS_EMPTY(entry)) {
@@ -189,7 +168,6 @@ void map_add(map_t *map, char *key, void *val) {
 }
 
 static void map_delete_entry(map_t *map, map_entry_t *entry) {
-  free(entry->key);
   if (map->free_val_fn) {
     (*map->free_val_fn)(entry->val);
   }
@@ -6,10 +6,9 @@
 #include "hcc.h"
 
 static node_t *node_new(parse_t *parse, int kind) {
-  node_t *node = (node_t *)malloc(sizeof (node_t));
+  node_t *node = (node_t *)arena_alloc(parse->node_arena);
   node->kind = kind;
   node->next = NULL;
-  vector_push(parse->nodes, node);
   return node;
 }
 
@@ -20,7 +19,7 @@ node_t *node_new_nop(parse_t *parse) {
 node_t *node_new_identifier(parse_t *parse, char *identifier) {
   node_t *node = node_new(parse, NODE_KIND_IDENTIFIER);
   node->type = NULL;
-  node->identifier = strdup(identifier);
+  node->identifier = atom_new(identifier);
   return node;
 }
 
@@ -44,17 +43,18 @@ node_t *node_new_string(parse_t *parse, string_t *sval, int sid) {
   int size = sval->size + 1;
   string_t *name = string_new();
   string_appendf(name, "char[%d]", size);
-  map_entry_t *e = map_find(parse->types, name->buf);
+  map_entry_t *e = map_find(parse->types, atom_new(name->buf));
   type_t *type;
   if (e == NULL) {
-    type = type_new_with_size(name->buf, TYPE_KIND_ARRAY, false, parse->type_char, size);
-    map_add(parse->types, name->buf, type);
+    type = type_new_with_size(parse, name->buf, TYPE_KIND_ARRAY, false, parse->type_char, size);
+    map_add(parse->types, type->name, type);
   } else {
     type = (type_t *)e->val;
   }
   node->type = type;
   node->sval = string_dup(sval);
   node->sid = sid;
+  arena_own(parse->node_arena, node);
   string_free(name);
   return node;
 }
@@ -63,6 +63,7 @@ node_t *node_new_init_list(parse_t *parse, type_t *type, vector_t *init) {
   node_t *node = node_new(parse, NODE_KIND_INIT_LIST);
   node->type = type;
   node->init_list = init;
+  arena_own(parse->node_arena, node);
   return node;
 }
 
@@ -70,11 +71,13 @@ node_t *node_new_variable(parse_t *parse, type_t *type, char *vname, int sclass,
   node_t *node = node_new(parse, NODE_KIND_VARIABLE);
   node->type = type;
   if (vname != NULL) {
-    node->vname = strdup(vname);
+    node->vname = atom_new(vname);
   } else {
     node->vname = NULL;
   }
   node->voffset = 0;
+  node->vreg = REG_NONE;
+  node->vconst = NULL;
   node->sclass = sclass;
   node->global = global;
   return node;
@@ -110,6 +113,7 @@ node_t *node_new_call(parse_t *parse, type_t *type, node_t *func, vector_t *args
   node->type = type;
   node->func = func;
   node->args = args;
+  arena_own(parse->node_arena, node);
   return node;
 }
 
@@ -126,11 +130,13 @@ node_t *node_new_block(parse_t *parse, int kind, vector_t *statements, node_t *b
   }
   node->child_blocks = vector_new();
   node->parent_node = NULL;
+  arena_own(parse->node_arena, node);
   return node;
 }
 
 node_t *node_new_if(parse_t *parse, node_t *cond, node_t *then_body, node_t *else_body) {
   node_t *node = node_new(parse, NODE_KIND_IF);
+  node->type = NULL;
   node->cond = cond;
   node->then_body = then_body;
   node->else_body = else_body;
@@ -143,7 +149,9 @@ node_t *node_new_function(parse_t *parse, node_t *fvar, vector_t *fargs, bool is
   node->fvar = fvar;
   node->fargs = fargs;
   node->is_vaargs = is_vaargs;
+  node->is_inline = false;
   node->fbody = fbody;
+  arena_own(parse->node_arena, node);
   return node;
 }
 
@@ -218,6 +226,7 @@ node_t *node_new_switch(parse_t *parse, node_t *expr, node_t *body) {
   node->sbody = body;
   node->cases = vector_new();
   node->default_case = NULL;
+  arena_own(parse->node_arena, node);
   if (body->kind == NODE_KIND_BLOCK) {
     body->parent_node = node;
   }
@@ -255,10 +264,19 @@ node_t *node_new_case(parse_t *parse, node_t *val, node_t *stmt) {
   return node;
 }
 
+bool node_is_assign(node_t *node) {
+  return node->op == '=' || (node->op & OP_ASSIGN_MASK);
+}
+
+bool node_is_incdec(node_t *node) {
+  return node->op == OP_INC || node->op == OP_DEC || node->op == OP_PINC || node->op == OP_PDEC;
+}
+
+// release what a node owns; the node itself lives in parse->node_arena and
+// only nodes registered with arena_own() get here
 void node_free(node_t *node) {
   switch (node->kind) {
   case NODE_KIND_IDENTIFIER:
-    free(node->identifier);
     break;
   case NODE_KIND_LITERAL:
     switch (node->type->kind) {
@@ -275,9 +293,6 @@ void node_free(node_t *node) {
     vector_free(node->init_list);
     break;
   case NODE_KIND_VARIABLE:
-    if (node->vname != NULL) {
-      free(node->vname);
-    }
     break;
   case NODE_KIND_DECLARATION:
     break;
@@ -291,7 +306,6 @@ void node_free(node_t *node) {
   case NODE_KIND_BLOCK:
     vector_free(node->statements);
     map_free(node->vars);
-    node->types->free_val_fn = (void (*)(void *))type_free;
     map_free(node->types);
     map_free(node->tags);
     vector_free(node->child_blocks);
@@ -313,7 +327,6 @@ void node_free(node_t *node) {
   case NODE_KIND_CASE:
     break;
   }
-  free(node);
 }
 
 void node_debug(node_t *node) {
@@ -324,6 +337,9 @@ void node_debug(node_t *node) {
     errorf("identifier node is internal use only");
   case NODE_KIND_LITERAL:
     switch (node->type->kind) {
+      case TYPE_KIND_BOOL:
+      case TYPE_KIND_CHAR:
+      case TYPE_KIND_SHORT:
       case TYPE_KIND_INT:
       case TYPE_KIND_LONG:
       case TYPE_KIND_LLONG:
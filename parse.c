@@ -1,5 +1,6 @@
 // Copyright 2019 @htz. Released under the MIT license.
 
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -210,7 +211,9 @@ static void ensure_assignable(parse_t *parse, node_t *node, type_t *type) {
 
 static node_t *external_declaration(parse_t *parse) {
   int sclass = STORAGE_CLASS_NONE;
+  parse->is_inline = false;
   type_t *type = declaration_specifier(parse, &sclass);
+  bool is_inline = parse->is_inline;
   if (type == NULL) {
     errorf("unknown type name");
   }
@@ -245,6 +248,7 @@ static node_t *external_declaration(parse_t *parse) {
     assert(args != NULL);
     if (cpp_next_keyword_is(parse, '{')) {
       node = function_definition(parse, var, args, is_vaargs);
+      node->is_inline = is_inline;
       vector_free(args);
       return node;
     }
@@ -412,6 +416,12 @@ static type_t *declaration_specifier(parse_t *parse, int *sclassp) {
         }
         *sclassp = STORAGE_CLASS_EXTERN;
         continue;
+      } else if (token->keyword == TOKEN_KEYWORD_INLINE) {
+        if (sclassp == NULL) {
+          errorf("expected expression");
+        }
+        parse->is_inline = true;
+        continue;
       } else if (token->keyword == TOKEN_KEYWORD_CONST) {
         if (is_const) {
           warnf("duplicate 'const' declaration specifier");
@@ -482,14 +492,14 @@ type_t *parse_make_empty_struct_type(parse_t *parse, char *tag, bool is_struct)
 }
 
 static type_t *make_empty_struct_type(parse_t *parse, char *tag, bool is_struct) {
-  type_t *type = type_new_struct(NULL, is_struct);
+  type_t *type = type_new_struct(parse, NULL, is_struct);
   string_t *name = string_new_with(is_struct ? "struct " : "union ");
   if (tag != NULL) {
     string_append(name, tag);
   } else {
     string_appendf(name, "$%p", type);
   }
-  type->name = strdup(name->buf);
+  type->name = atom_new(name->buf);
   string_free(name);
 
   type_add(parse, type->name, type);
@@ -592,7 +602,7 @@ static void struct_declarator(parse_t *parse, type_t *type, type_t *field_type)
   } else if (type->total_size < field_type->total_size) {
     type->total_size = field_type->total_size;
   }
-  map_add(type->fields, name, node);
+  map_add(type->fields, node->vname, node);
   if (type->align < field_type->align) {
     type->align = field_type->align;
   }
@@ -668,6 +678,10 @@ static type_t *direct_declarator_tail(parse_t *parse, type_t *type, vector_t **a
       if (sclass == STORAGE_CLASS_TYPEDEF || sclass == STORAGE_CLASS_STATIC || sclass == STORAGE_CLASS_EXTERN) {
         errorf("invalid storage class specifier in function declarator");
       }
+      if (t->kind == TYPE_KIND_ARRAY) {
+        // an array parameter is adjusted to a pointer to its element type
+        t = type_get_ptr(parse, t->parent);
+      }
       vector_push(args, name);
       vector_push(argtypes, t);
     }
@@ -704,12 +718,11 @@ static type_t *join_stub_type(parse_t *parse, type_t *base, type_t *stub) {
 
 static type_t *direct_declarator(parse_t *parse, type_t *type, char **namep, vector_t **argsp, bool *ellipsisp) {
   if (cpp_next_keyword_is(parse, '(')) {
-    type_t *stub = type_new_stub();
+    type_t *stub = type_new_stub(parse);
     type_t *tmp = declarator(parse, stub, namep, argsp, ellipsisp);
     cpp_expect_keyword_is(parse, ')');
     type = direct_declarator_tail(parse, type, argsp, ellipsisp);
     type = join_stub_type(parse, type, tmp);
-    type_free(stub);
     return type;
   }
 
@@ -906,6 +919,320 @@ static node_t *constant_expression(parse_t *parse) {
   return node;
 }
 
+/*
+ * Folding of runtime expressions.
+ *
+ * Operators are folded as they are built, so a subtree whose operands are
+ * all known ends up as a single literal. Operands may be literals, casts of
+ * literals, or const-qualified scalars with a literal initializer. Anything
+ * whose value would depend on behavior the target defines differently from
+ * the host (division by zero, out of range shifts, unsigned 64-bit compares)
+ * is left for gen.c.
+ */
+
+static long wrap_int(type_t *type, long v) {
+  if (type->kind == TYPE_KIND_BOOL) {
+    return v != 0;
+  }
+  switch (type->bytes) {
+  case 1:
+    return type->sign ? (long)(signed char)v : (long)(unsigned char)v;
+  case 2:
+    return type->sign ? (long)(short)v : (long)(unsigned short)v;
+  case 4:
+    return type->sign ? (long)(int)v : (long)(unsigned int)v;
+  }
+  return v;
+}
+
+static bool is_foldable_type(type_t *type) {
+  return type_is_int(type) || type->kind == TYPE_KIND_FLOAT || type->kind == TYPE_KIND_DOUBLE;
+}
+
+static node_t *fold_cast(parse_t *parse, type_t *type, node_t *val) {
+  if (!is_foldable_type(type)) {
+    return NULL;
+  }
+  if (type_is_int(type)) {
+    if (type_is_int(val->type)) {
+      return node_new_int(parse, type, wrap_int(type, val->ival));
+    }
+    if (type->kind == TYPE_KIND_BOOL) {
+      return node_new_int(parse, type, val->fval != 0);
+    }
+    if (!(val->fval > -9223372036854775808.0 && val->fval < 9223372036854775808.0)) {
+      return NULL;
+    }
+    return node_new_int(parse, type, wrap_int(type, (long)val->fval));
+  }
+  double v;
+  if (type_is_float(val->type)) {
+    v = val->fval;
+  } else if (type->kind == TYPE_KIND_FLOAT) {
+    v = val->type->sign ? (float)val->ival : (float)(unsigned long)val->ival;
+  } else {
+    v = val->type->sign ? (double)val->ival : (double)(unsigned long)val->ival;
+  }
+  if (type->kind == TYPE_KIND_FLOAT) {
+    v = (float)v;
+  }
+  return node_new_float(parse, type, v, -1);
+}
+
+// Returns the known value of node, or NULL
+static node_t *fold_operand(parse_t *parse, node_t *node) {
+  switch (node->kind) {
+  case NODE_KIND_LITERAL:
+    return is_foldable_type(node->type) ? node : NULL;
+  case NODE_KIND_VARIABLE:
+    return node->vconst;
+  case NODE_KIND_UNARY_OP:
+    if (node->op == OP_CAST) {
+      node_t *val = fold_operand(parse, node->operand);
+      return val != NULL ? fold_cast(parse, node->type, val) : NULL;
+    }
+    break;
+  }
+  return NULL;
+}
+
+// Turns a value computed here into a node that gen.c can emit
+static node_t *fold_result(parse_t *parse, node_t *val) {
+  if (type_is_float(val->type) && parse->current_function) {
+    val->fid = parse->data->size;
+    vector_push(parse->data, val);
+  }
+  return val;
+}
+
+static bool is_int_literal(node_t *node, long v) {
+  return node != NULL && type_is_int(node->type) && node->ival == v;
+}
+
+// p + c1 + c2 => p + (c1 + c2)
+static node_t *fold_pointer_offset(parse_t *parse, node_t *node, node_t *right) {
+  node_t *left = node->left;
+  if (left->kind != NODE_KIND_BINARY_OP || (left->op != '+' && left->op != '-') ||
+      left->type != node->type || left->right->kind != NODE_KIND_LITERAL ||
+      !type_is_int(left->right->type)) {
+    return node;
+  }
+  long offset = left->op == '+' ? left->right->ival : -left->right->ival;
+  offset += node->op == '+' ? right->ival : -right->ival;
+  node_t *val = node_new_int(parse, parse->type_long, offset);
+  node_t *base = left->left;
+  if (offset == 0 && base->type == node->type) {
+    return base;
+  }
+  return node_new_binary_op(parse, node->type, '+', base, val);
+}
+
+// Binary operators where only one side is known
+static node_t *fold_identity(parse_t *parse, node_t *node, node_t *left, node_t *right) {
+  switch (node->op) {
+  case OP_ANDAND:
+    if (left != NULL && (type_is_int(left->type) ? left->ival == 0 : left->fval == 0)) {
+      return node_new_int(parse, node->type, 0);
+    }
+    return node;
+  case OP_OROR:
+    if (left != NULL && (type_is_int(left->type) ? left->ival != 0 : left->fval != 0)) {
+      return node_new_int(parse, node->type, 1);
+    }
+    return node;
+  }
+  if (node->type->kind == TYPE_KIND_PTR && right != NULL && type_is_int(right->type) &&
+      (node->op == '+' || node->op == '-')) {
+    return fold_pointer_offset(parse, node, right);
+  }
+  if (!type_is_int(node->type)) {
+    return node;
+  }
+  node_t *other = left == NULL ? node->left : node->right;
+  node_t *val = left == NULL ? right : left;
+  if (other->type != node->type) {
+    return node;
+  }
+  switch (node->op) {
+  case '*':
+    if (is_int_literal(val, 1)) {
+      return other;
+    }
+    if (is_int_literal(val, 0) && other->kind == NODE_KIND_VARIABLE) {
+      return node_new_int(parse, node->type, 0);
+    }
+    break;
+  case '+':
+  case '|':
+  case '^':
+    if (is_int_literal(val, 0)) {
+      return other;
+    }
+    break;
+  case '-':
+  case OP_SAL:
+  case OP_SAR:
+    if (right != NULL && is_int_literal(val, 0)) {
+      return other;
+    }
+    break;
+  case '/':
+    if (right != NULL && is_int_literal(val, 1)) {
+      return other;
+    }
+    break;
+  }
+  return node;
+}
+
+static node_t *fold_binary_int(parse_t *parse, node_t *node, node_t *left, node_t *right) {
+  int op = node->op;
+  type_t *type = node->type;
+  switch (op) {
+  case OP_ANDAND:
+  case OP_OROR:
+    return eval_constant_binary_expression_int(parse, op, left, right);
+  case OP_EQ: case OP_NE:
+  case '<': case OP_LE: case '>': case OP_GE:
+    type = op_result(parse, op, left->type, right->type);
+    break;
+  case '&': case '|': case '^':
+    type = op_result(parse, op, left->type, right->type);
+    if (type->bytes > node->type->bytes) {
+      return node;
+    }
+    break;
+  case OP_SAL: case OP_SAR:
+    if (right->ival < 0 || right->ival >= type->bytes * 8) {
+      return node;
+    }
+    right = node_new_int(parse, parse->type_long, right->ival);
+    break;
+  case '+': case '-': case '*': case '/': case '%':
+    break;
+  default:
+    return node;
+  }
+  // gen.c does not promote, so narrow results are not truncated there
+  if (node->type->kind != TYPE_KIND_BOOL && node->type->bytes < 4) {
+    return node;
+  }
+  left = node_new_int(parse, type, wrap_int(type, left->ival));
+  if (op != OP_SAL && op != OP_SAR) {
+    right = node_new_int(parse, type, wrap_int(type, right->ival));
+  }
+  if (!type->sign && type->bytes == 8 && op != OP_EQ && op != OP_NE &&
+      op != '+' && op != '-' && op != '*' && op != OP_SAL &&
+      op != '&' && op != '|' && op != '^') {
+    return node;
+  }
+  if ((op == '/' || op == '%') && (right->ival == 0 || (left->ival == LONG_MIN && right->ival == -1))) {
+    return node;
+  }
+  node_t *val = eval_constant_binary_expression_int(parse, op, left, right);
+  val->ival = wrap_int(node->type, val->ival);
+  val->type = node->type;
+  return val;
+}
+
+static node_t *fold_binary_float(parse_t *parse, node_t *node, node_t *left, node_t *right) {
+  int op = node->op;
+  type_t *type = node->type;
+  switch (op) {
+  case OP_ANDAND:
+  case OP_OROR:
+    return eval_constant_binary_expression_float(parse, op, left, right);
+  case OP_EQ: case OP_NE:
+  case '<': case OP_LE: case '>': case OP_GE:
+    type = parse->type_float;
+    if (left->type->kind == TYPE_KIND_DOUBLE || right->type->kind == TYPE_KIND_DOUBLE) {
+      type = parse->type_double;
+    }
+    break;
+  case '+': case '-': case '*': case '/':
+    if (!type_is_float(type)) {
+      return node;
+    }
+    break;
+  default:
+    return node;
+  }
+  left = fold_cast(parse, type, left);
+  right = fold_cast(parse, type, right);
+  node_t *val = eval_constant_binary_expression_float(parse, op, left, right);
+  if (type_is_float(val->type)) {
+    if (node->type->kind == TYPE_KIND_FLOAT) {
+      val->fval = (float)val->fval;
+    }
+    val->type = node->type;
+    return fold_result(parse, val);
+  }
+  val->type = node->type;
+  return val;
+}
+
+static node_t *fold_binary_op(parse_t *parse, node_t *node) {
+  node_t *left = fold_operand(parse, node->left);
+  node_t *right = fold_operand(parse, node->right);
+  if (left == NULL || right == NULL) {
+    if (left == NULL && right == NULL) {
+      return node;
+    }
+    return fold_identity(parse, node, left, right);
+  }
+  if (!is_foldable_type(node->type)) {
+    return node;
+  }
+  if (type_is_float(left->type) || type_is_float(right->type)) {
+    return fold_binary_float(parse, node, left, right);
+  }
+  return fold_binary_int(parse, node, left, right);
+}
+
+static node_t *fold_unary_op(parse_t *parse, node_t *node) {
+  node_t *val = fold_operand(parse, node->operand);
+  if (val == NULL || !is_foldable_type(node->type)) {
+    return node;
+  }
+  if (node->op == '!') {
+    bool v = type_is_int(val->type) ? val->ival == 0 : val->fval == 0;
+    return node_new_int(parse, parse->type_int, v);
+  }
+  if (type_is_int(node->type) && node->type->bytes < 4) {
+    return node;
+  }
+  val = fold_cast(parse, node->type, val);
+  if (val == NULL) {
+    return node;
+  }
+  switch (node->op) {
+  case '+':
+    break;
+  case '-':
+    if (type_is_int(val->type)) {
+      val->ival = wrap_int(val->type, -val->ival);
+    } else {
+      val->fval = -val->fval;
+    }
+    break;
+  case '~':
+    if (!type_is_int(val->type)) {
+      return node;
+    }
+    val->ival = wrap_int(val->type, ~val->ival);
+    break;
+  default:
+    return node;
+  }
+  node_t *literal = node->operand;
+  if (type_is_float(val->type) && literal->kind == NODE_KIND_LITERAL && literal->type == val->type) {
+    // the literal already has its slot in the data section
+    literal->fval = val->fval;
+    return literal;
+  }
+  return fold_result(parse, val);
+}
+
 static node_t *conditional_expression(parse_t *parse) {
   node_t *node = logical_or_expression(parse);
   if (cpp_next_keyword_is(parse, '?')) {
@@ -928,7 +1255,7 @@ static node_t *logical_or_expression(parse_t *parse) {
       break;
     }
     node_t *right = logical_and_expression(parse);
-    node = node_new_binary_op(parse, parse->type_bool, OP_OROR, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_bool, OP_OROR, node, right));
   }
   return node;
 }
@@ -940,7 +1267,7 @@ static node_t *logical_and_expression(parse_t *parse) {
       break;
     }
     node_t *right = inclusive_or_expression(parse);
-    node = node_new_binary_op(parse, parse->type_bool, OP_ANDAND, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_bool, OP_ANDAND, node, right));
   }
   return node;
 }
@@ -955,7 +1282,7 @@ static node_t *inclusive_or_expression(parse_t *parse) {
     if (!type_is_int(node->type) || !type_is_int(right->type)) {
       errorf("invalid operands to binary expression ('%s' and '%s')", node->type->name, right->type->name);
     }
-    node = node_new_binary_op(parse, parse->type_int, '|', node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_int, '|', node, right));
   }
   return node;
 }
@@ -970,7 +1297,7 @@ static node_t *exclusive_or_expression(parse_t *parse) {
     if (!type_is_int(node->type) || !type_is_int(right->type)) {
       errorf("invalid operands to binary expression ('%s' and '%s')", node->type->name, right->type->name);
     }
-    node = node_new_binary_op(parse, parse->type_int, '^', node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_int, '^', node, right));
   }
   return node;
 }
@@ -985,7 +1312,7 @@ static node_t *and_expression(parse_t *parse) {
     if (!type_is_int(node->type) || !type_is_int(right->type)) {
       errorf("invalid operands to binary expression ('%s' and '%s')", node->type->name, right->type->name);
     }
-    node = node_new_binary_op(parse, parse->type_int, '&', node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_int, '&', node, right));
   }
   return node;
 }
@@ -1002,7 +1329,7 @@ static node_t *equality_expression(parse_t *parse) {
       break;
     }
     node_t *right = relational_expression(parse);
-    node = node_new_binary_op(parse, parse->type_bool, op, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_bool, op, node, right));
   }
   return node;
 }
@@ -1023,7 +1350,7 @@ static node_t *relational_expression(parse_t *parse) {
       break;
     }
     node_t *right = shift_expression(parse);
-    node = node_new_binary_op(parse, parse->type_bool, op, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, parse->type_bool, op, node, right));
   }
   return node;
 }
@@ -1043,7 +1370,7 @@ static node_t *shift_expression(parse_t *parse) {
     if (!type_is_int(node->type) || !type_is_int(right->type)) {
       errorf("invalid operands to binary expression ('%s' and '%s')", node->type->name, right->type->name);
     }
-    node = node_new_binary_op(parse, node->type, op, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, node->type, op, node, right));
   }
   return node;
 }
@@ -1069,7 +1396,7 @@ static node_t *additive_expression(parse_t *parse) {
       node = right;
       right = tmp;
     }
-    node = node_new_binary_op(parse, type, op, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, type, op, node, right));
   }
   return node;
 }
@@ -1089,7 +1416,7 @@ static node_t *multiplicative_expression(parse_t *parse) {
     }
     node_t *right = cast_expression(parse);
     type_t *type = op_result(parse, op, node->type, right->type);
-    node = node_new_binary_op(parse, type, op, node, right);
+    node = fold_binary_op(parse, node_new_binary_op(parse, type, op, node, right));
   }
   return node;
 }
@@ -1137,31 +1464,16 @@ static node_t *unary_expression(parse_t *parse) {
     }
   } else if (cpp_next_keyword_is(parse, '+')) {
     node_t *node = cast_expression(parse);
-    if (node->kind == NODE_KIND_LITERAL && node->type->kind == TYPE_KIND_INT) {
-      return node;
-    }
-    return node_new_unary_op(parse, node->type, '+', node);
+    return fold_unary_op(parse, node_new_unary_op(parse, node->type, '+', node));
   } else if (cpp_next_keyword_is(parse, '-')) {
     node_t *node = cast_expression(parse);
-    if (node->kind == NODE_KIND_LITERAL && node->type->kind == TYPE_KIND_INT) {
-      node->ival *= -1;
-      return node;
-    }
-    return node_new_unary_op(parse, node->type, '-', node);
+    return fold_unary_op(parse, node_new_unary_op(parse, node->type, '-', node));
   } else if (cpp_next_keyword_is(parse, '~')) {
     node_t *node = cast_expression(parse);
-    if (node->kind == NODE_KIND_LITERAL && node->type->kind == TYPE_KIND_INT) {
-      node->ival = ~node->ival;
-      return node;
-    }
-    return node_new_unary_op(parse, node->type, '~', node);
+    return fold_unary_op(parse, node_new_unary_op(parse, node->type, '~', node));
   } else if (cpp_next_keyword_is(parse, '!')) {
     node_t *node = cast_expression(parse);
-    if (node->kind == NODE_KIND_LITERAL && node->type->kind == TYPE_KIND_INT) {
-      node->ival = !node->ival;
-      return node;
-    }
-    return node_new_unary_op(parse, node->type, '!', node);
+    return fold_unary_op(parse, node_new_unary_op(parse, node->type, '!', node));
   } else if (cpp_next_keyword_is(parse, '*')) {
     node_t *node = cast_expression(parse);
     if (node->type->parent == NULL) {
@@ -1466,14 +1778,14 @@ static type_t *abstract_declarator(parse_t *parse, type_t *type) {
 }
 
 static type_t *make_empty_enum_type(parse_t *parse, token_t *tag) {
-  type_t *type = type_new_enum(NULL);
+  type_t *type = type_new_enum(parse, NULL);
   string_t *name = string_new_with("enum ");
   if (tag != NULL) {
     string_append(name, tag->identifier);
   } else {
     string_appendf(name, "$%p", type);
   }
-  type->name = strdup(name->buf);
+  type->name = atom_new(name->buf);
   string_free(name);
 
   type_add(parse, type->name, type);
@@ -1579,6 +1891,12 @@ static node_t *init_declarator(parse_t *parse, node_t *var) {
       var->type = type_make_array(parse, var->type->parent, init->init_list->size);
     }
   }
+  if (init != NULL && var->type->is_const) {
+    node_t *val = fold_operand(parse, init);
+    if (val != NULL) {
+      var->vconst = fold_cast(parse, var->type, val);
+    }
+  }
   add_var(parse, var);
   return node_new_declaration(parse, var->type, var, init);
 }
@@ -1854,52 +2172,56 @@ static node_t *jump_statement(parse_t *parse, int keyword) {
   return node_new_return(parse, parse->current_function->type, exp);
 }
 
-static parse_t *parse_new(FILE *fp) {
+static parse_t *parse_new(FILE *fp, option_t *option) {
   parse_t *parse = (parse_t *)malloc(sizeof (parse_t));
+  parse->option = option;
   parse->lex = lex_new(fp);
+  error_set_lex(parse->lex);
   parse->data = vector_new();
   parse->statements = vector_new();
-  parse->nodes = vector_new();
+  parse->node_arena = arena_new(sizeof (node_t));
+  parse->type_arena = arena_new(sizeof (type_t));
   parse->vars = map_new();
   parse->types = map_new();
   parse->tags = map_new();
   parse->macros = map_new();
   parse->current_scope = NULL;
   parse->next_scope = NULL;
+  parse->is_inline = false;
 
-  parse->type_void = type_new("void", TYPE_KIND_VOID, false, NULL);
+  parse->type_void = type_new(parse, "void", TYPE_KIND_VOID, false, NULL);
   map_add(parse->types, parse->type_void->name, parse->type_void);
-  parse->type_voidp = type_new("void*", TYPE_KIND_PTR, false, parse->type_void);
+  parse->type_voidp = type_new(parse, "void*", TYPE_KIND_PTR, false, parse->type_void);
   map_add(parse->types, parse->type_voidp->name, parse->type_voidp);
-  parse->type_bool = type_new("_Bool", TYPE_KIND_BOOL, true, NULL);
+  parse->type_bool = type_new(parse, "_Bool", TYPE_KIND_BOOL, true, NULL);
   type_add(parse, parse->type_bool->name, parse->type_bool);
-  parse->type_char = type_new("char", TYPE_KIND_CHAR, true, NULL);
+  parse->type_char = type_new(parse, "char", TYPE_KIND_CHAR, true, NULL);
   type_add(parse, parse->type_char->name, parse->type_char);
-  parse->type_schar = type_new("signed char", TYPE_KIND_CHAR, true, NULL);
+  parse->type_schar = type_new(parse, "signed char", TYPE_KIND_CHAR, true, NULL);
   type_add(parse, parse->type_schar->name, parse->type_schar);
-  parse->type_uchar = type_new("unsigned char", TYPE_KIND_CHAR, false, NULL);
+  parse->type_uchar = type_new(parse, "unsigned char", TYPE_KIND_CHAR, false, NULL);
   type_add(parse, parse->type_uchar->name, parse->type_uchar);
-  parse->type_short = type_new("short", TYPE_KIND_SHORT, true, NULL);
+  parse->type_short = type_new(parse, "short", TYPE_KIND_SHORT, true, NULL);
   type_add(parse, parse->type_short->name, parse->type_short);
-  parse->type_ushort = type_new("unsigned short", TYPE_KIND_SHORT, false, NULL);
+  parse->type_ushort = type_new(parse, "unsigned short", TYPE_KIND_SHORT, false, NULL);
   type_add(parse, parse->type_ushort->name, parse->type_ushort);
-  parse->type_int = type_new("int", TYPE_KIND_INT, true, NULL);
+  parse->type_int = type_new(parse, "int", TYPE_KIND_INT, true, NULL);
   type_add(parse, parse->type_int->name, parse->type_int);
-  parse->type_uint = type_new("unsigned int", TYPE_KIND_INT, false, NULL);
+  parse->type_uint = type_new(parse, "unsigned int", TYPE_KIND_INT, false, NULL);
   type_add(parse, parse->type_uint->name, parse->type_uint);
-  parse->type_long = type_new("long", TYPE_KIND_LONG, true, NULL);
+  parse->type_long = type_new(parse, "long", TYPE_KIND_LONG, true, NULL);
   type_add(parse, parse->type_long->name, parse->type_long);
-  parse->type_ulong = type_new("unsigned long", TYPE_KIND_LONG, false, NULL);
+  parse->type_ulong = type_new(parse, "unsigned long", TYPE_KIND_LONG, false, NULL);
   type_add(parse, parse->type_ulong->name, parse->type_ulong);
-  parse->type_llong = type_new("long long", TYPE_KIND_LLONG, true, NULL);
+  parse->type_llong = type_new(parse, "long long", TYPE_KIND_LLONG, true, NULL);
   type_add(parse, parse->type_llong->name, parse->type_llong);
-  parse->type_ullong = type_new("unsigned long long", TYPE_KIND_LLONG, false, NULL);
+  parse->type_ullong = type_new(parse, "unsigned long long", TYPE_KIND_LLONG, false, NULL);
   type_add(parse, parse->type_ullong->name, parse->type_ullong);
-  parse->type_float = type_new("float", TYPE_KIND_FLOAT, false, NULL);
+  parse->type_float = type_new(parse, "float", TYPE_KIND_FLOAT, false, NULL);
   type_add(parse, parse->type_float->name, parse->type_float);
-  parse->type_double = type_new("double", TYPE_KIND_DOUBLE, false, NULL);
+  parse->type_double = type_new(parse, "double", TYPE_KIND_DOUBLE, false, NULL);
   type_add(parse, parse->type_double->name, parse->type_double);
-  parse->type_ldouble = type_new("long double", TYPE_KIND_LDOUBLE, false, NULL);
+  parse->type_ldouble = type_new(parse, "long double", TYPE_KIND_LDOUBLE, false, NULL);
   type_add(parse, parse->type_ldouble->name, parse->type_ldouble);
 
   builtin_init(parse);
@@ -1911,32 +2233,39 @@ static parse_t *parse_new(FILE *fp) {
   vector_push(parse->include_path, "/usr/lib/gcc/x86_64-linux-gnu/7/include");
   vector_push(parse->include_path, "/usr/include/x86_64-linux-gnu");
   vector_push(parse->include_path, "/usr/include/linux");
+  parse->include_probes = map_new();
+  parse->include_guards = map_new();
+  parse->include_guards->free_val_fn = free;
 
-  parse_include(parse, BUILD_DIR "/include/hcc.h");
+  if (option->include_pch != NULL) {
+    pch_read(parse, option->include_pch);
+  } else {
+    parse_include(parse, BUILD_DIR "/include/hcc.h");
+  }
 
   return parse;
 }
 
 void parse_free(parse_t *parse) {
+  error_set_lex(NULL);
   lex_free(parse->lex);
   vector_free(parse->data);
   vector_free(parse->statements);
-  for (int i = 0; i < parse->nodes->size; i++) {
-    node_free((node_t *)parse->nodes->data[i]);
-  }
-  vector_free(parse->nodes);
+  arena_free(parse->node_arena, (void (*)(void *))node_free);
   map_free(parse->vars);
-  parse->types->free_val_fn = (void (*)(void *))type_free;
   map_free(parse->types);
   map_free(parse->tags);
   parse->macros->free_val_fn = (void (*)(void *))macro_free;
   map_free(parse->macros);
   vector_free(parse->include_path);
+  map_free(parse->include_probes);
+  map_free(parse->include_guards);
+  arena_free(parse->type_arena, (void (*)(void *))type_free);
   free(parse);
 }
 
-parse_t *parse_file(FILE *fp) {
-  parse_t *parse = parse_new(fp);
+parse_t *parse_file(FILE *fp, option_t *option) {
+  parse_t *parse = parse_new(fp, option);
   for (;;) {
     if (cpp_next_token_is(parse, TOKEN_KIND_EOF)) {
       break;
@@ -0,0 +1,592 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hcc.h"
+
+/*
+ * Precompiled headers.
+ *
+ * `hcc -emit-pch FILE` parses a header prefix from stdin and serializes the
+ * resulting parse->macros, types, tags, vars and include guards. `hcc
+ * -include-pch FILE` maps that image and rebuilds the same state in place
+ * of including include/hcc.h. Pointers are written as indices into the
+ * type, node, field-map and argtype tables; every integer is a 64-bit word.
+ *
+ * Types whose name is already registered by parse_new (the builtin types)
+ * are reused instead of being duplicated.
+ */
+
+#define PCH_MAGIC "HCCPCH02"
+
+typedef struct pch_writer pch_writer_t;
+struct pch_writer {
+  FILE *fp;
+  vector_t *types;
+  vector_t *nodes;
+  vector_t *fields;
+  vector_t *argtypes;
+};
+
+typedef struct pch_reader pch_reader_t;
+struct pch_reader {
+  parse_t *parse;
+  char *p;
+  char *end;
+  type_t **types;
+  node_t **nodes;
+  map_t **fields;
+  vector_t **argtypes;
+};
+
+static int index_of(vector_t *vec, void *p) {
+  if (p == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < vec->size; i++) {
+    if (vec->data[i] == p) {
+      return i;
+    }
+  }
+  errorf("internal error: object not collected for pch");
+}
+
+static void collect_node(pch_writer_t *w, node_t *node);
+
+static void collect_type(pch_writer_t *w, type_t *type) {
+  if (type == NULL || vector_exists(w->types, type)) {
+    return;
+  }
+  vector_push(w->types, type);
+  collect_type(w, type->parent);
+  if (type->kind == TYPE_KIND_FUNCTION) {
+    if (!vector_exists(w->argtypes, type->argtypes)) {
+      vector_push(w->argtypes, type->argtypes);
+    }
+    for (int i = 0; i < type->argtypes->size; i++) {
+      collect_type(w, (type_t *)type->argtypes->data[i]);
+    }
+  } else if (type->fields != NULL) {
+    if (!vector_exists(w->fields, type->fields)) {
+      vector_push(w->fields, type->fields);
+    }
+    for (map_entry_t *e = type->fields->top; e != NULL; e = e->next) {
+      collect_node(w, (node_t *)e->val);
+    }
+  }
+}
+
+static void collect_node(pch_writer_t *w, node_t *node) {
+  if (vector_exists(w->nodes, node)) {
+    return;
+  }
+  if (node->kind != NODE_KIND_VARIABLE && node->kind != NODE_KIND_LITERAL) {
+    errorf("cannot precompile %s", node->kind == NODE_KIND_FUNCTION ? "function definitions" : "expressions");
+  }
+  vector_push(w->nodes, node);
+  collect_type(w, node->type);
+}
+
+static void write_long(pch_writer_t *w, long v) {
+  fwrite(&v, sizeof (v), 1, w->fp);
+}
+
+static void write_double(pch_writer_t *w, double v) {
+  fwrite(&v, sizeof (v), 1, w->fp);
+}
+
+static void write_bytes(pch_writer_t *w, char *s, int len) {
+  write_long(w, len);
+  fwrite(s, 1, len, w->fp);
+}
+
+static void write_str(pch_writer_t *w, char *s) {
+  if (s == NULL) {
+    write_long(w, -1);
+    return;
+  }
+  write_bytes(w, s, strlen(s));
+}
+
+static void write_map(pch_writer_t *w, map_t *map, vector_t *table) {
+  write_long(w, map->size);
+  for (map_entry_t *e = map->top; e != NULL; e = e->next) {
+    write_str(w, e->key);
+    write_long(w, index_of(table, e->val));
+  }
+}
+
+static void write_type(pch_writer_t *w, parse_t *parse, type_t *type) {
+  write_str(w, type->name);
+  write_long(w, type->name != NULL && map_get(parse->types, type->name) == type);
+  write_long(w, type->kind);
+  write_long(w, type->sign);
+  write_long(w, type->is_const);
+  write_long(w, type->bytes);
+  write_long(w, type->size);
+  write_long(w, type->align);
+  write_long(w, type->total_size);
+  write_long(w, index_of(w->types, type->parent));
+  if (type->kind == TYPE_KIND_FUNCTION) {
+    write_long(w, type->is_vaargs);
+    write_long(w, type->is_typedef);
+    write_long(w, index_of(w->argtypes, type->argtypes));
+  } else {
+    write_long(w, type->is_struct);
+    write_long(w, type->is_typedef);
+    write_long(w, index_of(w->fields, type->fields));
+  }
+}
+
+static void write_node(pch_writer_t *w, node_t *node) {
+  write_long(w, node->kind);
+  write_long(w, index_of(w->types, node->type));
+  if (node->kind == NODE_KIND_VARIABLE) {
+    write_str(w, node->vname);
+    write_long(w, node->global);
+    write_long(w, node->sclass);
+    write_long(w, node->voffset);
+  } else {
+    write_long(w, node->ival);
+    write_double(w, node->fval);
+  }
+}
+
+static void write_token(pch_writer_t *w, token_t *token) {
+  write_long(w, token->kind);
+  write_long(w, token->line);
+  write_long(w, token->column);
+  write_long(w, token->is_space);
+  write_str(w, token->str);
+  switch (token->kind) {
+  case TOKEN_KIND_FLOAT:
+  case TOKEN_KIND_DOUBLE:
+    write_double(w, token->fval);
+    break;
+  case TOKEN_KIND_STRING:
+    write_bytes(w, token->sval->buf, token->sval->size);
+    break;
+  case TOKEN_KIND_KEYWORD:
+  case TOKEN_KIND_UNKNOWN:
+    write_long(w, token->keyword);
+    break;
+  case TOKEN_KIND_IDENTIFIER:
+    break;
+  case TOKEN_MACRO_PARAM:
+    write_long(w, token->position);
+    write_long(w, token->is_vaargs);
+    break;
+  default:
+    write_long(w, token->ival);
+  }
+}
+
+static void write_macro(pch_writer_t *w, macro_t *macro) {
+  write_long(w, macro->is_vaargs);
+  write_long(w, macro->args != NULL ? macro->args->size : -1);
+  if (macro->args != NULL) {
+    for (map_entry_t *e = macro->args->top; e != NULL; e = e->next) {
+      write_str(w, e->key);
+      write_token(w, (token_t *)e->val);
+    }
+  }
+  write_long(w, macro->tokens->size);
+  for (int i = 0; i < macro->tokens->size; i++) {
+    write_token(w, (token_t *)macro->tokens->data[i]);
+  }
+}
+
+void pch_write(parse_t *parse, char *file_name) {
+  if (parse->data->size > 0) {
+    errorf("cannot precompile a header that defines data");
+  }
+  for (int i = 0; i < parse->statements->size; i++) {
+    node_t *node = (node_t *)parse->statements->data[i];
+    if (node->kind != NODE_KIND_NOP && node->kind != NODE_KIND_DECLARATION) {
+      errorf("cannot precompile function definitions");
+    }
+  }
+
+  pch_writer_t w;
+  w.fp = fopen(file_name, "wb");
+  if (w.fp == NULL) {
+    errorf("cannot open %s", file_name);
+  }
+  w.types = vector_new();
+  w.nodes = vector_new();
+  w.fields = vector_new();
+  w.argtypes = vector_new();
+  for (map_entry_t *e = parse->types->top; e != NULL; e = e->next) {
+    collect_type(&w, (type_t *)e->val);
+  }
+  for (map_entry_t *e = parse->tags->top; e != NULL; e = e->next) {
+    collect_type(&w, (type_t *)e->val);
+  }
+  for (map_entry_t *e = parse->vars->top; e != NULL; e = e->next) {
+    collect_node(&w, (node_t *)e->val);
+  }
+
+  fwrite(PCH_MAGIC, 1, 8, w.fp);
+  write_long(&w, w.types->size);
+  for (int i = 0; i < w.types->size; i++) {
+    write_type(&w, parse, (type_t *)w.types->data[i]);
+  }
+  write_long(&w, w.nodes->size);
+  for (int i = 0; i < w.nodes->size; i++) {
+    write_node(&w, (node_t *)w.nodes->data[i]);
+  }
+  write_long(&w, w.fields->size);
+  for (int i = 0; i < w.fields->size; i++) {
+    write_map(&w, (map_t *)w.fields->data[i], w.nodes);
+  }
+  write_long(&w, w.argtypes->size);
+  for (int i = 0; i < w.argtypes->size; i++) {
+    vector_t *argtypes = (vector_t *)w.argtypes->data[i];
+    write_long(&w, argtypes->size);
+    for (int j = 0; j < argtypes->size; j++) {
+      write_long(&w, index_of(w.types, argtypes->data[j]));
+    }
+  }
+  write_map(&w, parse->types, w.types);
+  write_map(&w, parse->tags, w.types);
+  write_map(&w, parse->vars, w.nodes);
+
+  write_long(&w, parse->macros->size);
+  for (map_entry_t *e = parse->macros->top; e != NULL; e = e->next) {
+    write_str(&w, e->key);
+    write_macro(&w, (macro_t *)e->val);
+  }
+
+  write_long(&w, parse->include_guards->size);
+  for (map_entry_t *e = parse->include_guards->top; e != NULL; e = e->next) {
+    include_guard_t *guard = (include_guard_t *)e->val;
+    write_str(&w, e->key);
+    write_str(&w, guard->macro);
+    write_long(&w, guard->once);
+  }
+
+  fclose(w.fp);
+  vector_free(w.types);
+  vector_free(w.nodes);
+  vector_free(w.fields);
+  vector_free(w.argtypes);
+}
+
+static void check(pch_reader_t *r, int bytes) {
+  if (r->end - r->p < bytes) {
+    errorf("corrupted precompiled header");
+  }
+}
+
+static long read_long(pch_reader_t *r) {
+  long v;
+  check(r, sizeof (v));
+  memcpy(&v, r->p, sizeof (v));
+  r->p += sizeof (v);
+  return v;
+}
+
+static double read_double(pch_reader_t *r) {
+  double v;
+  check(r, sizeof (v));
+  memcpy(&v, r->p, sizeof (v));
+  r->p += sizeof (v);
+  return v;
+}
+
+static char *read_bytes(pch_reader_t *r, int *lenp) {
+  long len = read_long(r);
+  if (len < 0) {
+    return NULL;
+  }
+  check(r, len);
+  char *s = r->p;
+  r->p += len;
+  *lenp = len;
+  return s;
+}
+
+static char *read_atom(pch_reader_t *r) {
+  int len;
+  char *s = read_bytes(r, &len);
+  return s != NULL ? atom_new_with_len(s, len) : NULL;
+}
+
+static long read_index(pch_reader_t *r, int size) {
+  long i = read_long(r);
+  if (i < -1 || i >= size) {
+    errorf("corrupted precompiled header");
+  }
+  return i;
+}
+
+static token_t *read_token(pch_reader_t *r) {
+  token_t *token = (token_t *)arena_alloc(r->parse->lex->token_arena);
+  token->kind = read_long(r);
+  token->line = read_long(r);
+  token->column = read_long(r);
+  token->is_space = read_long(r);
+  token->hideset = NULL;
+  int len;
+  char *s = read_bytes(r, &len);
+  if (token->kind == TOKEN_KIND_IDENTIFIER) {
+    token->str = token->identifier = atom_new_with_len(s, len);
+    return token;
+  }
+  token->str = s != NULL ? atom_new_with_len(s, len) : atom_new("");
+  switch (token->kind) {
+  case TOKEN_KIND_FLOAT:
+  case TOKEN_KIND_DOUBLE:
+    token->fval = read_double(r);
+    break;
+  case TOKEN_KIND_STRING:
+    s = read_bytes(r, &len);
+    token->sval = string_new();
+    arena_own(r->parse->lex->token_arena, token);
+    for (int i = 0; i < len; i++) {
+      string_add(token->sval, s[i]);
+    }
+    break;
+  case TOKEN_KIND_KEYWORD:
+  case TOKEN_KIND_UNKNOWN:
+    token->keyword = read_long(r);
+    break;
+  case TOKEN_MACRO_PARAM:
+    token->position = read_long(r);
+    token->is_vaargs = read_long(r);
+    break;
+  default:
+    token->ival = read_long(r);
+  }
+  return token;
+}
+
+static macro_t *read_macro(pch_reader_t *r) {
+  macro_t *macro = macro_new();
+  macro->is_vaargs = read_long(r);
+  long nargs = read_long(r);
+  if (nargs >= 0) {
+    macro->args = map_new();
+    for (int i = 0; i < nargs; i++) {
+      char *name = read_atom(r);
+      map_add(macro->args, name, read_token(r));
+    }
+  }
+  long ntokens = read_long(r);
+  for (int i = 0; i < ntokens; i++) {
+    vector_push(macro->tokens, read_token(r));
+  }
+  return macro;
+}
+
+// add entries that parse_new has not already registered
+static void read_map(pch_reader_t *r, map_t *map, void **table, int size) {
+  long n = read_long(r);
+  for (int i = 0; i < n; i++) {
+    char *key = read_atom(r);
+    long j = read_index(r, size);
+    if (j >= 0 && map_get(map, key) == NULL) {
+      map_add(map, key, table[j]);
+    }
+  }
+}
+
+static void read_image(pch_reader_t *r) {
+  parse_t *parse = r->parse;
+  check(r, 8);
+  if (memcmp(r->p, PCH_MAGIC, 8) != 0) {
+    errorf("not a precompiled header or wrong version");
+  }
+  r->p += 8;
+
+  long ntypes = read_long(r);
+  r->types = (type_t **)calloc(ntypes + 1, sizeof (type_t *));
+  long *parents = (long *)calloc(ntypes + 1, sizeof (long));
+  long *links = (long *)calloc(ntypes + 1, sizeof (long));
+  bool *reused = (bool *)calloc(ntypes + 1, sizeof (bool));
+  for (int i = 0; i < ntypes; i++) {
+    char *name = read_atom(r);
+    bool named = read_long(r);
+    type_t *type = named ? (type_t *)map_get(parse->types, name) : NULL;
+    reused[i] = type != NULL;
+    if (type == NULL) {
+      type = (type_t *)arena_alloc(parse->type_arena);
+      type->name = name;
+    }
+    type_t t;
+    t.kind = read_long(r);
+    t.sign = read_long(r);
+    t.is_const = read_long(r);
+    t.bytes = read_long(r);
+    t.size = read_long(r);
+    t.align = read_long(r);
+    t.total_size = read_long(r);
+    parents[i] = read_index(r, ntypes);
+    bool flag = read_long(r);
+    bool is_typedef = read_long(r);
+    links[i] = read_long(r);
+    if (!reused[i]) {
+      type->kind = t.kind;
+      type->sign = t.sign;
+      type->is_const = t.is_const;
+      type->bytes = t.bytes;
+      type->size = t.size;
+      type->align = t.align;
+      type->total_size = t.total_size;
+      if (type->kind == TYPE_KIND_FUNCTION) {
+        type->is_vaargs = flag;
+      } else {
+        type->is_struct = flag;
+      }
+      type->is_typedef = is_typedef;
+    }
+    r->types[i] = type;
+  }
+  for (int i = 0; i < ntypes; i++) {
+    if (!reused[i]) {
+      r->types[i]->parent = parents[i] >= 0 ? r->types[parents[i]] : NULL;
+    }
+  }
+
+  long nnodes = read_long(r);
+  r->nodes = (node_t **)calloc(nnodes + 1, sizeof (node_t *));
+  for (int i = 0; i < nnodes; i++) {
+    int kind = read_long(r);
+    long t = read_index(r, ntypes);
+    type_t *type = t >= 0 ? r->types[t] : NULL;
+    node_t *node;
+    if (kind == NODE_KIND_VARIABLE) {
+      char *vname = read_atom(r);
+      bool global = read_long(r);
+      int sclass = read_long(r);
+      node = node_new_variable(parse, type, vname, sclass, global);
+      node->voffset = read_long(r);
+    } else {
+      node = node_new_int(parse, type, read_long(r));
+      node->fval = read_double(r);
+    }
+    r->nodes[i] = node;
+  }
+
+  long nfields = read_long(r);
+  r->fields = (map_t **)calloc(nfields + 1, sizeof (map_t *));
+  for (int i = 0; i < nfields; i++) {
+    r->fields[i] = map_new();
+    read_map(r, r->fields[i], (void **)r->nodes, nnodes);
+  }
+
+  long nargtypes = read_long(r);
+  r->argtypes = (vector_t **)calloc(nargtypes + 1, sizeof (vector_t *));
+  for (int i = 0; i < nargtypes; i++) {
+    r->argtypes[i] = vector_new();
+    long n = read_long(r);
+    for (int j = 0; j < n; j++) {
+      vector_push(r->argtypes[i], r->types[read_index(r, ntypes)]);
+    }
+  }
+
+  // tables only referenced by reused builtin types are dropped
+  bool *used_fields = (bool *)calloc(nfields + 1, sizeof (bool));
+  bool *used_argtypes = (bool *)calloc(nargtypes + 1, sizeof (bool));
+  for (int i = 0; i < ntypes; i++) {
+    type_t *type = r->types[i];
+    if (reused[i]) {
+      continue;
+    }
+    if (type->kind == TYPE_KIND_FUNCTION) {
+      if (links[i] < 0 || links[i] >= nargtypes) {
+        errorf("corrupted precompiled header");
+      }
+      type->argtypes = r->argtypes[links[i]];
+      used_argtypes[links[i]] = true;
+      if (!type->is_typedef && !type->is_const) {
+        arena_own(parse->type_arena, type);
+      }
+    } else {
+      if (links[i] < -1 || links[i] >= nfields) {
+        errorf("corrupted precompiled header");
+      }
+      type->fields = links[i] >= 0 ? r->fields[links[i]] : NULL;
+      if (links[i] >= 0) {
+        used_fields[links[i]] = true;
+        if (!type->is_typedef && !type->is_const) {
+          arena_own(parse->type_arena, type);
+        }
+      }
+    }
+  }
+  for (int i = 0; i < nfields; i++) {
+    if (!used_fields[i]) {
+      map_free(r->fields[i]);
+    }
+  }
+  for (int i = 0; i < nargtypes; i++) {
+    if (!used_argtypes[i]) {
+      vector_free(r->argtypes[i]);
+    }
+  }
+  free(used_fields);
+  free(used_argtypes);
+
+  read_map(r, parse->types, (void **)r->types, ntypes);
+  read_map(r, parse->tags, (void **)r->types, ntypes);
+  read_map(r, parse->vars, (void **)r->nodes, nnodes);
+
+  long nmacros = read_long(r);
+  for (int i = 0; i < nmacros; i++) {
+    char *name = read_atom(r);
+    macro_t *macro = read_macro(r);
+    macro_t *old_macro = (macro_t *)map_get(parse->macros, name);
+    if (old_macro != NULL) {
+      macro_free(old_macro);
+      map_delete(parse->macros, name);
+    }
+    map_add(parse->macros, name, macro);
+  }
+
+  long nguards = read_long(r);
+  for (int i = 0; i < nguards; i++) {
+    char *path = read_atom(r);
+    include_guard_t *guard = (include_guard_t *)malloc(sizeof (include_guard_t));
+    guard->macro = read_atom(r);
+    guard->once = read_long(r);
+    if (map_get(parse->include_guards, path) == NULL) {
+      map_add(parse->include_guards, path, guard);
+    } else {
+      free(guard);
+    }
+  }
+
+  free(parents);
+  free(links);
+  free(reused);
+  free(r->types);
+  free(r->nodes);
+  free(r->fields);
+  free(r->argtypes);
+}
+
+void pch_read(parse_t *parse, char *file_name) {
+  int fd = open(file_name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    errorf("cannot open %s", file_name);
+  }
+  char *buf = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (buf == MAP_FAILED) {
+    errorf("cannot map %s", file_name);
+  }
+
+  pch_reader_t r;
+  r.parse = parse;
+  r.p = buf;
+  r.end = buf + st.st_size;
+  read_image(&r);
+  munmap(buf, st.st_size);
+}
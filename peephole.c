@@ -0,0 +1,276 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hcc.h"
+
+/*
+ * Peephole optimizer.
+ *
+ * Runs over the instruction records buffered by emit.c, before they are
+ * rendered or assembled. Each pattern looks at a window of consecutive live
+ * records and rewrites it in place; a record is deleted by clearing its op.
+ * After a hit the scan backs up by one window so that a rewrite can expose
+ * another match. The branch pattern relies on gen.c never reading flags set
+ * before a jump.
+ */
+
+#define PEEPHOLE_WINDOW 5
+
+typedef struct pattern pattern_t;
+struct pattern {
+  char *name;
+  bool (*apply)(inst_t **w, int n);
+  int hits;
+};
+
+// setcc, then the jumps taken when the condition holds and when it does not
+static char *conds[][3] = {
+  {"sete", "je", "jne"},
+  {"setne", "jne", "je"},
+  {"setg", "jg", "jle"},
+  {"setge", "jge", "jl"},
+  {"setl", "jl", "jge"},
+  {"setle", "jle", "jg"},
+  {"seta", "ja", "jbe"},
+  {"setae", "jae", "jb"},
+  {"setb", "jb", "jae"},
+  {"setbe", "jbe", "ja"},
+  {NULL, NULL, NULL},
+};
+
+static bool is(inst_t *inst, char *op, int nargs) {
+  return inst->nargs == nargs && strcmp(inst->op, op) == 0;
+}
+
+static bool is_label(inst_t *inst) {
+  int len = strlen(inst->op);
+  return inst->nargs == 0 && len > 0 && inst->op[len - 1] == ':';
+}
+
+static bool is_reg64(char *s) {
+  return s[0] == '%' && s[1] == 'r';
+}
+
+static void set(inst_t *inst, char *op, char *a, char *b) {
+  inst->op = op;
+  inst->args[0] = a;
+  inst->args[1] = b;
+  inst->nargs = b ? 2 : a ? 1 : 0;
+}
+
+// push %x; pop %y
+static bool push_pop(inst_t **w, int n) {
+  if (n < 2 || !is(w[0], "push", 1) || !is(w[1], "pop", 1)) {
+    return false;
+  }
+  if (strcmp(w[0]->args[0], w[1]->args[0]) == 0) {
+    w[0]->op = NULL;
+  } else {
+    set(w[0], "mov", w[0]->args[0], w[1]->args[0]);
+  }
+  w[1]->op = NULL;
+  return true;
+}
+
+// pop %x; push %x
+static bool pop_push(inst_t **w, int n) {
+  if (n < 2 || !is(w[0], "pop", 1) || !is(w[1], "push", 1) ||
+      strcmp(w[0]->args[0], w[1]->args[0]) != 0) {
+    return false;
+  }
+  set(w[0], "mov", "(%rsp)", w[0]->args[0]);
+  w[1]->op = NULL;
+  return true;
+}
+
+// mov %x, %y; mov %y, %x
+static bool mov_mov(inst_t **w, int n) {
+  if (n < 2 || !is(w[0], "mov", 2) || !is(w[1], "mov", 2)) {
+    return false;
+  }
+  char *x = w[0]->args[0], *y = w[0]->args[1];
+  if (!is_reg64(x) || !is_reg64(y) ||
+      strcmp(w[1]->args[0], y) != 0 || strcmp(w[1]->args[1], x) != 0) {
+    return false;
+  }
+  w[1]->op = NULL;
+  return true;
+}
+
+// mov $imm32, %rax; cltq
+static bool mov_cltq(inst_t **w, int n) {
+  if (n < 2 || !is(w[0], "mov", 2) || !is(w[1], "cltq", 0) ||
+      w[0]->args[0][0] != '$' || strcmp(w[0]->args[1], "%rax") != 0) {
+    return false;
+  }
+  long v = strtol(w[0]->args[0] + 1, NULL, 10);
+  if (v < INT32_MIN || v > INT32_MAX) {
+    return false;
+  }
+  w[1]->op = NULL;
+  return true;
+}
+
+// jmp .L; .L:
+static bool jmp_next(inst_t **w, int n) {
+  if (!is(w[0], "jmp", 1)) {
+    return false;
+  }
+  char *target = w[0]->args[0];
+  int len = strlen(target);
+  for (int i = 1; i < n && is_label(w[i]); i++) {
+    if (strncmp(w[i]->op, target, len) == 0 && w[i]->op[len] == ':' && w[i]->op[len + 1] == '\0') {
+      w[0]->op = NULL;
+      return true;
+    }
+  }
+  return false;
+}
+
+// setcc %al; movzb %al, %eax; [pop %x;] test %rax, %rax; je/jne .L
+static bool bool_branch(inst_t **w, int n) {
+  if (n < 4 || w[0]->nargs != 1 || strncmp(w[0]->op, "set", 3) != 0 ||
+      strcmp(w[0]->args[0], "%al") != 0 || !is(w[1], "movzb", 2) ||
+      strcmp(w[1]->args[0], "%al") != 0 || strcmp(w[1]->args[1], "%eax") != 0) {
+    return false;
+  }
+  int i = 2;
+  if (is(w[i], "pop", 1) && strcmp(w[i]->args[0], "%rax") != 0) {
+    i++;
+  }
+  if (i + 1 >= n || !is(w[i], "test", 2) || strcmp(w[i]->args[0], "%rax") != 0 ||
+      strcmp(w[i]->args[1], "%rax") != 0) {
+    return false;
+  }
+  inst_t *jump = w[i + 1];
+  bool taken_if_true;
+  if (is(jump, "jne", 1)) {
+    taken_if_true = true;
+  } else if (is(jump, "je", 1)) {
+    taken_if_true = false;
+  } else {
+    return false;
+  }
+  for (int j = 0; conds[j][0] != NULL; j++) {
+    if (strcmp(w[0]->op, conds[j][0]) == 0) {
+      jump->op = conds[j][taken_if_true ? 1 : 2];
+      w[i]->op = NULL;
+      return true;
+    }
+  }
+  return false;
+}
+
+// push %x; mov/lea ..., %rax; pop %y, when the load touches neither %y nor %rsp
+static bool push_load_pop(inst_t **w, int n) {
+  static char *loads[] = {
+    "mov", "lea", "movslq", "movsbq", "movswq", "movzbq", "movzwq", NULL,
+  };
+  if (n < 3 || !is(w[0], "push", 1) || !is(w[2], "pop", 1) || w[1]->nargs != 2 ||
+      strcmp(w[1]->args[1], "%rax") != 0) {
+    return false;
+  }
+  char *x = w[0]->args[0], *y = w[2]->args[0], *src = w[1]->args[0];
+  if (src[0] == '%' || strcmp(y, "%rax") == 0 || strstr(src, y + 1) != NULL ||
+      strstr(src, "%rsp") != NULL) {
+    return false;
+  }
+  for (int i = 0; loads[i] != NULL; i++) {
+    if (strcmp(w[1]->op, loads[i]) != 0) {
+      continue;
+    }
+    if (strcmp(x, y) == 0) {
+      w[0]->op = NULL;
+    } else {
+      set(w[0], "mov", x, y);
+    }
+    w[2]->op = NULL;
+    return true;
+  }
+  return false;
+}
+
+// emit_push_xmm immediately undone by emit_pop_xmm
+static bool xmm_push_pop(inst_t **w, int n) {
+  if (n < 4 || !is(w[0], "sub", 2) || strcmp(w[0]->args[0], "$8") != 0 ||
+      strcmp(w[0]->args[1], "%rsp") != 0 || !is(w[1], "movsd", 2) ||
+      strcmp(w[1]->args[1], "(%rsp)") != 0 || !is(w[2], "movsd", 2) ||
+      strcmp(w[2]->args[0], "(%rsp)") != 0 || !is(w[3], "add", 2) ||
+      strcmp(w[3]->args[0], "$8") != 0 || strcmp(w[3]->args[1], "%rsp") != 0) {
+    return false;
+  }
+  char *x = w[1]->args[0], *y = w[2]->args[1];
+  w[0]->op = NULL;
+  if (strcmp(x, y) == 0) {
+    w[1]->op = NULL;
+  } else {
+    set(w[1], "movsd", x, y);
+  }
+  w[2]->op = NULL;
+  w[3]->op = NULL;
+  return true;
+}
+
+static pattern_t patterns[] = {
+  {"push-pop", push_pop, 0},
+  {"pop-push", pop_push, 0},
+  {"mov-mov", mov_mov, 0},
+  {"mov-cltq", mov_cltq, 0},
+  {"jmp-next", jmp_next, 0},
+  {"bool-branch", bool_branch, 0},
+  {"push-load-pop", push_load_pop, 0},
+  {"xmm-push-pop", xmm_push_pop, 0},
+  {NULL, NULL, 0},
+};
+
+void peephole(parse_t *parse) {
+  vector_t *insts = emit_insts();
+  if (insts == NULL) {
+    return;
+  }
+  inst_t **data = (inst_t **)insts->data;
+  int i = 0;
+  while (i < insts->size) {
+    inst_t *w[PEEPHOLE_WINDOW];
+    int n = 0;
+    for (int j = i; j < insts->size && n < PEEPHOLE_WINDOW; j++) {
+      if (data[j]->op != NULL) {
+        w[n++] = data[j];
+      }
+    }
+    if (n == 0) {
+      break;
+    }
+    if (w[0] != data[i]) {
+      i++;
+      continue;
+    }
+    bool hit = false;
+    for (pattern_t *p = patterns; p->name != NULL; p++) {
+      if (p->apply(w, n)) {
+        p->hits++;
+        hit = true;
+        break;
+      }
+    }
+    if (!hit) {
+      i++;
+      continue;
+    }
+    // back up over a window of live records
+    for (int back = 0; i > 0 && back < PEEPHOLE_WINDOW - 1; ) {
+      if (data[--i]->op != NULL) {
+        back++;
+      }
+    }
+  }
+
+  if (parse->option->stats) {
+    for (pattern_t *p = patterns; p->name != NULL; p++) {
+      fprintf(stderr, "peephole %-16s %d\n", p->name, p->hits);
+    }
+  }
+}
@@ -0,0 +1,432 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Linear-scan register allocator for local variables.
+ *
+ * Liveness is computed on the IR of the function: a backward dataflow over
+ * its CFG finds the instructions at which each local variable is live, and
+ * its live interval is the range of instruction numbers that covers them.
+ * gen.c still emits code from the AST and may evaluate the operands of a
+ * statement in a different order than the IR, so a variable that a
+ * statement reads or writes is live across that whole statement.
+ * Intervals are then assigned to GPRs (integer and pointer variables) or
+ * to xmm12-xmm15 (float variables whose interval does not cross a call).
+ * Functions that make no calls take %rsi, %rdi, %r8 and %r9 first, less
+ * those that a vectorized loop holds its array bases in, so leaf functions
+ * need not save callee-saved registers.
+ * Variables whose address is taken stay in their stack slot. Parameters
+ * that get a register are moved there straight from their argument
+ * register by the prologue and have no stack slot at all. The same pass
+ * tells gen.c whether any pointer into the frame can exist, which is what
+ * decides if calls in tail position may reuse it.
+ */
+
+typedef struct interval interval_t;
+struct interval {
+  node_t *var;
+  int start;
+  int end;
+  int hint;  // the argument register of a parameter
+  bool addressed;
+};
+
+typedef struct liveness liveness_t;
+struct liveness {
+  vector_t *intervals;
+  vector_t *calls;
+  bool escapes;
+  int vbases;  // array bases of the widest vectorized loop
+};
+
+static const char *reg_names[REG_NUM][4] = {
+  {"bl", "bx", "ebx", "rbx"},
+  {"r12b", "r12w", "r12d", "r12"},
+  {"r13b", "r13w", "r13d", "r13"},
+  {"r14b", "r14w", "r14d", "r14"},
+  {"r15b", "r15w", "r15d", "r15"},
+  {"sil", "si", "esi", "rsi"},
+  {"dil", "di", "edi", "rdi"},
+  {"r8b", "r8w", "r8d", "r8"},
+  {"r9b", "r9w", "r9d", "r9"},
+  {"r10b", "r10w", "r10d", "r10"},
+  {"r11b", "r11w", "r11d", "r11"},
+  {"xmm8", "xmm8", "xmm8", "xmm8"},
+  {"xmm9", "xmm9", "xmm9", "xmm9"},
+  {"xmm10", "xmm10", "xmm10", "xmm10"},
+  {"xmm11", "xmm11", "xmm11", "xmm11"},
+  {"xmm12", "xmm12", "xmm12", "xmm12"},
+  {"xmm13", "xmm13", "xmm13", "xmm13"},
+  {"xmm14", "xmm14", "xmm14", "xmm14"},
+  {"xmm15", "xmm15", "xmm15", "xmm15"},
+};
+
+static const int gpr_pool[] = {REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15};
+// in the order of VBASE_REGS in gen.c
+static const int leaf_gpr_pool[] = {REG_RSI, REG_RDI, REG_R8, REG_R9, REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15};
+// the argument registers that can also hold variables
+static const int arg_regs[] = {REG_RDI, REG_RSI, REG_NONE, REG_NONE, REG_R8, REG_R9};
+static const int xmm_pool[] = {REG_XMM12, REG_XMM13, REG_XMM14, REG_XMM15};
+
+bool reg_is_xmm(int reg) {
+  return reg >= REG_XMM8;
+}
+
+const char *reg_name(int reg, int bytes) {
+  assert(reg >= 0 && reg < REG_NUM);
+  switch (bytes) {
+  case 1:
+    return reg_names[reg][0];
+  case 2:
+    return reg_names[reg][1];
+  case 4:
+    return reg_names[reg][2];
+  }
+  return reg_names[reg][3];
+}
+
+static int find_interval(liveness_t *lv, node_t *var) {
+  for (int i = 0; i < lv->intervals->size; i++) {
+    interval_t *it = (interval_t *)lv->intervals->data[i];
+    if (it->var == var) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int add_interval(liveness_t *lv, node_t *var) {
+  if (var->global || var->sclass != STORAGE_CLASS_NONE) {
+    return -1;
+  }
+  int i = find_interval(lv, var);
+  if (i < 0) {
+    interval_t *it = (interval_t *)malloc(sizeof (interval_t));
+    it->var = var;
+    it->start = INT_MAX;
+    it->end = -1;
+    it->hint = REG_NONE;
+    it->addressed = false;
+    i = lv->intervals->size;
+    vector_push(lv->intervals, it);
+  }
+  return i;
+}
+
+static void cover(liveness_t *lv, int i, int start, int end) {
+  interval_t *it = (interval_t *)lv->intervals->data[i];
+  it->start = min(it->start, start);
+  it->end = max(it->end, end);
+}
+
+static bool is_aggregate(type_t *type) {
+  return type->kind == TYPE_KIND_ARRAY || type_is_struct(type);
+}
+
+static void analyze(liveness_t *lv, ir_func_t *f) {
+  int nblocks = f->blocks->size, ninsts = 0;
+  for (int i = 0; i < nblocks; i++) {
+    ninsts += ((ir_block_t *)f->blocks->data[i])->insts->size;
+  }
+
+  // number the instructions from 1, position 0 is the entry where the
+  // parameters are set
+  int *vars = (int *)malloc(sizeof (int) * (ninsts + 1));
+  int *first = (int *)malloc(sizeof (int) * nblocks);
+  int *stmt_start = (int *)malloc(sizeof (int) * f->nstmts);
+  int *stmt_end = (int *)malloc(sizeof (int) * f->nstmts);
+  for (int i = 0; i < f->nstmts; i++) {
+    stmt_start[i] = INT_MAX;
+    stmt_end[i] = -1;
+  }
+  int pos = 1;
+  for (int i = 0; i < nblocks; i++) {
+    ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+    first[i] = pos;
+    for (int j = 0; j < bb->insts->size; j++, pos++) {
+      ir_t *ir = (ir_t *)bb->insts->data[j];
+      vars[pos] = -1;
+      stmt_start[ir->stmt] = min(stmt_start[ir->stmt], pos);
+      stmt_end[ir->stmt] = max(stmt_end[ir->stmt], pos);
+      if (ir->kind == IR_CALL) {
+        vector_push(lv->calls, (void *)(intptr_t)pos);
+      }
+      if (ir->kind != IR_VAR && ir->kind != IR_ASSIGN && ir->kind != IR_ADDR) {
+        continue;
+      }
+      vars[pos] = add_interval(lv, ir->node);
+      if (vars[pos] < 0) {
+        continue;
+      }
+      if (ir->kind == IR_ADDR) {
+        ((interval_t *)lv->intervals->data[vars[pos]])->addressed = true;
+        lv->escapes = true;
+      } else if (is_aggregate(ir->node->type)) {
+        lv->escapes = true;
+      }
+    }
+  }
+
+  // the variables each block reads before writing them, and writes
+  int n = lv->intervals->size;
+  char *use = (char *)calloc(nblocks * n + 1, 1);
+  char *def = (char *)calloc(nblocks * n + 1, 1);
+  char *live_in = (char *)calloc(nblocks * n + 1, 1);
+  char *live_out = (char *)calloc(nblocks * n + 1, 1);
+  for (int i = 0; i < nblocks; i++) {
+    ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+    for (int j = 0; j < bb->insts->size; j++) {
+      ir_t *ir = (ir_t *)bb->insts->data[j];
+      int v = vars[first[i] + j];
+      if (v < 0) {
+        continue;
+      }
+      if (ir->kind == IR_ASSIGN) {
+        def[i * n + v] = 1;
+      } else if (!def[i * n + v]) {
+        use[i * n + v] = 1;
+      }
+    }
+  }
+
+  // live_out is the union of live_in of the successors and live_in is
+  // use plus whatever of live_out the block does not define
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = nblocks - 1; i >= 0; i--) {
+      ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+      for (int v = 0; v < n; v++) {
+        char out = 0;
+        for (int j = 0; j < bb->succs->size; j++) {
+          out |= live_in[((ir_block_t *)bb->succs->data[j])->id * n + v];
+        }
+        char in = use[i * n + v] || (out && !def[i * n + v]);
+        live_out[i * n + v] = out;
+        if (live_in[i * n + v] != in) {
+          live_in[i * n + v] = in;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // walk each block backwards, covering the positions at which a variable
+  // is live and the statements it is used in
+  char *live = (char *)malloc(n + 1);
+  for (int i = 0; i < nblocks; i++) {
+    ir_block_t *bb = (ir_block_t *)f->blocks->data[i];
+    for (int v = 0; v < n; v++) {
+      live[v] = live_out[i * n + v];
+    }
+    for (int j = bb->insts->size - 1; j >= 0; j--) {
+      ir_t *ir = (ir_t *)bb->insts->data[j];
+      pos = first[i] + j;
+      for (int v = 0; v < n; v++) {
+        if (live[v]) {
+          cover(lv, v, pos, pos);
+        }
+      }
+      int v = vars[pos];
+      if (v >= 0) {
+        cover(lv, v, stmt_start[ir->stmt], stmt_end[ir->stmt]);
+        live[v] = ir->kind != IR_ASSIGN;
+      }
+    }
+  }
+
+  free(vars);
+  free(first);
+  free(stmt_start);
+  free(stmt_end);
+  free(use);
+  free(def);
+  free(live_in);
+  free(live_out);
+  free(live);
+}
+
+// the most array bases that a vectorized loop in node keeps in registers
+static int vector_bases(node_t *node) {
+  int n = 0;
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        n = max(n, vector_bases((node_t *)node->statements->data[i]));
+      }
+      break;
+    case NODE_KIND_IF:
+      n = max(n, max(vector_bases(node->then_body), vector_bases(node->else_body)));
+      break;
+    case NODE_KIND_FOR:
+      if (node->vloop != NULL) {
+        n = max(n, node->vloop->bases->size);
+      }
+      // fall through
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+      n = max(n, vector_bases(node->lbody));
+      break;
+    case NODE_KIND_SWITCH:
+      n = max(n, vector_bases(node->sbody));
+      break;
+    case NODE_KIND_CASE:
+      n = max(n, vector_bases(node->cstmt));
+      break;
+    }
+  }
+  return n;
+}
+
+static bool crosses_call(liveness_t *lv, interval_t *it) {
+  for (int i = 0; i < lv->calls->size; i++) {
+    int pos = (int)(intptr_t)lv->calls->data[i];
+    if (it->start < pos && pos < it->end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_candidate(liveness_t *lv, interval_t *it) {
+  type_t *type = it->var->type;
+  if (it->addressed) {
+    return false;
+  }
+  if (type_is_float(type)) {
+    return !crosses_call(lv, it);
+  }
+  return type_is_int(type) || type->kind == TYPE_KIND_PTR || type->kind == TYPE_KIND_ENUM;
+}
+
+static int comp_interval(const void *a, const void *b) {
+  interval_t *x = *(interval_t **)a, *y = *(interval_t **)b;
+  if (x->start != y->start) {
+    return x->start - y->start;
+  }
+  // parameters that can stay in their argument register pick first
+  return (y->hint != REG_NONE) - (x->hint != REG_NONE);
+}
+
+static void expire(vector_t *active, interval_t *it, bool *busy) {
+  for (int i = 0; i < active->size;) {
+    interval_t *a = (interval_t *)active->data[i];
+    if (a->end < it->start) {
+      busy[a->var->vreg] = false;
+      active->data[i] = active->data[--active->size];
+    } else {
+      i++;
+    }
+  }
+}
+
+static void linear_scan(vector_t *intervals, const int *pool, int npool) {
+  vector_t *active = vector_new();
+  bool busy[REG_NUM] = {false};
+  for (int i = 0; i < intervals->size; i++) {
+    interval_t *it = (interval_t *)intervals->data[i];
+    expire(active, it, busy);
+    int reg = REG_NONE;
+    for (int j = 0; j < npool; j++) {
+      if (!busy[pool[j]] && (reg == REG_NONE || pool[j] == it->hint)) {
+        reg = pool[j];
+      }
+    }
+    if (reg == REG_NONE) {
+      // spill whichever interval ends last
+      int spill = -1;
+      for (int j = 0; j < active->size; j++) {
+        interval_t *a = (interval_t *)active->data[j];
+        if (a->end > it->end && (spill < 0 || a->end > ((interval_t *)active->data[spill])->end)) {
+          spill = j;
+        }
+      }
+      if (spill < 0) {
+        continue;
+      }
+      interval_t *a = (interval_t *)active->data[spill];
+      reg = a->var->vreg;
+      a->var->vreg = REG_NONE;
+      active->data[spill] = active->data[--active->size];
+    }
+    it->var->vreg = reg;
+    busy[reg] = true;
+    vector_push(active, it);
+  }
+  vector_free(active);
+}
+
+int regalloc(parse_t *parse, node_t *func) {
+  parse->tail_calls = false;
+  if (parse->option->optimize < 1 || func->fvar->type->is_vaargs) {
+    return 0;
+  }
+
+  liveness_t lv;
+  lv.intervals = vector_new();
+  lv.calls = vector_new();
+  lv.escapes = false;
+  lv.vbases = vector_bases(func->fbody);
+
+  int iregs = 0, xregs = 0;
+  for (int i = 0; i < func->fargs->size; i++) {
+    node_t *n = (node_t *)func->fargs->data[i];
+    int v = add_interval(&lv, n);
+    interval_t *it = (interval_t *)lv.intervals->data[v];
+    // the prologue sets every parameter at once, so all are live on entry
+    it->start = 0;
+    it->end = 0;
+    if (type_is_float(n->type) && xregs < 8) {
+      xregs++;
+    } else if (!type_is_struct(n->type) && iregs < 6) {
+      // staying in its argument register saves a move
+      it->hint = arg_regs[iregs++];
+    } else {
+      it->addressed = true;
+    }
+  }
+  ir_func_t *f = ir_lower_function(parse, func);
+  analyze(&lv, f);
+  ir_free_function(f);
+  parse->tail_calls = !lv.escapes && !type_is_struct(func->fvar->type->parent);
+
+  vector_t *gprs = vector_new(), *xmms = vector_new();
+  for (int i = 0; i < lv.intervals->size; i++) {
+    interval_t *it = (interval_t *)lv.intervals->data[i];
+    if (!is_candidate(&lv, it)) {
+      continue;
+    }
+    vector_push(type_is_float(it->var->type) ? xmms : gprs, it);
+  }
+  qsort(gprs->data, gprs->size, sizeof (void *), comp_interval);
+  qsort(xmms->data, xmms->size, sizeof (void *), comp_interval);
+  if (lv.calls->size == 0) {
+    linear_scan(gprs, leaf_gpr_pool + lv.vbases, sizeof (leaf_gpr_pool) / sizeof (leaf_gpr_pool[0]) - lv.vbases);
+  } else {
+    linear_scan(gprs, gpr_pool, sizeof (gpr_pool) / sizeof (gpr_pool[0]));
+  }
+  linear_scan(xmms, xmm_pool, sizeof (xmm_pool) / sizeof (xmm_pool[0]));
+
+  // callee-saved registers the prologue has to save
+  int used = 0;
+  for (int i = 0; i < gprs->size; i++) {
+    interval_t *it = (interval_t *)gprs->data[i];
+    if (it->var->vreg != REG_NONE && it->var->vreg <= REG_R15) {
+      used |= 1 << it->var->vreg;
+    }
+  }
+
+  while (lv.intervals->size > 0) {
+    free(vector_pop(lv.intervals));
+  }
+  vector_free(lv.intervals);
+  vector_free(lv.calls);
+  vector_free(gprs);
+  vector_free(xmms);
+  return used;
+}
@@ -79,19 +79,26 @@ string_t *string_dup(string_t *str0) {
   return str;
 }
 
-void string_print_quote(string_t *str, FILE *out) {
-  for (char *p = str->buf; *p; p++) {
+void string_append_quote(string_t *str, string_t *src) {
+  for (char *p = src->buf; *p; p++) {
     switch (*p) {
-    case '\a': fprintf(out, "\\a"); continue;
-    case '\b': fprintf(out, "\\b"); continue;
-    case '\f': fprintf(out, "\\f"); continue;
-    case '\n': fprintf(out, "\\n"); continue;
-    case '\r': fprintf(out, "\\r"); continue;
-    case '\t': fprintf(out, "\\t"); continue;
+    case '\a': string_append(str, "\\a"); continue;
+    case '\b': string_append(str, "\\b"); continue;
+    case '\f': string_append(str, "\\f"); continue;
+    case '\n': string_append(str, "\\n"); continue;
+    case '\r': string_append(str, "\\r"); continue;
+    case '\t': string_append(str, "\\t"); continue;
     }
     if (*p == '"' || *p == '\\') {
-      fprintf(out, "\\");
+      string_add(str, '\\');
     }
-    fprintf(out, "%c", *p);
+    string_add(str, *p);
   }
 }
+
+void string_print_quote(string_t *str, FILE *out) {
+  string_t *quoted = string_new();
+  string_append_quote(quoted, str);
+  fwrite(quoted->buf, 1, quoted->size, out);
+  string_free(quoted);
+}
@@ -16,6 +16,72 @@ function testast {
   assertequal "$result" "$1"
 }
 
+function testir {
+  result="$(echo "$2" | ./hcc -emit-ir 2>/dev/null | tr '\n\t' '; ')"
+  if [ $? -ne 0 ]; then
+    echo "Failed to compile $2"
+    exit
+  fi
+  assertequal "$result" "$1"
+}
+
+function testpch {
+  pch="$(mktemp)"
+  echo "$1" | ./hcc -emit-pch "$pch" 2>/dev/null
+  if [ $? -ne 0 ]; then
+    echo "Failed to precompile $1"
+    exit
+  fi
+  expected="$(./hcc < "$2" | sed 's/0x[0-9a-f]*/L/g')"
+  result="$(./hcc -include-pch "$pch" < "$2" | sed 's/0x[0-9a-f]*/L/g')"
+  rm -f "$pch"
+  if [ "$result" != "$expected" ]; then
+    echo "Test failed: $2 compiles differently with a precompiled header"
+    exit
+  fi
+}
+
+function testasm {
+  exe="$(mktemp)"
+  ./hcc $2 < "$1" | gcc -no-pie -Wa,--noexecstack -I. -o "$exe" -x assembler - -x c test/testmain.c
+  if [ $? -ne 0 ]; then
+    rm -f "$exe"
+    echo "Failed to assemble $1"
+    exit
+  fi
+  result="$("$exe")"
+  rm -f "$exe"
+  assertequal "$result" "All tests passed"
+}
+
+function testrun {
+  exe="$(mktemp)"
+  echo "$3" | ./hcc $2 | gcc -no-pie -Wa,--noexecstack -o "$exe" -x assembler -
+  if [ $? -ne 0 ]; then
+    rm -f "$exe"
+    echo "Failed to assemble $3"
+    exit
+  fi
+  result="$("$exe")"
+  rm -f "$exe"
+  assertequal "$result" "$1"
+}
+
+function testnoobject {
+  obj="$(mktemp -u)"
+  echo "$1" | ./hcc -c -o "$obj" > /dev/null 2>&1
+  if [ -e "$obj" ]; then
+    rm -f "$obj"
+    echo "Failed compile left an object file behind: $1"
+    exit
+  fi
+}
+
+function teststat {
+  result="$(echo "$4" | ./hcc $3 -stats 2>&1 >/dev/null | awk -v key="$1" '{$1 = $1} index($0, key " ") == 1 {print substr($0, length(key) + 2)}')"
+  assertequal "$result" "$2"
+}
+
 function testfail {
   expr="$1"
   echo "$expr" | ./hcc > /dev/null 2>&1
@@ -135,4 +201,76 @@ testfail 'void f(){const int a;a=0;}'
 testfail 'void f(){int a;const int *p=&a;*p=0;}'
 testfail 'void f(){struct{const int x;}a;a.x=0;}'
 
+testir 'func f(int a);bb0:; t0 = a; t1 = 1; t2 = t0 + t1; ret t2;' 'int f(int a){return a+1;}'
+testir 'func f(int a);bb0:; t0 = a; br t0, bb1, bb2;bb1: ; preds bb0; t1 = 1; ret t1;bb2: ; preds bb0; t2 = 0; ret t2;' 'int f(int a){if(a)return 1;return 0;}'
+testir 'func f();bb0:; t0 = 0; i = t0; jmp bb1;bb1: ; preds bb0 bb2; t1 = i; t2 = 3; t3 = t1 < t2; br t3, bb2, bb3;bb2: ; preds bb1; t4 = i; t5 = 1; t6 = t4 + t5; i = t6; jmp bb1;bb3: ; preds bb1; ret;' 'void f(){int i=0;while(i<3)i=i+1;}'
+
+testpch '#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>' test/function.c
+
+testnoobject 'int f(){return x;}'
+
+teststat 'peephole bool-branch' 1 -O0 'int f(int a){if(a>1)return 1;return 0;}'
+teststat 'peephole mov-cltq' 1 -O0 'int f(){int a=3;return a;}'
+teststat 'peephole pop-push' 1 -O0 'int f(int a,int b){return a*b+a*b;}'
+
+teststat 'dce statements' 1 -O0 'int f(){return 1;f();}'
+teststat 'dce statements' 1 -O0 'int f(int a){if(0)a=2;return a;}'
+teststat 'dce statements' 0 -O0 'int f(int a){switch(a){case 1:return 1;case 2:return 2;}return 0;}'
+teststat 'dce functions' 1 -O0 'static int g(){return 1;}int f(){return 0;}'
+teststat 'dce functions' 0 -O0 'static int g(){return 1;}int f(){return g();}'
+teststat 'dce data' 1 -O0 'int f(){if(0)return "x"[0];return 0;}'
+
+teststat 'inline calls' 1 -O1 'static int sq(int x){return x*x;}int f(int a){return sq(a);}'
+teststat 'inline calls' 0 -O1 'static int sq(int x){return x*x;}int f(int a){return sq(a+1);}'
+teststat 'inline calls' 0 -O1 'int sq(int x){return x*x;}int f(int a){return sq(a);}'
+teststat 'inline calls' 0 -O1 'static int f(int n){return n?n*f(n-1):1;}int g(){return f(3);}'
+teststat 'inline calls' 1 -O1 'static inline int m(int a,int b,int c){return a<b?b:a>c?c:a;}int f(int a){return m(a,0,9);}'
+teststat 'inline calls' 3 -O1 'int printf(char *fmt, ...);static int ts(short c){return c+1;}static int tc(char c){return c+1;}static int tu(unsigned char c){return c+1;}int main(){printf("%d %d %d", ts(70000), tc(70000), tu(70000));return 0;}'
+testrun '4465 113 113' -O0 'int printf(char *fmt, ...);static int ts(short c){return c+1;}static int tc(char c){return c+1;}static int tu(unsigned char c){return c+1;}int main(){printf("%d %d %d", ts(70000), tc(70000), tu(70000));return 0;}'
+testrun '4465 113 113' -O1 'int printf(char *fmt, ...);static int ts(short c){return c+1;}static int tc(char c){return c+1;}static int tu(unsigned char c){return c+1;}int main(){printf("%d %d %d", ts(70000), tc(70000), tu(70000));return 0;}'
+teststat 'inline calls' 2 -O1 'int printf(char *fmt, ...);static long sz(int a[10]){return sizeof(a);}static int second(int a[10]){return a[1];}int main(){int b[10];b[1]=7;printf("%ld %d", sz(b), second(b));return 0;}'
+testrun '8 7' -O0 'int printf(char *fmt, ...);static long sz(int a[10]){return sizeof(a);}static int second(int a[10]){return a[1];}int main(){int b[10];b[1]=7;printf("%ld %d", sz(b), second(b));return 0;}'
+testrun '8 7' -O1 'int printf(char *fmt, ...);static long sz(int a[10]){return sizeof(a);}static int second(int a[10]){return a[1];}int main(){int b[10];b[1]=7;printf("%ld %d", sz(b), second(b));return 0;}'
+
+teststat 'licm hoisted' 1 -O1 'int f(int *a,int n,int m){int s=0;for(int i=0;i<n;i++)s+=a[i]*(n+m);return s;}'
+teststat 'licm hoisted' 1 -O1 'int f(int *a,int n,int m){int s=0;for(int i=0;i<n*m;i++)s+=a[i]+n*m;return s;}'
+teststat 'licm hoisted' 0 -O1 'int f(int *a,int n){int s=0;for(int i=0;i<n;i++){s+=n*2;n--;}return s;}'
+teststat 'licm hoisted' 0 -O1 'int g;int f(int *a,int n){int s=0;for(int i=0;i<n;i++){s+=g*2;a[i]=s;}return s;}'
+teststat 'licm hoisted' 0 -O1 'int f(int n,int d){int s=0;for(int i=0;i<n;i++)s+=n/d;return s;}'
+teststat 'induction pointers' 1 -O1 'long f(int *a,int n){long s=0;for(int i=0;i<n;i++)s+=a[i];return s;}'
+teststat 'induction tests' 1 -O1 'long f(int *a,int n){long s=0;for(int i=0;i<n;i++)s+=a[i];return s;}'
+teststat 'induction pointers' 2 -O1 'void f(int *a,int *b,int n){for(int i=0;i<n;i++)a[i]=b[2*i+1];}'
+teststat 'induction tests' 0 -O1 'int f(int *a,int n){int s=0;for(int i=0;i<n;i++)s+=a[i]+i;return s;}'
+teststat 'induction tests' 0 -O1 'int f(char *a,int n){int i;for(i=0;i<n;i++)a[i]=0;return i;}'
+teststat 'induction pointers' 0 -O1 'int f(int *a,int n){int s=0;for(int i=0;i<n;i++){s+=a[i];i+=s&1;}return s;}'
+teststat 'vectorize loops' 1 -O1 'void f(float *c,float *a,float *b,float k,int n){for(int i=0;i<n;i++)c[i]=a[i]*b[i]+k;}'
+teststat 'vectorize loops' 1 -O1 'int f(int *a,int n){int s=0;for(int i=0;i<n;i++)s+=a[i];return s;}'
+teststat 'vectorize loops' 1 -O1 'int f(int *a,int n){int m=a[0];for(int i=1;i<n;i++)if(a[i]<m)m=a[i];return m;}'
+teststat 'vectorize loops' 0 -O1 'float f(float *a,int n){float s=0;for(int i=0;i<n;i++)s+=a[i];return s;}'
+teststat 'vectorize loops' 0 -O1 'void f(int *a,int n){for(int i=0;i<n;i++)a[i]=a[i+1];}'
+teststat 'vectorize loops' 0 -O1 'void f(int *a,int n){for(int i=0;i<n;i++)a[i]=i;}'
+
+testrun '268435455 613566756 3 306783378 8 613566756' -O0 'int printf(char *fmt, ...);int main(){unsigned int u=0xFFFFFFFFu,v=2147483648u,w=7;printf("%u %u %u %u %u %u", u/16, u/7, u%7, v/7, v%10, u/w);return 0;}'
+testrun '268435455 613566756 3 306783378 8 613566756' -O1 'int printf(char *fmt, ...);int main(){unsigned int u=0xFFFFFFFFu,v=2147483648u,w=7;printf("%u %u %u %u %u %u", u/16, u/7, u%7, v/7, v%10, u/w);return 0;}'
+
+testrun '543216 13' -O0 'int printf(char *fmt, ...);int rot(int a,int b,int c,int d,int e,int f){int t=f;f=e;e=d;d=c;c=b;b=a;a=t;return a+b*10+c*100+d*1000+e*10000+f*100000;}int mid(char a,int,long c){return a*10+c;}int main(){printf("%d %d", rot(1,2,3,4,5,6), mid(1,2,3));return 0;}'
+testrun '543216 13' -O1 'int printf(char *fmt, ...);int rot(int a,int b,int c,int d,int e,int f){int t=f;f=e;e=d;d=c;c=b;b=a;a=t;return a+b*10+c*100+d*1000+e*10000+f*100000;}int mid(char a,int,long c){return a*10+c;}int main(){printf("%d %d", rot(1,2,3,4,5,6), mid(1,2,3));return 0;}'
+testrun '14 86 33 5 6' -O1 'int printf(char *fmt, ...);int f(int a,int b){return a*10+b;}int k(int a){int x=a*2;int y;return x+((y=3)*1)+y;}int g(int a){int x=a*2;int y;return f(x,(y=3)+0)+y;}int k2(int a){int x=a*2;int y;return (x+(y=3))*y;}int c(int a){int x=a+1;int y;if(x<(y=5))return y;return y+1;}int main(){printf("%d %d %d %d %d", k(4), g(4), k2(4), c(1), c(9));return 0;}'
+testrun '40 130' -O1 'int printf(char *fmt, ...);void axpy(int *y,int *x,int k,int n){for(int i=0;i<n;i++)y[i]=x[i]*k+y[i];}int main(){int x[11],y[11];for(int i=0;i<11;i++){x[i]=i;y[i]=i*i;}axpy(y,x,3,11);printf("%d %d", y[0]+y[5], y[10]);return 0;}'
+
+teststat 'frame f' 8 -O0 'int f(){{int a=1;a=a+1;}{int b=2;b=b+1;}return 0;}'
+teststat 'frame f' 8 -O0 'int f(){int a=1;a=a+1;int b=2;b=b+1;return b;}'
+teststat 'frame f' 16 -O0 'int f(){char c=1;long l=2;char d=3;return c+l+d;}'
+teststat 'frame f' '16 red-zone' -O1 'int f(){int a[4];a[0]=1;return a[0];}'
+teststat 'frame f' 160 -O1 'int f(){int a[40];a[0]=1;return a[0];}'
+teststat 'frame f' 8 -O0 'int f(int a){int x=a+1;int y=x*2;return y;}'
+teststat 'frame f' 16 -O0 'int f(int a,int b,int c){int x=a+b*c;return x;}'
+teststat 'frame f' '0 red-zone' -O1 'int f(int a,int b,int c){int x=a+b*c;return x;}'
+
+testasm test/function.c
+testasm test/function.c -O1
+testasm test/struct.c -O1
+
 echo "All tests passed"
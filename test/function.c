@@ -75,6 +75,70 @@ static int t10(int a, int, int c) {
   expect(3, c);
 }
 
+static int t11a(int n) {
+  return n + 1;
+}
+
+static int t11(int a, char b, short c) {
+  int d = 4, e = 5, f = 6, g = 7, h = 8;
+  long sum = 0;
+  for (int i = 0; i < 3; i++) {
+    sum += a + b + c + d + e + f + g + h + t11a(i);
+  }
+  expect(-1, (char)(b - 4));
+  return sum;
+}
+
+static double t12(double a, float b) {
+  double x = a * 2, y = b - 1;
+  float z = a / b;
+  return x + y + z - (x - y) / z;
+}
+
+static int t13(void) {
+  int x = 9, y = 3, s = 1;
+  double d = 0.5;
+  expect(12, t7(x / y, t11a(3)));
+  t3(1, 2, t11a(1) + 1, 4, x / y + 2, 3 << s);
+  expect_double(5.75, t12(d * 6, (float)(x / y) / 2));
+  return 0;
+}
+
+static long t14a(long n, long acc) {
+  if (n == 0) {
+    return acc;
+  }
+  return t14a(n - 1, acc + n);
+}
+
+static int t14b(int n);
+static int t14c(int n) {
+  return n == 0 ? 0 : t14b(n - 1);
+}
+
+static int t14b(int n) {
+  if (n == 0) {
+    return 1;
+  }
+  return t14c(n - 1);
+}
+
+static double t14d(char c, double acc) {
+  if (c == 0) {
+    return acc;
+  }
+  return t14d(c - 1, acc + 0.5);
+}
+
+static int t14e(int *p, int n) {
+  return *p + n;
+}
+
+static int t14(int n) {
+  int x = n * 2;
+  return t14e(&x, n);
+}
+
 static void test_int(int a, ...) {
   va_list ap;
   va_start(ap, a);
@@ -133,6 +197,14 @@ void testmain() {
   expect(0, t8("test"));
   expect(94, t9(1, 1.23, 2, 2.34, 3, 3.45, 4, 4.56, 5, 5.67, 6, 6.78, 7, 7.89, 8, 8.90, 9, 9.01));
   t10(1, 2, 3);
+  expect(102, t11(1, 3, -2));
+  expect_double(5.75, t12(3.0, 1.5));
+  t13();
+  expect(500500, t14a(1000, 0));
+  expect(1, t14b(1000));
+  expect(0, t14c(1000));
+  expect_double(50.0, t14d(100, 0.0));
+  expect(21, t14(7));
 
   test_int(1, 2, 3, 5, 8);
   test_float(1.0, 2.0, 4.0, 8.0);
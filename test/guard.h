@@ -0,0 +1,9 @@
+// header with a classic include guard
+#ifndef TEST_GUARD_H
+#define TEST_GUARD_H
+
+struct guarded {
+  int value;
+};
+
+#endif
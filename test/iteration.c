@@ -48,10 +48,274 @@ static void test_continue() {
   expect(9, ans[4]);
 }
 
+static void test_continue_loops() {
+  int i = 0, n = 0;
+  while (i < 10) {
+    i++;
+    if (i % 3 == 0) continue;
+    n++;
+  }
+  expect(7, n);
+
+  i = 0;
+  n = 0;
+  do {
+    i++;
+    if (i % 2 == 0) continue;
+    n++;
+  } while (i < 10);
+  expect(10, i);
+  expect(5, n);
+
+  n = 0;
+  for (i = 0; i < 10;) {
+    i++;
+    if (i > 4) continue;
+    n++;
+  }
+  expect(10, i);
+  expect(4, n);
+
+  n = 0;
+  for (;;) {
+    if (++n == 5) break;
+  }
+  expect(5, n);
+
+  n = 0;
+  for (int j = 0, k = 8; j < 5 && k > 0; j++, k -= 2) {
+    n += k;
+  }
+  expect(20, n);
+}
+
+static int licm_global = 3;
+
+static int licm_bump(int *p) {
+  *p += 1;
+  return *p;
+}
+
+static void test_invariant() {
+  int a[16], n = 4, m = 3, s = 0;
+  for (int i = 0; i < 16; i++) {
+    a[i] = i;
+  }
+  for (int i = 0; i < n * m; i++) {
+    s += a[i] * (n + m) + n * m;
+  }
+  expect(606, s);
+
+  int k, x = 0;
+  for (k = n * 2; k < 10; k++) {
+    x += k;
+  }
+  expect(17, x);
+
+  // stores through a pointer may change a global or an addressed variable
+  int *p = &licm_global, t = 0;
+  for (int i = 0; i < 3; i++) {
+    t += licm_global * 2;
+    *p += 1;
+  }
+  expect(24, t);
+  int c = 1;
+  t = 0;
+  for (int i = 0; i < 3; i++) {
+    t += licm_bump(&c);
+    t += c * 10;
+  }
+  expect(99, t);
+
+  // an invariant in a loop that never runs must not trap
+  int zero = 0, y = 0;
+  while (zero) {
+    y += n / zero;
+  }
+  expect(0, y);
+
+  double d = 1.5, e = 0;
+  int j = 0;
+  do {
+    e += d * 2 + j;
+    j++;
+  } while (j < n - 1);
+  expect(12, e);
+
+  s = 0;
+  for (int i = 0; i < 3; i++) {
+    for (int l = 0; l < 2; l++) {
+      s += i * n + l * m + n * m;
+    }
+  }
+  expect(105, s);
+}
+
+static int induction_sum(int *a, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++) {
+    s += a[i];
+  }
+  return s;
+}
+
+static void test_induction() {
+  int a[10], b[10], m[3][4], i;
+  long l[5];
+  for (int k = 0; k < 10; k++) {
+    a[k] = k * 3;
+  }
+  expect(135, induction_sum(a, 10));
+  expect(0, induction_sum(a, 0));
+  expect(0, induction_sum(a, -2));
+
+  for (int k = 0; k < 9; k++) {
+    b[k] = a[k + 1] - a[k];
+  }
+  expect(3, b[0]);
+  expect(3, b[8]);
+
+  int s = 0;
+  for (int k = 0; k < 5; k++) {
+    s += a[k * 2];
+  }
+  expect(60, s);
+
+  s = 0;
+  for (int k = 9; k >= 0; k -= 3) {
+    s += a[k];
+  }
+  expect(54, s);
+
+  s = 0;
+  for (int k = 0; k < 5; k++) {
+    s += a[9 - k];
+  }
+  expect(105, s);
+
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      m[r][c] = r * 10 + c;
+    }
+  }
+  s = 0;
+  for (int r = 0; r < 3; r++) {
+    s += m[r][2];
+  }
+  expect(36, s);
+
+  long t = 0;
+  for (long k = 0; k < 5; k++) {
+    l[k] = k * 100;
+  }
+  for (long k = 1; k != 5; k++) {
+    t += l[k];
+  }
+  expect(1000, t);
+
+  s = 0;
+  for (int k = 0; k < 10; k++) {
+    if (a[k] % 2) {
+      continue;
+    }
+    s += a[k];
+  }
+  expect(60, s);
+
+  s = 0;
+  for (i = 0; i < 10 && a[i] < 12; i++) {
+    s += a[i];
+  }
+  expect(4, i);
+  expect(18, s);
+}
+
+static int vector_data[50];
+
+static void vector_axpy(float *c, float *a, float *b, float k, int n) {
+  for (int i = 0; i < n; i++) {
+    c[i] = a[i] * b[i] + k;
+  }
+}
+
+static void vector_mul(int *c, int *a, int *b, int n) {
+  for (int i = 0; i < n; i++) {
+    c[i] = a[i] * b[i] - 3;
+  }
+}
+
+static void test_vectorize() {
+  float fa[11], fb[11], fc[11];
+  double da[7], db[7];
+  int ia[20], ib[20], i;
+  for (i = 0; i < 11; i++) {
+    fa[i] = i;
+    fb[i] = i + 0.5f;
+  }
+  vector_axpy(fc, fa, fb, 2, 11);
+  expect(2, fc[0]);
+  expect(7, fc[2]);
+  expect(107, fc[10]);
+
+  for (i = 0; i < 7; i++) {
+    da[i] = i * 2;
+    db[i] = 1;
+  }
+  for (i = 1; i != 7; i++) {
+    db[i] += da[i] / 4.0;
+  }
+  expect(7, i);
+  expect(1, db[0]);
+  expect(2, db[2]);
+  expect(4, db[6]);
+
+  for (i = 0; i < 20; i++) {
+    ia[i] = i;
+    ib[i] = 20 - i;
+  }
+  vector_mul(ib, ia, ib, 3);
+  expect(-3, ib[0]);
+  expect(33, ib[2]);
+  expect(17, ib[3]);
+  // overlapping arrays take the scalar loop
+  vector_mul(ia + 1, ia, ib, 10);
+  expect(0, ia[0]);
+  expect(-3, ia[1]);
+  expect(-51, ia[2]);
+  expect(-1686, ia[3]);
+  expect(11, ia[11]);
+
+  int s = 0, lo = 100, hi = 0;
+  for (i = 0; i < 50; i++) {
+    vector_data[i] = (i * 37) % 50 + 1;
+  }
+  for (int j = 0; j < 50; j++) {
+    s += vector_data[j] * 2;
+    if (vector_data[j] < lo) {
+      lo = vector_data[j];
+    }
+    if (hi < vector_data[j]) {
+      hi = vector_data[j];
+    }
+  }
+  expect(2550, s);
+  expect(1, lo);
+  expect(50, hi);
+  s = 1000;
+  for (int j = 3; j < 14; j++) {
+    s -= vector_data[j];
+  }
+  expect(683, s);
+}
+
 void testmain() {
   test_while();
   test_do_while();
   test_for();
   test_break();
   test_continue();
+  test_continue_loops();
+  test_invariant();
+  test_induction();
+  test_vectorize();
 }
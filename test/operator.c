@@ -107,6 +107,110 @@ static void test_assign() {
   expect(64, a6);
 }
 
+static void test_fold() {
+  int y = 7;
+  int x = 3 * 4 + y * 0;
+  expect(12, x);
+  expect(7, y * 1 + 0);
+  const int k = 10;
+  expect(20, k * 2);
+  expect(1, 1 << 31 < 0);
+  expect(1, ~0u > 0);
+
+  int a[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  int *p = a + 2 + 3;
+  expect(5, *p);
+  expect(6, *(p - 1 + 2));
+  expect(10, sizeof(a) / sizeof(a[0]));
+  expect_double(3.5, 1.5 * 2 - -0.5);
+  expect_float(0.3f, 0.1f * 3);
+}
+
+static void test_strength() {
+  char c = -100;
+  unsigned char uc = 100;
+  short s = -30000;
+  unsigned short us = 30000;
+  int i = -1000001;
+  unsigned int ui = 2000000001;
+  long l = -1000000000001L;
+  unsigned long ul = 18000000000000000001ul;
+  long long ll = 999999999999L;
+
+  expect(-25, c / 4);
+  expect(0, c % 4);
+  expect(-14, c / 7);
+  expect(-2, c % 7);
+  expect(-800, c * 8);
+  expect(-300, c * 3);
+  expect(25, uc / 4);
+  expect(2, uc % 7);
+  expect(900, uc * 9);
+
+  expect(-1875, s / 16);
+  expect(-4285, s / 7);
+  expect(-5, s % 7);
+  expect(4285, s / -7);
+  expect(-150000, s * 5);
+  expect(3750, us / 8);
+  expect(30, us / 1000);
+  expect(0, us % 1000);
+
+  expect(-1000001, i / 1);
+  expect(1000001, i / -1);
+  expect(-62500, i / 16);
+  expect(-1, i % 16);
+  expect(-142857, i / 7);
+  expect(-2, i % 7);
+  expect(100000, i / -10);
+  expect(-1, i % -10);
+  expect(-7000007, i * 7);
+  expect(-12000012, i * 12);
+  expect(-1, -5 % 2 == -1 ? -1 : 0);
+  expect(1, ui / 1000000000 == 2);
+  expect(1, ui % 1000000000 == 1);
+  expect(1, ui / 4 == 500000000);
+  expect(1, ui % 4 == 1);
+  unsigned int umax = 0xFFFFFFFFu;
+  unsigned int uhalf = 2147483648u;
+  unsigned int useven = 7;
+  expect(268435455, umax / 16);
+  expect(15, umax % 16);
+  expect(613566756, umax / 7);
+  expect(3, umax % 7);
+  expect(306783378, uhalf / 7);
+  expect(8, uhalf % 10);
+  expect(1073741824, uhalf / 2);
+  expect(613566756, umax / useven);
+  expect(3, umax % useven);
+
+  expect(1, l / 1000 == -1000000000);
+  expect(1, l % 1000 == -1);
+  expect(1, l / 4096 == -244140625);
+  expect(1, l % 4096 == -1);
+  expect(1, l / 3 == -333333333333L);
+  expect(1, l % 3 == -2);
+  expect(1, l * 10 == -10000000000010L);
+  expect(1, l / 1099511627776L == 0);
+  expect(1, ul / 10 == 1800000000000000000ul);
+  expect(1, ul % 10 == 1);
+  expect(1, ul / 7 == 2571428571428571428ul);
+  expect(1, ul % 7 == 5);
+  expect(1, ul / 65536 == 274658203125000ul);
+  expect(1, ul % 65536 == 1);
+  expect(1, ll / 9 == 111111111111L);
+  expect(1, ll % 1000000007 == 999993006);
+  expect(1, ll * 64 == 63999999999936L);
+
+  int n = 13;
+  n /= 4;
+  expect(3, n);
+  n *= 5;
+  expect(15, n);
+  n %= 8;
+  expect(7, n);
+}
+
 void testmain() {
   test_basic();
   test_inc_dec();
@@ -114,4 +218,6 @@ void testmain() {
   test_ternary();
   test_comp();
   test_assign();
+  test_fold();
+  test_strength();
 }
@@ -1,4 +1,8 @@
 #include "test/test.h"
+#include "test/guard.h"
+#include "test/guard.h"
+#include "test/once.h"
+#include "test/once.h"
 
 #define ZERO 0
 #define ONE 1
@@ -294,6 +298,13 @@ static void test_ifdef() {
   expect(a, 7);
 }
 
+static void test_include_once() {
+  struct guarded g = {1};
+  struct once o = {2};
+  expect(1, g.value);
+  expect(2, o.value);
+}
+
 void testmain() {
   test_basic();
   test_loop();
@@ -306,4 +317,5 @@ void testmain() {
   test_cond_incl();
   test_defined();
   test_ifdef();
+  test_include_once();
 }
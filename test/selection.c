@@ -24,6 +24,118 @@ static void test_basic() {
   expect('j', testif10());
 }
 
+static int switch_chain(int n) {
+  switch (n) {
+  case 1: return 10;
+  case 3: return 30;
+  default: return -1;
+  }
+}
+
+static int switch_table(int n) {
+  int r = 0;
+  switch (n) {
+  case -2: r = 1; break;
+  case 0: r = 2; break;
+  case 1: r = 3;
+  case 2: r += 4; break;
+  case 4: r = 5; break;
+  case 5: r = 6; break;
+  case 7: r = 7; break;
+  }
+  return r;
+}
+
+static int switch_tree(long n) {
+  switch (n) {
+  case 1000000: return 1;
+  case -50: return 2;
+  case 7: return 3;
+  case 300: return 4;
+  case 99999: return 5;
+  case 42: return 6;
+  case -100000: return 7;
+  case 12345: return 8;
+  case 64: return 9;
+  default: return 0;
+  }
+}
+
+static void test_switch() {
+  expect(10, switch_chain(1));
+  expect(30, switch_chain(3));
+  expect(-1, switch_chain(2));
+
+  expect(1, switch_table(-2));
+  expect(0, switch_table(-1));
+  expect(2, switch_table(0));
+  expect(7, switch_table(1));
+  expect(4, switch_table(2));
+  expect(0, switch_table(3));
+  expect(5, switch_table(4));
+  expect(7, switch_table(7));
+  expect(0, switch_table(8));
+  expect(0, switch_table(-100));
+
+  expect(1, switch_tree(1000000));
+  expect(2, switch_tree(-50));
+  expect(3, switch_tree(7));
+  expect(4, switch_tree(300));
+  expect(5, switch_tree(99999));
+  expect(6, switch_tree(42));
+  expect(7, switch_tree(-100000));
+  expect(8, switch_tree(12345));
+  expect(9, switch_tree(64));
+  expect(0, switch_tree(8));
+  expect(0, switch_tree(-51));
+  expect(0, switch_tree(2000000));
+}
+
+static int cond_and(int a, int b) { if (a > 0 && b > 0) return 1; return 0; }
+static int cond_or(int a, int b) { if (a > 0 || b > 0) return 1; return 0; }
+static int cond_not(int a, int b) { if (!(a == 1 || b != 2)) return 1; else return 0; }
+static int cond_mixed(int a, int b, int c) { if ((a < b && b <= c) || !(c >= 0)) return 1; return 0; }
+static int cond_unsigned(unsigned int a, int b) { if (a < b) return 1; return 0; }
+static int cond_double(double x, float y) { if (x > y && !(x >= 2.5)) return 1; return 0; }
+static int cond_ptr(char *p) { if (p && *p == 'a') return 1; return 0; }
+
+static void test_cond() {
+  expect(1, cond_and(1, 2));
+  expect(0, cond_and(1, 0));
+  expect(0, cond_and(0, 1));
+  expect(1, cond_or(0, 1));
+  expect(1, cond_or(1, 0));
+  expect(0, cond_or(0, -1));
+  expect(1, cond_not(2, 2));
+  expect(0, cond_not(1, 2));
+  expect(0, cond_not(2, 3));
+  expect(1, cond_mixed(1, 2, 2));
+  expect(0, cond_mixed(2, 2, 2));
+  expect(1, cond_mixed(5, 2, -1));
+  expect(0, cond_mixed(1, 3, 2));
+  expect(1, cond_unsigned(1, 2));
+  expect(0, cond_unsigned(-1, 2));
+  expect(1, cond_double(2.0, 1.5));
+  expect(0, cond_double(2.5, 1.5));
+  expect(0, cond_double(1.0, 1.5));
+  expect(1, cond_ptr("abc"));
+  expect(0, cond_ptr("bc"));
+  expect(0, cond_ptr(0));
+  expect('k', 3 > 2 && 1 ? 'k' : 0);
+
+  int n = 0;
+  for (int i = 0; i < 10 && n < 5; i++) {
+    n++;
+  }
+  expect(5, n);
+  while (!(n == 0 || n < 0)) {
+    n--;
+  }
+  expect(0, n);
+}
+
 void testmain() {
   test_basic();
+  test_switch();
+  test_cond();
 }
@@ -22,54 +22,44 @@ static const char *token_names[] = {
 };
 
 token_t *token_new(lex_t *lex, int kind) {
-  token_t *token = (token_t *)malloc(sizeof (token_t));
+  token_t *token = (token_t *)arena_alloc(lex->token_arena);
   token->kind = kind;
   token->line = lex->mark_line;
   token->column = lex->mark_column;
   token->is_space = lex->is_space;
   token->hideset = NULL;
   if (kind == TOKEN_MACRO_PARAM || kind == TOKEN_KIND_EOF || kind == TOKEN_KIND_NEWLINE) {
-    token->str = strdup("");
+    token->str = atom_new("");
   } else {
     file_t *f = lex_current_file(lex);
-    token->str = malloc(f->p - lex->mark_p + 1);
-    strncpy(token->str, lex->mark_p, f->p - lex->mark_p);
-    token->str[f->p - lex->mark_p] = '\0';
+    token->str = atom_new_with_len(lex->mark_p, f->p - lex->mark_p);
+  }
+  if (kind == TOKEN_KIND_STRING) {
+    arena_own(lex->token_arena, token);
   }
-  vector_push(lex->tokens, (void *)token);
   return token;
 }
 
+// release what a token owns; the token itself lives in lex->token_arena
+// and its str is an atom
 void token_free(token_t *token) {
-  switch (token->kind) {
-  case TOKEN_KIND_IDENTIFIER:
-    free(token->identifier);
-    break;
-  case TOKEN_KIND_STRING:
+  if (token->kind == TOKEN_KIND_STRING) {
     string_free(token->sval);
-    break;
   }
   if (token->hideset != NULL) {
     vector_free(token->hideset);
   }
-  free(token->str);
-  free(token);
 }
 
 token_t *token_dup(lex_t *lex, token_t *token) {
-  token_t *dup = (token_t *)malloc(sizeof (token_t));
+  token_t *dup = (token_t *)arena_alloc(lex->token_arena);
   memcpy(dup, token, sizeof (token_t));
-  switch (token->kind) {
-  case TOKEN_KIND_IDENTIFIER:
-    dup->identifier = strdup(token->identifier);
-    break;
-  case TOKEN_KIND_STRING:
+  if (token->kind == TOKEN_KIND_STRING) {
     dup->sval = string_dup(token->sval);
-    break;
   }
   dup->hideset = NULL;
-  dup->str = strdup(token->str);
-  vector_push(lex->tokens, (void *)dup);
+  // copies made during macro expansion pick up hidesets
+  arena_own(lex->token_arena, dup);
   return dup;
 }
 
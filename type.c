@@ -18,10 +18,10 @@ const char *type_kind_names[] = {
   "[]",
 };
 
-type_t *type_new_with_size(char *name, int kind, int sign, type_t *parent, int size) {
-  type_t *t = (type_t *)malloc(sizeof (type_t));
+type_t *type_new_with_size(parse_t *parse, char *name, int kind, int sign, type_t *parent, int size) {
+  type_t *t = (type_t *)arena_alloc(parse->type_arena);
   if (name != NULL) {
-    t->name = strdup(name);
+    t->name = atom_new(name);
   } else {
     t->name = NULL;
   }
@@ -77,67 +77,67 @@ type_t *type_new_with_size(char *name, int kind, int sign, type_t *parent, int s
   return t;
 }
 
-type_t *type_new(char *name, int kind, int sign, type_t *parent) {
-  return type_new_with_size(name, kind, sign, parent, 0);
+type_t *type_new(parse_t *parse, char *name, int kind, int sign, type_t *parent) {
+  return type_new_with_size(parse, name, kind, sign, parent, 0);
 }
 
-type_t *type_new_struct(char *name, bool is_struct) {
-  type_t *t = type_new(name, TYPE_KIND_STRUCT, false, NULL);
+type_t *type_new_struct(parse_t *parse, char *name, bool is_struct) {
+  type_t *t = type_new(parse, name, TYPE_KIND_STRUCT, false, NULL);
   t->total_size = 0;
   t->fields = map_new();
   t->is_struct = is_struct;
+  arena_own(parse->type_arena, t);
   return t;
 }
 
-type_t *type_new_typedef(char *name, type_t *type) {
-  type_t *t = (type_t *)malloc(sizeof (type_t));
+type_t *type_new_typedef(parse_t *parse, char *name, type_t *type) {
+  type_t *t = (type_t *)arena_alloc(parse->type_arena);
   memcpy(t, type, sizeof(type_t));
-  t->name = strdup(name);
+  t->name = atom_new(name);
   t->is_typedef = true;
   return t;
 }
 
-type_t *type_new_enum(char *name) {
-  type_t *t = type_new(name, TYPE_KIND_ENUM, false, NULL);
+type_t *type_new_enum(parse_t *parse, char *name) {
+  type_t *t = type_new(parse, name, TYPE_KIND_ENUM, false, NULL);
   t->total_size = 0;
   return t;
 }
 
-type_t *type_new_const(type_t *type) {
+type_t *type_new_const(parse_t *parse, type_t *type) {
   if (type->is_const) {
     return type;
   }
   string_t *name = string_new();
   string_appendf(name, "const %s", type->name);
-  type_t *t = (type_t *)malloc(sizeof (type_t));
+  type_t *t = (type_t *)arena_alloc(parse->type_arena);
   memcpy(t, type, sizeof(type_t));
-  t->name = strdup(name->buf);
+  t->name = atom_new(name->buf);
   t->is_const = true;
   string_free(name);
   return t;
 }
 
-type_t *type_new_stub() {
-  type_t *t = type_new(NULL, TYPE_KIND_STUB, false, NULL);
+type_t *type_new_stub(parse_t *parse) {
+  type_t *t = type_new(parse, NULL, TYPE_KIND_STUB, false, NULL);
   string_t *name = string_new();
   string_appendf(name, "$stub%p", t);
-  t->name = strdup(name->buf);
+  t->name = atom_new(name->buf);
   string_free(name);
   return t;
 }
 
+// release what a type owns; the type itself lives in parse->type_arena and
+// only types registered with arena_own() get here
 void type_free(type_t *t) {
-  if (t->name != NULL) {
-    free(t->name);
-  }
-  if (!t->is_typedef) {
+  // typedef and const types share fields/argtypes with their original
+  if (!t->is_typedef && !t->is_const) {
     if (t->kind == TYPE_KIND_FUNCTION) {
       vector_free(t->argtypes);
     } else if (t->fields != NULL) {
       map_free(t->fields);
     }
   }
-  free(t);
 }
 
 type_t *type_find(parse_t *parse, char *name) {
@@ -164,7 +164,7 @@ void type_add(parse_t *parse, char *name, type_t *type) {
 type_t *type_get(parse_t *parse, char *name, type_t *parent) {
   type_t *type = type_find(parse, name);
   if (type == NULL && parent != NULL) {
-    type = type_new(name, TYPE_KIND_PTR, false, parent);
+    type = type_new(parse, name, TYPE_KIND_PTR, false, parent);
     type_add(parse, name, type);
   }
   return type;
@@ -173,7 +173,7 @@ type_t *type_get(parse_t *parse, char *name, type_t *parent) {
 type_t *type_get_ptr(parse_t *parse, type_t *type) {
   string_t *name = string_new_with(type->name);
   string_add(name, '*');
-  type = type_get(parse, name->buf, type);
+  type = type_get(parse, atom_new(name->buf), type);
   if (type == NULL) {
     errorf("get pointer type error: &%s", type->name);
   }
@@ -199,13 +199,14 @@ type_t *type_get_function(parse_t *parse, type_t *rettype, vector_t *argtypes, b
     string_append(name, "...");
   }
   string_append(name, ")");
-  type_t *type = (type_t *)map_get(parse->types, name->buf);
+  type_t *type = (type_t *)map_get(parse->types, atom_new(name->buf));
   if (type == NULL) {
-    type = type_new(name->buf, TYPE_KIND_FUNCTION, false, NULL);
+    type = type_new(parse, name->buf, TYPE_KIND_FUNCTION, false, NULL);
     type->parent = rettype;
     type->argtypes = vector_dup(argtypes);
     type->is_vaargs = is_vaargs;
-    map_add(parse->types, name->buf, type);
+    arena_own(parse->type_arena, type);
+    map_add(parse->types, type->name, type);
   }
   string_free(name);
   return type;
@@ -217,10 +218,10 @@ type_t *type_get_const(parse_t *parse, type_t *type) {
   }
   string_t *name = string_new();
   string_appendf(name, "const %s", type->name);
-  type_t *t = (type_t *)map_get(parse->types, name->buf);
+  type_t *t = (type_t *)map_get(parse->types, atom_new(name->buf));
   if (t == NULL) {
-    t = type_new_const(type);
-    map_add(parse->types, name->buf, t);
+    t = type_new_const(parse, type);
+    map_add(parse->types, t->name, t);
   }
   string_free(name);
   return t;
@@ -253,8 +254,8 @@ type_t *type_get_by_tag(parse_t *parse, char *tag, bool local_only) {
 }
 
 type_t *type_add_typedef(parse_t *parse, char *name, type_t *type) {
-  type = type_new_typedef(name, type);
-  type_add(parse, name, type);
+  type = type_new_typedef(parse, name, type);
+  type_add(parse, type->name, type);
   return type;
 }
 
@@ -280,10 +281,10 @@ type_t *type_make_array(parse_t *parse, type_t *parent, int size) {
     }
     string_appendf(str, "[%d]", p->size);
   }
-  type_t *type = type_find(parse, str->buf);
+  type_t *type = type_find(parse, atom_new(str->buf));
   if (type == NULL) {
-    type = type_new_with_size(str->buf, TYPE_KIND_ARRAY, false, parent, size);
-    type_add(parse, str->buf, type);
+    type = type_new_with_size(parse, str->buf, TYPE_KIND_ARRAY, false, parent, size);
+    type_add(parse, type->name, type);
   }
   string_free(str);
   return type;
@@ -0,0 +1,512 @@
+// Copyright 2019 @htz. Released under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hcc.h"
+
+/*
+ * Loop vectorizer.
+ *
+ * Plans packed SSE2 code for counted for loops: the induction variable
+ * starts anywhere, is incremented by one and compared against a loop
+ * invariant bound with < or !=. Every statement of the body must be one of
+ *
+ *   base[i] = e;  base[i] op= e;       element-wise stores
+ *   s += e;  s -= e;  s = s + e;       integer sums
+ *   if (e < s) s = e;  (and > forms)   integer minimum and maximum
+ *
+ * where base is an array or pointer variable and e is built from + - *
+ * (and / for floating point, & | ^ for integers) over loads base[i + c]
+ * and loop invariants, all of one element type: float, double or 32-bit
+ * integer. Floating point reductions are left scalar, since reassociating
+ * them changes the result.
+ *
+ * A stored array may only be read at the same index, so no value flows
+ * between iterations of one vector. Different bases may still overlap
+ * unless both are array variables; gen.c then checks the ranges accessed
+ * by the vector iterations at run time and falls back to the scalar loop
+ * when they intersect. The scalar loop also runs the remaining iterations.
+ */
+
+typedef struct vectorizer vectorizer_t;
+struct vectorizer {
+  parse_t *parse;
+  loop_info_t loop;     // side effects of the current loop
+  vloop_t *vl;
+  int loops;
+};
+
+static void walk(vectorizer_t *v, node_t *node);
+
+// Whether values of type are packed the same way as vector elements of elem
+static bool is_elem(type_t *type, type_t *elem) {
+  if (type_is_int(type) && type_is_int(elem)) {
+    return type->bytes == 4 && elem->bytes == 4;
+  }
+  return type->kind == elem->kind && (type->kind == TYPE_KIND_FLOAT || type->kind == TYPE_KIND_DOUBLE);
+}
+
+// The element offset of the index iv, iv + c, c + iv or iv - c
+static bool index_offset(vectorizer_t *v, node_t *idx, int *offset) {
+  *offset = 0;
+  if (idx == v->vl->iv) {
+    return true;
+  }
+  if (idx->kind != NODE_KIND_BINARY_OP || (idx->op != '+' && idx->op != '-')) {
+    return false;
+  }
+  node_t *lit = idx->right;
+  if (idx->left != v->vl->iv) {
+    if (idx->op != '+' || idx->right != v->vl->iv) {
+      return false;
+    }
+    lit = idx->left;
+  }
+  if (lit->kind != NODE_KIND_LITERAL || !type_is_int(lit->type) || lit->ival < -4096 || lit->ival > 4096) {
+    return false;
+  }
+  *offset = idx->op == '-' ? -lit->ival : lit->ival;
+  return true;
+}
+
+static int add_base(vectorizer_t *v, node_t *var, int offset) {
+  vector_t *bases = v->vl->bases;
+  for (int i = 0; i < bases->size; i++) {
+    vbase_t *b = (vbase_t *)bases->data[i];
+    if (b->var == var) {
+      b->lo = min(b->lo, offset);
+      b->hi = max(b->hi, offset);
+      return i;
+    }
+  }
+  vbase_t *b = (vbase_t *)malloc(sizeof (vbase_t));
+  b->var = var;
+  b->lo = b->hi = offset;
+  b->stored = false;
+  vector_push(bases, b);
+  return bases->size - 1;
+}
+
+// The base and offset of the element *(base + index), or -1
+static int element(vectorizer_t *v, node_t *node, int *offset) {
+  if (node->kind != NODE_KIND_UNARY_OP || node->op != '*' || node->next != NULL ||
+      !is_elem(node->type, v->vl->elem)) {
+    return -1;
+  }
+  node_t *addr = node->operand;
+  if (addr->kind != NODE_KIND_BINARY_OP || addr->op != '+' || addr->left->kind != NODE_KIND_VARIABLE ||
+      (addr->left->type->kind != TYPE_KIND_PTR && addr->left->type->kind != TYPE_KIND_ARRAY) ||
+      addr->left->type->parent->kind != node->type->kind || !loop_is_invariant(&v->loop, addr->left) ||
+      !index_offset(v, addr->right, offset)) {
+    return -1;
+  }
+  return add_base(v, addr->left, *offset);
+}
+
+static vexpr_t *vexpr_new(int kind) {
+  vexpr_t *e = (vexpr_t *)calloc(1, sizeof (vexpr_t));
+  e->kind = kind;
+  return e;
+}
+
+static vexpr_t *vexpr_op(int op, vexpr_t *left, vexpr_t *right) {
+  vexpr_t *e = vexpr_new(VEXPR_OP);
+  e->op = op;
+  e->left = left;
+  e->right = right;
+  return e;
+}
+
+static vexpr_t *vexpr_load(int base, int offset) {
+  vexpr_t *e = vexpr_new(VEXPR_LOAD);
+  e->base = base;
+  e->offset = offset;
+  return e;
+}
+
+// Translates an element-wise expression, or returns NULL
+static vexpr_t *translate(vectorizer_t *v, node_t *node) {
+  vloop_t *vl = v->vl;
+  if (node->next != NULL || !is_elem(node->type, vl->elem)) {
+    return NULL;
+  }
+  if (loop_is_invariant(&v->loop, node)) {
+    vexpr_t *e = vexpr_new(VEXPR_BROADCAST);
+    for (e->fixed = 0; e->fixed < vl->fixed->size; e->fixed++) {
+      node_t *f = (node_t *)vl->fixed->data[e->fixed];
+      if (f != NULL && loop_same_expr(f, node)) {
+        return e;
+      }
+    }
+    vector_push(vl->fixed, node);
+    return e;
+  }
+  int offset;
+  switch (node->kind) {
+  case NODE_KIND_UNARY_OP:
+    if (node->op == OP_CAST && type_is_int(node->type)) {
+      // between int and unsigned int
+      return translate(v, node->operand);
+    }
+    if (node->op == '*') {
+      int base = element(v, node, &offset);
+      return base < 0 ? NULL : vexpr_load(base, offset);
+    }
+    break;
+  case NODE_KIND_BINARY_OP:
+    switch (node->op) {
+    case '+': case '-': case '*':
+      break;
+    case '/':
+      if (type_is_int(node->type)) {
+        return NULL;
+      }
+      break;
+    case '&': case '|': case '^':
+      if (!type_is_int(node->type)) {
+        return NULL;
+      }
+      break;
+    default:
+      return NULL;
+    }
+    vexpr_t *left = translate(v, node->left);
+    vexpr_t *right = left ? translate(v, node->right) : NULL;
+    return right ? vexpr_op(node->op, left, right) : NULL;
+  }
+  return NULL;
+}
+
+// Registers gen.c needs to evaluate e
+static int depth(vloop_t *vl, vexpr_t *e) {
+  if (e->kind != VEXPR_OP) {
+    return 1;
+  }
+  int n = max(depth(vl, e->left), depth(vl, e->right) + 1);
+  if (e->op == '*' && type_is_int(vl->elem)) {
+    // 32-bit multiplies are pieced together from pmuludq
+    n = max(n, 3);
+  }
+  return n;
+}
+
+// Counts the occurrences of var in node
+static int count_uses(node_t *node, node_t *var) {
+  int n = 0;
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_VARIABLE:
+      n += node == var;
+      break;
+    case NODE_KIND_DECLARATION:
+      n += count_uses(node->dec_init, var);
+      break;
+    case NODE_KIND_BINARY_OP:
+      n += count_uses(node->left, var);
+      if (node->op != '.') {
+        n += count_uses(node->right, var);
+      }
+      break;
+    case NODE_KIND_UNARY_OP:
+      n += count_uses(node->operand, var);
+      break;
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        n += count_uses((node_t *)node->statements->data[i], var);
+      }
+      break;
+    case NODE_KIND_IF:
+      n += count_uses(node->cond, var) + count_uses(node->then_body, var) + count_uses(node->else_body, var);
+      break;
+    }
+  }
+  return n;
+}
+
+static vstmt_t *vstmt_new(int op, node_t *var, node_t *value, node_t **expr) {
+  vstmt_t *s = (vstmt_t *)calloc(1, sizeof (vstmt_t));
+  s->op = op;
+  s->var = var;
+  *expr = value;
+  return s;
+}
+
+// Matches a store or reduction statement; its value expr is translated by plan()
+static vstmt_t *match(vectorizer_t *v, node_t *node, node_t **expr) {
+  if (node->next != NULL) {
+    return NULL;
+  }
+  if (node->kind == NODE_KIND_IF) {
+    // if (x < s) s = x;
+    node_t *cond = node->cond, *then = node->then_body;
+    if (then != NULL && then->kind == NODE_KIND_BLOCK && then->statements->size == 1) {
+      then = (node_t *)then->statements->data[0];
+    }
+    if (node->else_body != NULL || then == NULL || then->kind != NODE_KIND_BINARY_OP || then->op != '=' ||
+        then->next != NULL || cond->kind != NODE_KIND_BINARY_OP || cond->next != NULL ||
+        !cond->left->type->sign || !cond->right->type->sign) {
+      return NULL;
+    }
+    bool less;
+    switch (cond->op) {
+    case '<': case OP_LE:
+      less = true;
+      break;
+    case '>': case OP_GE:
+      less = false;
+      break;
+    default:
+      return NULL;
+    }
+    node_t *var = then->left, *value = then->right;
+    if (cond->left == var && loop_same_expr(cond->right, value)) {
+      less = !less;
+    } else if (cond->right != var || !loop_same_expr(cond->left, value)) {
+      return NULL;
+    }
+    return vstmt_new(less ? '<' : '>', var, value, expr);
+  }
+  if (node->kind != NODE_KIND_BINARY_OP) {
+    return NULL;
+  }
+  node_t *left = node->left, *right = node->right;
+  if (left->kind == NODE_KIND_UNARY_OP && left->op == '*') {
+    switch (node->op) {
+    case '=':
+      return vstmt_new('=', left, right, expr);
+    case '+' | OP_ASSIGN_MASK: case '-' | OP_ASSIGN_MASK: case '*' | OP_ASSIGN_MASK: case '/' | OP_ASSIGN_MASK:
+    case '&' | OP_ASSIGN_MASK: case '|' | OP_ASSIGN_MASK: case '^' | OP_ASSIGN_MASK:
+      // the compound operator is evaluated at the type of the element
+      right = node_new_binary_op(v->parse, left->type, node->op & ~OP_ASSIGN_MASK, left, right);
+      return vstmt_new('=', left, right, expr);
+    }
+    return NULL;
+  }
+  if (left->kind != NODE_KIND_VARIABLE) {
+    return NULL;
+  }
+  if (node->op == ('+' | OP_ASSIGN_MASK) || node->op == ('-' | OP_ASSIGN_MASK)) {
+    return vstmt_new(node->op & ~OP_ASSIGN_MASK, left, right, expr);
+  }
+  if (node->op == '=' && right->kind == NODE_KIND_BINARY_OP && right->next == NULL) {
+    if (right->op == '+' && right->left == left) {
+      return vstmt_new('+', left, right->right, expr);
+    }
+    if (right->op == '+' && right->right == left) {
+      return vstmt_new('+', left, right->left, expr);
+    }
+    if (right->op == '-' && right->left == left) {
+      return vstmt_new('-', left, right->right, expr);
+    }
+  }
+  return NULL;
+}
+
+// Plans the statements of the loop body; false if one cannot be vectorized
+static bool plan(vectorizer_t *v, node_t *loop, vector_t *nodes, vector_t *exprs) {
+  vloop_t *vl = v->vl;
+  vector_t *stmts = vl->stmts;
+  for (int i = 0; i < stmts->size; i++) {
+    vstmt_t *s = (vstmt_t *)stmts->data[i];
+    if (vl->elem == NULL) {
+      vl->elem = s->var->type;
+      if (!is_elem(vl->elem, vl->elem)) {
+        return false;
+      }
+    }
+    int offset;
+    if (s->op == '=') {
+      s->base = element(v, s->var, &offset);
+      if (s->base < 0 || offset != 0) {
+        return false;
+      }
+      ((vbase_t *)vl->bases->data[s->base])->stored = true;
+    } else {
+      // integer reductions of a variable only this statement uses
+      node_t *var = s->var;
+      if (!loop_is_local(&v->loop, var) || var == vl->iv || !type_is_int(vl->elem) || !is_elem(var->type, vl->elem) ||
+          ((s->op == '<' || s->op == '>') && !var->type->sign)) {
+        return false;
+      }
+      int uses = count_uses(loop->lcond, var) + count_uses(loop->lstep, var) + count_uses(loop->lbody, var);
+      if (uses != count_uses((node_t *)nodes->data[i], var)) {
+        return false;
+      }
+    }
+    s->value = translate(v, (node_t *)exprs->data[i]);
+    if (s->value == NULL || depth(vl, s->value) > VLOOP_MAX_DEPTH) {
+      return false;
+    }
+  }
+
+  // accumulators follow the broadcast invariants
+  for (int i = 0; i < stmts->size; i++) {
+    vstmt_t *s = (vstmt_t *)stmts->data[i];
+    if (s->op != '=') {
+      s->fixed = vl->fixed->size;
+      vector_push(vl->fixed, NULL);
+    }
+  }
+  if (vl->bases->size > VLOOP_MAX_BASES || vl->fixed->size > VLOOP_MAX_FIXED) {
+    return false;
+  }
+  // a stored array is only read at the element being stored
+  for (int i = 0; i < vl->bases->size; i++) {
+    vbase_t *b = (vbase_t *)vl->bases->data[i];
+    if (b->stored && (b->lo != 0 || b->hi != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Finds the induction variable incremented by step and compared by cond
+static node_t *induction_var(vectorizer_t *v, node_t *cond, node_t *step, node_t **bound) {
+  if (step == NULL || step->next != NULL || cond == NULL || cond->next != NULL ||
+      cond->kind != NODE_KIND_BINARY_OP) {
+    return NULL;
+  }
+  node_t *iv;
+  if (step->kind == NODE_KIND_UNARY_OP && (step->op == OP_INC || step->op == OP_PINC)) {
+    iv = step->operand;
+  } else if (step->kind == NODE_KIND_BINARY_OP && step->op == ('+' | OP_ASSIGN_MASK) &&
+             step->right->kind == NODE_KIND_LITERAL && step->right->ival == 1) {
+    iv = step->left;
+  } else {
+    return NULL;
+  }
+  if (!loop_is_local(&v->loop, iv) || !type_is_int(iv->type) || !iv->type->sign || iv->type->bytes < 4) {
+    return NULL;
+  }
+  if ((cond->op == '<' || cond->op == OP_NE) && cond->left == iv) {
+    *bound = cond->right;
+  } else if ((cond->op == '>' || cond->op == OP_NE) && cond->right == iv) {
+    *bound = cond->left;
+  } else {
+    return NULL;
+  }
+  if (!cond->left->type->sign || !cond->right->type->sign || !type_is_int((*bound)->type)) {
+    return NULL;
+  }
+  return iv;
+}
+
+static void process_loop(vectorizer_t *v, node_t *loop) {
+  walk(v, loop->lbody);
+  if (loop->kind != NODE_KIND_FOR) {
+    return;
+  }
+  node_t *bound;
+  node_t *iv = induction_var(v, loop->lcond, loop->lstep, &bound);
+  if (iv == NULL) {
+    return;
+  }
+
+  vector_t *nodes = vector_new();
+  node_t *body = loop->lbody;
+  if (body->kind == NODE_KIND_BLOCK) {
+    for (int i = 0; i < body->statements->size; i++) {
+      node_t *node = (node_t *)body->statements->data[i];
+      if (node->kind != NODE_KIND_NOP) {
+        vector_push(nodes, node);
+      }
+    }
+  } else {
+    vector_push(nodes, body);
+  }
+
+  vloop_t *vl = (vloop_t *)calloc(1, sizeof (vloop_t));
+  vl->iv = iv;
+  vl->bound = bound;
+  vl->bases = vector_new();
+  vl->fixed = vector_new();
+  vl->stmts = vector_new();
+  vector_t *exprs = vector_new();
+  for (int i = 0; i < nodes->size; i++) {
+    node_t *expr;
+    vstmt_t *s = match(v, (node_t *)nodes->data[i], &expr);
+    if (s == NULL) {
+      break;
+    }
+    vector_push(vl->stmts, s);
+    vector_push(exprs, expr);
+  }
+
+  v->vl = vl;
+  v->loop.written = vector_new();
+  v->loop.calls = false;
+  v->loop.stores = false;
+  v->loop.iv = iv;
+  loop_scan(&v->loop, loop->lcond);
+  loop_scan(&v->loop, loop->lstep);
+  loop_scan(&v->loop, loop->lbody);
+  if (vl->stmts->size == nodes->size && nodes->size > 0 && !v->loop.calls &&
+      loop_is_invariant(&v->loop, bound) && plan(v, loop, nodes, exprs)) {
+    vl->lanes = 16 / vl->elem->bytes;
+    loop->vloop = vl;
+    v->loops++;
+  } else {
+    while (vl->bases->size > 0) {
+      free(vector_pop(vl->bases));
+    }
+    while (vl->stmts->size > 0) {
+      free(vector_pop(vl->stmts));
+    }
+    vector_free(vl->bases);
+    vector_free(vl->stmts);
+    vector_free(vl->fixed);
+    free(vl);
+  }
+  vector_free(nodes);
+  vector_free(exprs);
+  vector_free(v->loop.written);
+  v->loop.iv = NULL;
+  v->vl = NULL;
+}
+
+static void walk(vectorizer_t *v, node_t *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case NODE_KIND_BLOCK:
+      for (int i = 0; i < node->statements->size; i++) {
+        walk(v, (node_t *)node->statements->data[i]);
+      }
+      break;
+    case NODE_KIND_IF:
+      walk(v, node->then_body);
+      walk(v, node->else_body);
+      break;
+    case NODE_KIND_WHILE:
+    case NODE_KIND_DO:
+    case NODE_KIND_FOR:
+      process_loop(v, node);
+      break;
+    case NODE_KIND_SWITCH:
+      walk(v, node->sbody);
+      break;
+    case NODE_KIND_CASE:
+      walk(v, node->cstmt);
+      break;
+    }
+  }
+}
+
+void vectorize(parse_t *parse) {
+  vectorizer_t v = {0};
+  v.parse = parse;
+  vector_t *stmts = parse->statements;
+  for (int i = 0; i < stmts->size; i++) {
+    node_t *node = (node_t *)stmts->data[i];
+    if (node->kind != NODE_KIND_FUNCTION) {
+      continue;
+    }
+    v.loop.addressed = vector_new();
+    loop_collect_addressed(v.loop.addressed, node->fbody);
+    walk(&v, node->fbody);
+    vector_free(v.loop.addressed);
+  }
+
+  if (parse->option->stats) {
+    fprintf(stderr, "vectorize loops %d\n", v.loops);
+  }
+}